@@ -2,13 +2,27 @@
 
 # Build WebAssembly module for high-performance audio processing
 # Requires Emscripten SDK to be installed and activated
+#
+# ./build_wasm.sh --bench [block_samples] [iterations] instead builds
+# audio_kernel_bench for node, with the module's SIMD and math flags, and
+# runs it for the wasm kernel, spectrum and codec numbers
+
+if [ "$1" = "--bench" ]; then
+    mkdir -p build/wasm
+    em++ src/fast_audio_processor.cpp \
+        -O3 -msimd128 -ffast-math -DFAST_AUDIO_BENCHMARK \
+        -s ENVIRONMENT=node -s ALLOW_MEMORY_GROWTH=1 -s EXIT_RUNTIME=1 \
+        -o build/wasm/audio_kernel_bench.js || exit 1
+    node build/wasm/audio_kernel_bench.js "${@:2}"
+    exit $?
+fi
 
 echo "Building High-Performance Audio Processor WASM module..."
 
 # Set optimization flags for maximum performance
 EMCC_FLAGS="-O3 -s WASM=1 -s EXPORT_ES6=1 -s MODULARIZE=1 -s EXPORT_NAME='FastAudioModule'"
 EMCC_FLAGS="$EMCC_FLAGS -s ALLOW_MEMORY_GROWTH=1 -s INITIAL_MEMORY=33554432"
-EMCC_FLAGS="$EMCC_FLAGS -s EXPORTED_RUNTIME_METHODS='[\"ccall\",\"cwrap\"]'"
+EMCC_FLAGS="$EMCC_FLAGS -s EXPORTED_RUNTIME_METHODS='[\"ccall\",\"cwrap\",\"HEAPF32\"]'"
 EMCC_FLAGS="$EMCC_FLAGS -s ENVIRONMENT='web,worker'"
 EMCC_FLAGS="$EMCC_FLAGS -s USE_PTHREADS=0 -s DISABLE_EXCEPTION_CATCHING=1"
 EMCC_FLAGS="$EMCC_FLAGS -s AGGRESSIVE_VARIABLE_ELIMINATION=1"
@@ -35,12 +49,26 @@ emcc src/fast_audio_processor.cpp \
     -s ENVIRONMENT='worker' \
     -o ../../client/public/wasm/fast_audio_worker.js
 
+# SharedArrayBuffer/pthreads variant: spectrum analysis runs on its own
+# thread (startBackgroundAnalysis). Memory is fixed-size so views into the
+# shared heap stay valid. Serving it needs cross-origin isolation
+# (Cross-Origin-Opener-Policy: same-origin, Cross-Origin-Embedder-Policy: require-corp).
+THREAD_FLAGS="${EMCC_FLAGS//-s USE_PTHREADS=0/-pthread -s PTHREAD_POOL_SIZE=1}"
+THREAD_FLAGS="${THREAD_FLAGS//-s ALLOW_MEMORY_GROWTH=1/-s ALLOW_MEMORY_GROWTH=0}"
+THREAD_FLAGS="${THREAD_FLAGS//-s INITIAL_MEMORY=33554432/-s INITIAL_MEMORY=67108864}"
+THREAD_FLAGS="$THREAD_FLAGS -DFAST_AUDIO_THREADS"
+
+emcc src/fast_audio_processor.cpp \
+    $THREAD_FLAGS \
+    -o ../../client/public/wasm/fast_audio_threads.js
+
 echo "WebAssembly modules built successfully!"
 echo "Modules available at:"
 echo "  - client/public/wasm/fast_audio.js"
 echo "  - client/public/wasm/fast_audio.wasm"
 echo "  - client/public/wasm/fast_audio_worker.js"
 echo "  - client/public/wasm/fast_audio_worker.wasm"
+echo "  - client/public/wasm/fast_audio_threads.js (+ .wasm, needs COOP/COEP)"
 
 # Set executable permissions
 chmod +x ../../client/public/wasm/*.js
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+
+namespace catch_streaming {
+
+// Client control protocol, shared by the server and control_parser_fuzz
+enum class ControlAction { none, play, pause, resume, seek, stop, set_quality, join, leave };
+
+// One decoded control message. String fields are views into the payload and
+// are only valid while the websocketpp message is alive.
+struct ControlMessage {
+    ControlAction action = ControlAction::none;
+    std::string_view track_id;
+    std::string_view channel_id; // join/leave: "channel"
+    int64_t position_ms = -1;   // seek: "position_ms", or "position" in seconds
+    int64_t offset = -1;        // resume: byte offset
+    int32_t quality_kbps = 0;   // set-quality: "quality" as kbps or low/medium/high
+};
+
+// Single-pass, allocation-free parser for the client control protocol, e.g.
+//   {"action": "seek", "track_id": "abc123", "position_ms": 90500}
+// Keys may come in any order with arbitrary whitespace; unknown keys (with
+// any value, nested or not) are skipped.
+class ControlParser {
+public:
+    static bool parse(std::string_view json, ControlMessage& out) {
+        ControlParser parser(json);
+        out = ControlMessage();
+        return parser.parse_object(out);
+    }
+    
+    static const char* action_name(ControlAction action) {
+        switch (action) {
+            case ControlAction::play: return "play";
+            case ControlAction::pause: return "pause";
+            case ControlAction::resume: return "resume";
+            case ControlAction::seek: return "seek";
+            case ControlAction::stop: return "stop";
+            case ControlAction::set_quality: return "set-quality";
+            case ControlAction::join: return "join";
+            case ControlAction::leave: return "leave";
+            default: return "none";
+        }
+    }
+    
+private:
+    static const int MAX_DEPTH = 16;
+    static constexpr double MAX_INTEGER = 9007199254740992.0; // 2^53, exact as a double
+    // The server builds with -ffast-math, which drops isfinite() checks, so
+    // parse_number keeps the mantissa below 10 * 2^53 and the exponent in a
+    // range where the product stays finite
+    static const int MAX_EXPONENT = 290;
+    static const int MIN_EXPONENT = -400;
+    
+    explicit ControlParser(std::string_view json) : input(json) {}
+    
+    bool parse_object(ControlMessage& out) {
+        skip_ws();
+        if (!consume('{')) return false;
+        skip_ws();
+        if (consume('}')) return at_end();
+        
+        for (;;) {
+            std::string_view key;
+            bool escaped = false;
+            skip_ws();
+            if (!parse_string(key, escaped) || !(skip_ws(), consume(':'))) return false;
+            skip_ws();
+            if (!parse_member(key, out)) return false;
+            skip_ws();
+            if (consume('}')) return at_end();
+            if (!consume(',')) return false;
+        }
+    }
+    
+    bool parse_member(std::string_view key, ControlMessage& out) {
+        if (key == "action") {
+            std::string_view value;
+            bool escaped = false;
+            if (!parse_string(value, escaped)) return false;
+            out.action = escaped ? ControlAction::none : to_action(value);
+            return true;
+        }
+        if (key == "track_id") {
+            bool escaped = false;
+            // Escaped ids are passed through raw; TrackCache rejects them
+            return parse_string(out.track_id, escaped);
+        }
+        if (key == "channel") {
+            bool escaped = false;
+            return parse_string(out.channel_id, escaped);
+        }
+        if (key == "position_ms" || key == "position" || key == "offset") {
+            double value = 0;
+            if (!parse_number(value) || value < 0) return false;
+            if (key == "position") value *= 1000.0;
+            // Out of int64 range is malformed, and converting it would be UB
+            if (value > MAX_INTEGER) return false;
+            if (key == "offset") out.offset = static_cast<int64_t>(value);
+            else out.position_ms = static_cast<int64_t>(value);
+            return true;
+        }
+        if (key == "quality") {
+            if (peek() == '"') {
+                std::string_view name;
+                bool escaped = false;
+                if (!parse_string(name, escaped)) return false;
+                out.quality_kbps = name == "low" ? 64 : name == "medium" ? 128 :
+                                   name == "high" ? 320 : 0;
+                return true;
+            }
+            double kbps = 0;
+            if (!parse_number(kbps) || kbps < 0 || kbps > 10000) return false;
+            out.quality_kbps = static_cast<int32_t>(kbps);
+            return true;
+        }
+        return skip_value();
+    }
+    
+    static ControlAction to_action(std::string_view name) {
+        if (name == "play") return ControlAction::play;
+        if (name == "pause") return ControlAction::pause;
+        if (name == "resume") return ControlAction::resume;
+        if (name == "seek") return ControlAction::seek;
+        if (name == "stop") return ControlAction::stop;
+        if (name == "set-quality" || name == "set_quality") return ControlAction::set_quality;
+        if (name == "join") return ControlAction::join;
+        if (name == "leave") return ControlAction::leave;
+        return ControlAction::none;
+    }
+    
+    // String contents without the quotes; escapes are validated, not decoded
+    bool parse_string(std::string_view& value, bool& escaped) {
+        if (!consume('"')) return false;
+        const size_t start = pos;
+        escaped = false;
+        while (pos < input.size()) {
+            const char c = input[pos];
+            if (c == '"') {
+                value = input.substr(start, pos - start);
+                ++pos;
+                return true;
+            }
+            if (static_cast<unsigned char>(c) < 0x20) return false;
+            if (c == '\\') {
+                escaped = true;
+                if (++pos >= input.size()) return false;
+                if (input[pos] == 'u') {
+                    if (pos + 4 >= input.size()) return false;
+                    for (size_t i = 1; i <= 4; ++i) {
+                        if (!std::isxdigit(static_cast<unsigned char>(input[pos + i]))) return false;
+                    }
+                    pos += 4;
+                } else if (!std::strchr("\"\\/bfnrt", input[pos])) {
+                    return false;
+                }
+            }
+            ++pos;
+        }
+        return false;
+    }
+    
+    bool parse_number(double& value) {
+        const size_t start = pos;
+        bool negative = consume('-');
+        double mantissa = 0;
+        int64_t exponent = 0;
+        int digits = 0;
+        // Digits past 2^53 are below double precision; integer ones still
+        // count towards the magnitude, fraction ones are dropped
+        while (pos < input.size() && is_digit(input[pos])) {
+            if (mantissa < MAX_INTEGER) {
+                mantissa = mantissa * 10 + (input[pos] - '0');
+            } else {
+                exponent++;
+            }
+            ++pos;
+            digits++;
+        }
+        if (digits == 0) return false;
+        
+        if (consume('.')) {
+            int fraction_digits = 0;
+            while (pos < input.size() && is_digit(input[pos])) {
+                if (mantissa < MAX_INTEGER) {
+                    mantissa = mantissa * 10 + (input[pos] - '0');
+                    exponent--;
+                }
+                ++pos;
+                fraction_digits++;
+            }
+            if (fraction_digits == 0) return false;
+        }
+        if (pos < input.size() && (input[pos] == 'e' || input[pos] == 'E')) {
+            ++pos;
+            const bool negative_exp = consume('-');
+            if (!negative_exp) consume('+');
+            int exp_value = 0;
+            int exp_digits = 0;
+            while (pos < input.size() && is_digit(input[pos])) {
+                exp_value = std::min(exp_value * 10 + (input[pos++] - '0'), 400);
+                exp_digits++;
+            }
+            if (exp_digits == 0) return false;
+            exponent += negative_exp ? -exp_value : exp_value;
+        }
+        
+        if (mantissa == 0) {
+            value = 0; // Whatever the exponent; 0 * pow() could be 0 * inf
+        } else if (exponent > MAX_EXPONENT) {
+            // Beyond any field's range; saturate rather than produce inf
+            value = negative ? -std::numeric_limits<double>::max() : std::numeric_limits<double>::max();
+        } else {
+            const int clamped = static_cast<int>(std::max<int64_t>(exponent, MIN_EXPONENT));
+            value = scale(negative ? -mantissa : mantissa, clamped);
+        }
+        return pos > start;
+    }
+    
+    // Powers of ten up to 1e22 are exact doubles, so "1.5" scales to exactly
+    // 1.5 even where fast-math pow() would be a few ulps low
+    static double scale(double mantissa, int exponent) {
+        static const double EXACT[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                       1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        const int max_exact = static_cast<int>(sizeof(EXACT) / sizeof(EXACT[0])) - 1;
+        if (exponent >= 0 && exponent <= max_exact) return mantissa * EXACT[exponent];
+        if (exponent < 0 && -exponent <= max_exact) return mantissa / EXACT[-exponent];
+        return mantissa * std::pow(10.0, exponent);
+    }
+    
+    // Skips any JSON value without materializing it
+    bool skip_value() {
+        char open_containers[MAX_DEPTH]; // '{' or '[' for each level
+        int depth = 0;
+        for (;;) {
+            skip_ws();
+            const char c = peek();
+            if (c == '{' || c == '[') {
+                if (depth == MAX_DEPTH) return false;
+                ++pos;
+                skip_ws();
+                if (!consume(c == '{' ? '}' : ']')) {
+                    open_containers[depth++] = c;
+                    if (c == '{' && !skip_key()) return false;
+                    continue; // Now at the first element's value
+                }
+            } else if (c == '"') {
+                std::string_view ignored;
+                bool escaped = false;
+                if (!parse_string(ignored, escaped)) return false;
+            } else if (c == '-' || is_digit(c)) {
+                double ignored = 0;
+                if (!parse_number(ignored)) return false;
+            } else if (!consume_literal("true") && !consume_literal("false") &&
+                       !consume_literal("null")) {
+                return false;
+            }
+            
+            // After a value: either the next element, or close containers
+            for (;;) {
+                if (depth == 0) return true;
+                skip_ws();
+                const char container = open_containers[depth - 1];
+                if (consume(',')) {
+                    if (container == '{' && !skip_key()) return false;
+                    break;
+                }
+                if (!consume(container == '{' ? '}' : ']')) return false;
+                --depth;
+            }
+        }
+    }
+    
+    bool skip_key() {
+        std::string_view ignored;
+        bool escaped = false;
+        skip_ws();
+        if (!parse_string(ignored, escaped)) return false;
+        skip_ws();
+        return consume(':');
+    }
+    
+    char peek() const { return pos < input.size() ? input[pos] : '\0'; }
+    
+    bool consume(char c) {
+        if (pos < input.size() && input[pos] == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+    
+    bool consume_literal(std::string_view literal) {
+        if (input.substr(pos, literal.size()) == literal) {
+            pos += literal.size();
+            return true;
+        }
+        return false;
+    }
+    
+    void skip_ws() {
+        while (pos < input.size() && (input[pos] == ' ' || input[pos] == '\t' ||
+                                      input[pos] == '\n' || input[pos] == '\r')) {
+            ++pos;
+        }
+    }
+    
+    bool at_end() {
+        skip_ws();
+        return pos == input.size();
+    }
+    
+    static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+    
+    std::string_view input;
+    size_t pos = 0;
+};
+
+} // namespace catch_streaming
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace catch_streaming {
+
+// Log-linear latency histogram in the style of HdrHistogram: 16 linear
+// sub-buckets per power of two, so any recorded value is known to within
+// 6.25%. Values are integer microseconds.
+class LatencyHistogram {
+public:
+    static const size_t SUB_BUCKETS = 16;
+    static const size_t BUCKET_COUNT = 40 * SUB_BUCKETS; // Up to ~2^39 us
+    
+    static size_t bucket_for(uint64_t value) {
+        if (value < SUB_BUCKETS) return static_cast<size_t>(value);
+        const unsigned shift = 63 - __builtin_clzll(value) - 4; // value >> shift in [16, 32)
+        const size_t index = (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+        return std::min(index, BUCKET_COUNT - 1);
+    }
+    
+    // Smallest value that lands in `index`
+    static uint64_t bucket_lower(size_t index) {
+        if (index < SUB_BUCKETS) return index;
+        const unsigned shift = index / SUB_BUCKETS - 1;
+        return (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    }
+    
+    // Single writer (the owning thread); any thread may read
+    void record(uint64_t value) {
+        bump(counts[bucket_for(value)], 1);
+        bump(total, 1);
+        bump(sum, value);
+    }
+    
+    struct Snapshot {
+        std::vector<uint64_t> counts = std::vector<uint64_t>(BUCKET_COUNT);
+        uint64_t total = 0;
+        uint64_t sum = 0;
+        
+        void add(const LatencyHistogram& histogram) {
+            for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+                counts[i] += histogram.counts[i].load(std::memory_order_relaxed);
+            }
+            total += histogram.total.load(std::memory_order_relaxed);
+            sum += histogram.sum.load(std::memory_order_relaxed);
+        }
+        
+        // Number of samples strictly below `value`, exact at powers of two
+        uint64_t count_below(uint64_t value) const {
+            uint64_t below = 0;
+            for (size_t i = 0; i < BUCKET_COUNT && bucket_lower(i) < value; ++i) {
+                below += counts[i];
+            }
+            return below;
+        }
+        
+        uint64_t value_at_quantile(double q) const {
+            if (total == 0) return 0;
+            const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * total)));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+                seen += counts[i];
+                if (seen >= rank) {
+                    return i + 1 < BUCKET_COUNT ? bucket_lower(i + 1) - 1 : bucket_lower(i);
+                }
+            }
+            return bucket_lower(BUCKET_COUNT - 1);
+        }
+    };
+    
+private:
+    static void bump(std::atomic<uint64_t>& cell, uint64_t delta) {
+        // Plain load/store: only the owning thread writes
+        cell.store(cell.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+    
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> counts{};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum{0};
+};
+
+} // namespace catch_streaming
@@ -0,0 +1,186 @@
+// Fuzz target for ControlParser::parse.
+//
+// Built with clang this is a libFuzzer target:
+//   ./control_parser_fuzz fuzz/control_parser_corpus
+// Elsewhere (CATCH_FUZZ_STANDALONE) a small driver replays the corpus and
+// then runs seeded random mutations of it, so a run is reproducible from
+// its seed:
+//   ./control_parser_fuzz -runs=2000000 -seed=1 fuzz/control_parser_corpus
+// Both builds run under ASan/UBSan; any report, or a broken invariant
+// below, aborts with the offending input.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include "control_parser.hpp"
+
+using catch_streaming::ControlMessage;
+using catch_streaming::ControlParser;
+
+namespace {
+
+// Views must point into the payload, since the server reads them after parsing
+bool within(std::string_view field, std::string_view input) {
+    return field.empty() ||
+           (field.data() >= input.data() && field.data() + field.size() <= input.data() + input.size());
+}
+
+void check(bool condition, const char* what) {
+    if (!condition) {
+        std::fprintf(stderr, "control_parser_fuzz: invariant failed: %s\n", what);
+        std::abort();
+    }
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    const std::string_view input(reinterpret_cast<const char*>(data), size);
+    ControlMessage message;
+    const bool parsed = ControlParser::parse(input, message);
+
+    ControlMessage again;
+    check(ControlParser::parse(input, again) == parsed, "parse is deterministic");
+    if (!parsed) {
+        return 0;
+    }
+    check(within(message.track_id, input), "track_id lies in the payload");
+    check(within(message.channel_id, input), "channel id lies in the payload");
+    check(message.position_ms >= -1, "position_ms is unset or non-negative");
+    check(message.offset >= -1, "offset is unset or non-negative");
+    check(message.quality_kbps >= 0 && message.quality_kbps <= 10000, "quality is in range");
+    check(ControlParser::action_name(message.action) != nullptr, "action has a name");
+    return 0;
+}
+
+#ifdef CATCH_FUZZ_STANDALONE
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace {
+
+// Tokens the mutator splices in; libFuzzer finds these on its own
+const char* const DICTIONARY[] = {
+    "{", "}", "[", "]", ":", ",", "\"", "\\", "\\u00e9", "\\\"", "true", "false", "null",
+    "-", "0", "1e308", "1e-400", "9223372036854775807", ".5", "E+", "\"action\"", "\"track_id\"",
+    "\"channel\"", "\"position\"", "\"position_ms\"", "\"offset\"", "\"quality\"", "\"seek\"",
+    "\"set-quality\"", "\"join\"", "\"low\"", " ", "\n"
+};
+
+struct Random {
+    uint64_t state;
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+    size_t below(size_t n) { return n ? static_cast<size_t>(next() % n) : 0; }
+};
+
+void add_file(const std::string& path, std::vector<std::string>& corpus) {
+    std::ifstream file(path, std::ios::binary);
+    if (file) {
+        corpus.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+}
+
+void add_path(const std::string& path, std::vector<std::string>& corpus) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        std::fprintf(stderr, "control_parser_fuzz: cannot read %s\n", path.c_str());
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        add_file(path, corpus);
+        return;
+    }
+    DIR* dir = opendir(path.c_str());
+    if (!dir) return;
+    while (dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') {
+            add_file(path + "/" + entry->d_name, corpus);
+        }
+    }
+    closedir(dir);
+}
+
+// One to four edits: byte flips, deletions, duplicated ranges, dictionary
+// tokens and splices from another input
+std::string mutate(const std::vector<std::string>& corpus, Random& random) {
+    std::string input = corpus[random.below(corpus.size())];
+    const size_t edits = 1 + random.below(4);
+    for (size_t e = 0; e < edits; ++e) {
+        const size_t at = random.below(input.size() + 1);
+        switch (random.below(5)) {
+            case 0:
+                if (!input.empty()) input[random.below(input.size())] ^= static_cast<char>(1 << random.below(8));
+                break;
+            case 1:
+                input.erase(at, 1 + random.below(8));
+                break;
+            case 2:
+                if (at < input.size()) input.insert(at, input.substr(at, 1 + random.below(16)));
+                break;
+            case 3:
+                input.insert(at, DICTIONARY[random.below(sizeof(DICTIONARY) / sizeof(DICTIONARY[0]))]);
+                break;
+            default: {
+                const std::string& other = corpus[random.below(corpus.size())];
+                const size_t from = random.below(other.size() + 1);
+                input.insert(at, other.substr(from, random.below(other.size() - from + 1)));
+                break;
+            }
+        }
+    }
+    return input;
+}
+
+void run_one(const std::string& input) {
+    // Copy to an exact-size heap buffer so ASan catches reads past the end
+    std::vector<uint8_t> bytes(input.begin(), input.end());
+    LLVMFuzzerTestOneInput(bytes.data(), bytes.size());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    uint64_t runs = 0;
+    uint64_t seed = 1;
+    std::vector<std::string> corpus;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg.compare(0, 6, "-runs=") == 0) {
+            runs = std::strtoull(arg.c_str() + 6, nullptr, 10);
+        } else if (arg.compare(0, 6, "-seed=") == 0) {
+            seed = std::strtoull(arg.c_str() + 6, nullptr, 10);
+        } else {
+            add_path(arg, corpus);
+        }
+    }
+    if (corpus.empty()) {
+        std::fprintf(stderr, "usage: %s [-runs=N] [-seed=S] corpus_dir_or_file...\n", argv[0]);
+        return 1;
+    }
+
+    for (const auto& input : corpus) {
+        run_one(input);
+    }
+    Random random{seed ? seed : 1};
+    for (uint64_t run = 0; run < runs; ++run) {
+        const std::string input = mutate(corpus, random);
+        run_one(input);
+    }
+    std::printf("control_parser_fuzz: %zu corpus inputs, %llu mutations (seed %llu), no failures\n",
+                corpus.size(), static_cast<unsigned long long>(runs), static_cast<unsigned long long>(seed));
+    return 0;
+}
+#endif // CATCH_FUZZ_STANDALONE
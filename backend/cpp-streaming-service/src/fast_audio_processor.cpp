@@ -1,237 +1,3624 @@
+#ifdef __EMSCRIPTEN__
 #include <emscripten/bind.h>
 #include <emscripten/val.h>
+#endif
 #include <vector>
+#include <array>
+#include <string>
 #include <memory>
 #include <cmath>
 #include <algorithm>
 #include <atomic>
 #include <thread>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 namespace fast_audio {
 
-class HighPerformanceAudioProcessor {
+// Sample kernels used by the processor, in one portable version and one per
+// instruction set. All of them work in place on caller-owned buffers; none
+// allocate. The widest set the CPU supports is picked once at startup
+// (native x86) or at compile time (NEON, wasm simd128).
+namespace kernels {
+
+struct KernelTable {
+    const char* name;
+    void (*scale)(float* samples, size_t count, float gain);
+    void (*scale_clamp)(float* samples, size_t count, float gain, float limit);
+    void (*clamp)(float* samples, size_t count, float limit);
+    void (*crossfade)(const float* from, const float* to, float* out, size_t count, float fade);
+    // Accumulate into out, for mixing voices: one gain, or one per sample
+    void (*mix)(const float* in, float* out, size_t count, float gain);
+    void (*mix_curve)(const float* in, const float* gains, float* out, size_t count);
+};
+
+static void scale_scalar(float* samples, size_t count, float gain) {
+    for (size_t i = 0; i < count; ++i) {
+        samples[i] *= gain;
+    }
+}
+
+static void scale_clamp_scalar(float* samples, size_t count, float gain, float limit) {
+    for (size_t i = 0; i < count; ++i) {
+        samples[i] = std::min(std::max(samples[i] * gain, -limit), limit);
+    }
+}
+
+static void clamp_scalar(float* samples, size_t count, float limit) {
+    for (size_t i = 0; i < count; ++i) {
+        samples[i] = std::min(std::max(samples[i], -limit), limit);
+    }
+}
+
+static void crossfade_scalar(const float* from, const float* to, float* out, size_t count, float fade) {
+    const float keep = 1.0f - fade;
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = from[i] * keep + to[i] * fade;
+    }
+}
+
+static void mix_scalar(const float* in, float* out, size_t count, float gain) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] += in[i] * gain;
+    }
+}
+
+static void mix_curve_scalar(const float* in, const float* gains, float* out, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] += in[i] * gains[i];
+    }
+}
+
+static const KernelTable scalar_kernels = {
+    "scalar", scale_scalar, scale_clamp_scalar, clamp_scalar, crossfade_scalar,
+    mix_scalar, mix_curve_scalar
+};
+
+#if defined(__SSE2__)
+static void scale_sse(float* samples, size_t count, float gain) {
+    const __m128 g = _mm_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), g));
+    }
+    scale_scalar(samples + i, count - i, gain);
+}
+
+static void scale_clamp_sse(float* samples, size_t count, float gain, float limit) {
+    const __m128 g = _mm_set1_ps(gain);
+    const __m128 hi = _mm_set1_ps(limit);
+    const __m128 lo = _mm_set1_ps(-limit);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 v = _mm_mul_ps(_mm_loadu_ps(samples + i), g);
+        _mm_storeu_ps(samples + i, _mm_min_ps(_mm_max_ps(v, lo), hi));
+    }
+    scale_clamp_scalar(samples + i, count - i, gain, limit);
+}
+
+static void clamp_sse(float* samples, size_t count, float limit) {
+    const __m128 hi = _mm_set1_ps(limit);
+    const __m128 lo = _mm_set1_ps(-limit);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(samples + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(samples + i), lo), hi));
+    }
+    clamp_scalar(samples + i, count - i, limit);
+}
+
+static void crossfade_sse(const float* from, const float* to, float* out, size_t count, float fade) {
+    const __m128 keep = _mm_set1_ps(1.0f - fade);
+    const __m128 take = _mm_set1_ps(fade);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 a = _mm_mul_ps(_mm_loadu_ps(from + i), keep);
+        const __m128 b = _mm_mul_ps(_mm_loadu_ps(to + i), take);
+        _mm_storeu_ps(out + i, _mm_add_ps(a, b));
+    }
+    crossfade_scalar(from + i, to + i, out + i, count - i, fade);
+}
+
+static void mix_sse(const float* in, float* out, size_t count, float gain) {
+    const __m128 g = _mm_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 v = _mm_mul_ps(_mm_loadu_ps(in + i), g);
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), v));
+    }
+    mix_scalar(in + i, out + i, count - i, gain);
+}
+
+static void mix_curve_sse(const float* in, const float* gains, float* out, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 v = _mm_mul_ps(_mm_loadu_ps(in + i), _mm_loadu_ps(gains + i));
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), v));
+    }
+    mix_curve_scalar(in + i, gains + i, out + i, count - i);
+}
+
+static const KernelTable sse_kernels = {
+    "sse", scale_sse, scale_clamp_sse, clamp_sse, crossfade_sse, mix_sse, mix_curve_sse
+};
+
+// AVX2/FMA is compiled per function so the module still runs on older CPUs
+#define FAST_AUDIO_AVX2 __attribute__((target("avx2,fma")))
+
+FAST_AUDIO_AVX2 static void scale_avx2(float* samples, size_t count, float gain) {
+    const __m256 g = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256 a = _mm256_mul_ps(_mm256_loadu_ps(samples + i), g);
+        const __m256 b = _mm256_mul_ps(_mm256_loadu_ps(samples + i + 8), g);
+        _mm256_storeu_ps(samples + i, a);
+        _mm256_storeu_ps(samples + i + 8, b);
+    }
+    scale_scalar(samples + i, count - i, gain);
+}
+
+FAST_AUDIO_AVX2 static void scale_clamp_avx2(float* samples, size_t count, float gain, float limit) {
+    const __m256 g = _mm256_set1_ps(gain);
+    const __m256 hi = _mm256_set1_ps(limit);
+    const __m256 lo = _mm256_set1_ps(-limit);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256 a = _mm256_mul_ps(_mm256_loadu_ps(samples + i), g);
+        const __m256 b = _mm256_mul_ps(_mm256_loadu_ps(samples + i + 8), g);
+        _mm256_storeu_ps(samples + i, _mm256_min_ps(_mm256_max_ps(a, lo), hi));
+        _mm256_storeu_ps(samples + i + 8, _mm256_min_ps(_mm256_max_ps(b, lo), hi));
+    }
+    scale_clamp_scalar(samples + i, count - i, gain, limit);
+}
+
+FAST_AUDIO_AVX2 static void clamp_avx2(float* samples, size_t count, float limit) {
+    const __m256 hi = _mm256_set1_ps(limit);
+    const __m256 lo = _mm256_set1_ps(-limit);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(samples + i, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(samples + i), lo), hi));
+    }
+    clamp_scalar(samples + i, count - i, limit);
+}
+
+FAST_AUDIO_AVX2 static void crossfade_avx2(const float* from, const float* to, float* out,
+                                           size_t count, float fade) {
+    // from + (to - from) * fade, one FMA per sample
+    const __m256 take = _mm256_set1_ps(fade);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 a = _mm256_loadu_ps(from + i);
+        const __m256 b = _mm256_loadu_ps(to + i);
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_sub_ps(b, a), take, a));
+    }
+    crossfade_scalar(from + i, to + i, out + i, count - i, fade);
+}
+
+FAST_AUDIO_AVX2 static void mix_avx2(const float* in, float* out, size_t count, float gain) {
+    const __m256 g = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_loadu_ps(in + i), g, _mm256_loadu_ps(out + i)));
+    }
+    mix_scalar(in + i, out + i, count - i, gain);
+}
+
+FAST_AUDIO_AVX2 static void mix_curve_avx2(const float* in, const float* gains, float* out,
+                                           size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 g = _mm256_loadu_ps(gains + i);
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_loadu_ps(in + i), g, _mm256_loadu_ps(out + i)));
+    }
+    mix_curve_scalar(in + i, gains + i, out + i, count - i);
+}
+
+static const KernelTable avx2_kernels = {
+    "avx2", scale_avx2, scale_clamp_avx2, clamp_avx2, crossfade_avx2, mix_avx2, mix_curve_avx2
+};
+#endif // __SSE2__
+
+#if defined(__ARM_NEON)
+static void scale_neon(float* samples, size_t count, float gain) {
+    const float32x4_t g = vdupq_n_f32(gain);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(samples + i, vmulq_f32(vld1q_f32(samples + i), g));
+    }
+    scale_scalar(samples + i, count - i, gain);
+}
+
+static void scale_clamp_neon(float* samples, size_t count, float gain, float limit) {
+    const float32x4_t g = vdupq_n_f32(gain);
+    const float32x4_t hi = vdupq_n_f32(limit);
+    const float32x4_t lo = vdupq_n_f32(-limit);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float32x4_t v = vmulq_f32(vld1q_f32(samples + i), g);
+        vst1q_f32(samples + i, vminq_f32(vmaxq_f32(v, lo), hi));
+    }
+    scale_clamp_scalar(samples + i, count - i, gain, limit);
+}
+
+static void clamp_neon(float* samples, size_t count, float limit) {
+    const float32x4_t hi = vdupq_n_f32(limit);
+    const float32x4_t lo = vdupq_n_f32(-limit);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(samples + i, vminq_f32(vmaxq_f32(vld1q_f32(samples + i), lo), hi));
+    }
+    clamp_scalar(samples + i, count - i, limit);
+}
+
+static void crossfade_neon(const float* from, const float* to, float* out, size_t count, float fade) {
+    const float32x4_t take = vdupq_n_f32(fade);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float32x4_t a = vld1q_f32(from + i);
+        const float32x4_t b = vld1q_f32(to + i);
+        vst1q_f32(out + i, vmlaq_f32(a, vsubq_f32(b, a), take));
+    }
+    crossfade_scalar(from + i, to + i, out + i, count - i, fade);
+}
+
+static void mix_neon(const float* in, float* out, size_t count, float gain) {
+    const float32x4_t g = vdupq_n_f32(gain);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(out + i, vmlaq_f32(vld1q_f32(out + i), vld1q_f32(in + i), g));
+    }
+    mix_scalar(in + i, out + i, count - i, gain);
+}
+
+static void mix_curve_neon(const float* in, const float* gains, float* out, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(out + i, vmlaq_f32(vld1q_f32(out + i), vld1q_f32(in + i), vld1q_f32(gains + i)));
+    }
+    mix_curve_scalar(in + i, gains + i, out + i, count - i);
+}
+
+static const KernelTable neon_kernels = {
+    "neon", scale_neon, scale_clamp_neon, clamp_neon, crossfade_neon, mix_neon, mix_curve_neon
+};
+#endif // __ARM_NEON
+
+#if defined(__wasm_simd128__)
+static void scale_wasm(float* samples, size_t count, float gain) {
+    const v128_t g = wasm_f32x4_splat(gain);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        wasm_v128_store(samples + i, wasm_f32x4_mul(wasm_v128_load(samples + i), g));
+    }
+    scale_scalar(samples + i, count - i, gain);
+}
+
+static void scale_clamp_wasm(float* samples, size_t count, float gain, float limit) {
+    const v128_t g = wasm_f32x4_splat(gain);
+    const v128_t hi = wasm_f32x4_splat(limit);
+    const v128_t lo = wasm_f32x4_splat(-limit);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const v128_t v = wasm_f32x4_mul(wasm_v128_load(samples + i), g);
+        // pmin/pmax lower to single instructions; NaN handling is irrelevant here
+        wasm_v128_store(samples + i, wasm_f32x4_pmin(wasm_f32x4_pmax(v, lo), hi));
+    }
+    scale_clamp_scalar(samples + i, count - i, gain, limit);
+}
+
+static void clamp_wasm(float* samples, size_t count, float limit) {
+    const v128_t hi = wasm_f32x4_splat(limit);
+    const v128_t lo = wasm_f32x4_splat(-limit);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        wasm_v128_store(samples + i, wasm_f32x4_pmin(wasm_f32x4_pmax(wasm_v128_load(samples + i), lo), hi));
+    }
+    clamp_scalar(samples + i, count - i, limit);
+}
+
+static void crossfade_wasm(const float* from, const float* to, float* out, size_t count, float fade) {
+    const v128_t keep = wasm_f32x4_splat(1.0f - fade);
+    const v128_t take = wasm_f32x4_splat(fade);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const v128_t a = wasm_f32x4_mul(wasm_v128_load(from + i), keep);
+        const v128_t b = wasm_f32x4_mul(wasm_v128_load(to + i), take);
+        wasm_v128_store(out + i, wasm_f32x4_add(a, b));
+    }
+    crossfade_scalar(from + i, to + i, out + i, count - i, fade);
+}
+
+static void mix_wasm(const float* in, float* out, size_t count, float gain) {
+    const v128_t g = wasm_f32x4_splat(gain);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const v128_t v = wasm_f32x4_mul(wasm_v128_load(in + i), g);
+        wasm_v128_store(out + i, wasm_f32x4_add(wasm_v128_load(out + i), v));
+    }
+    mix_scalar(in + i, out + i, count - i, gain);
+}
+
+static void mix_curve_wasm(const float* in, const float* gains, float* out, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const v128_t v = wasm_f32x4_mul(wasm_v128_load(in + i), wasm_v128_load(gains + i));
+        wasm_v128_store(out + i, wasm_f32x4_add(wasm_v128_load(out + i), v));
+    }
+    mix_curve_scalar(in + i, gains + i, out + i, count - i);
+}
+
+static const KernelTable wasm_kernels = {
+    "wasm-simd128", scale_wasm, scale_clamp_wasm, clamp_wasm, crossfade_wasm, mix_wasm, mix_curve_wasm
+};
+#endif // __wasm_simd128__
+
+static const KernelTable& select_kernels() {
+#if defined(__wasm_simd128__)
+    return wasm_kernels;
+#elif defined(__ARM_NEON)
+    return neon_kernels;
+#elif defined(__SSE2__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return avx2_kernels;
+    }
+    return sse_kernels;
+#else
+    return scalar_kernels;
+#endif
+}
+
+// The best kernels for this machine, chosen on first use
+inline const KernelTable& active() {
+    static const KernelTable& table = select_kernels();
+    return table;
+}
+
+} // namespace kernels
+
+// Heap float buffer aligned for vector loads. Its address only changes on
+// resize, which is what lets JS keep a Float32Array view over it.
+class AlignedBuffer {
+public:
+    static constexpr size_t ALIGNMENT = 64;
+
+    explicit AlignedBuffer(size_t count = 0) { resize(count); }
+
+    // Allocates; zero-fills
+    void resize(size_t count) {
+        storage.reset(count ? static_cast<float*>(
+            ::operator new[](count * sizeof(float), std::align_val_t{ALIGNMENT})) : nullptr);
+        length = count;
+        std::fill(storage.get(), storage.get() + length, 0.0f);
+    }
+
+    float* data() { return storage.get(); }
+    const float* data() const { return storage.get(); }
+    size_t size() const { return length; }
+
+private:
+    struct Release {
+        void operator()(float* p) const { ::operator delete[](p, std::align_val_t{ALIGNMENT}); }
+    };
+    std::unique_ptr<float[], Release> storage;
+    size_t length = 0;
+};
+
+// Up to 7.1; per-channel state is sized for this many
+constexpr size_t MAX_CHANNELS = 8;
+
+// Non-owning planar (structure-of-arrays) audio: `channels` rows of `frames`
+// samples, each row `stride` floats after the previous one. Cheap to copy;
+// the multichannel stages all take one.
+template <typename Sample>
+struct PlanarSpan {
+    Sample* data = nullptr;
+    size_t channels = 0;
+    size_t frames = 0;
+    size_t stride = 0;
+
+    Sample* channel(size_t c) const { return data + c * stride; }
+
+    // The same channels starting `start` frames in, or cut to `count` frames
+    PlanarSpan from(size_t start) const {
+        start = std::min(start, frames);
+        return {data + start, channels, frames - start, stride};
+    }
+    PlanarSpan first(size_t count) const { return {data, channels, std::min(count, frames), stride}; }
+
+    template <typename T = Sample, typename = std::enable_if_t<!std::is_const<T>::value>>
+    operator PlanarSpan<const T>() const { return {data, channels, frames, stride}; }
+};
+
+using PlanarView = PlanarSpan<float>;
+using ConstPlanarView = PlanarSpan<const float>;
+
+// Non-owning interleaved (frame-major) audio, the layout of PCM streams and
+// of the vector API: sample c of frame i is data[i * channels + c]
+template <typename Sample>
+struct InterleavedSpan {
+    Sample* data = nullptr;
+    size_t channels = 0;
+    size_t frames = 0;
+
+    Sample& at(size_t frame, size_t c) const { return data[frame * channels + c]; }
+
+    template <typename T = Sample, typename = std::enable_if_t<!std::is_const<T>::value>>
+    operator InterleavedSpan<const T>() const { return {data, channels, frames}; }
+};
+
+// Owning planar buffer. Every row starts on a cache line, so per-channel
+// loops get aligned vector loads; the rows never move until resize.
+class PlanarBuffer {
+public:
+    static constexpr size_t ROW_ALIGN = AlignedBuffer::ALIGNMENT / sizeof(float);
+
+    // Allocates; zero-fills
+    void resize(size_t channels, size_t frames) {
+        channel_count = std::clamp<size_t>(channels, 1, MAX_CHANNELS);
+        frame_count = frames;
+        row_stride = (frames + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN;
+        storage.resize(channel_count * row_stride);
+    }
+
+    float* channel(size_t c) { return storage.data() + c * row_stride; }
+    const float* channel(size_t c) const { return storage.data() + c * row_stride; }
+    size_t channels() const { return channel_count; }
+    size_t frames() const { return frame_count; }
+
+    PlanarView view() { return {storage.data(), channel_count, frame_count, row_stride}; }
+    ConstPlanarView view() const { return {storage.data(), channel_count, frame_count, row_stride}; }
+
+private:
+    AlignedBuffer storage;
+    size_t channel_count = 1;
+    size_t frame_count = 0;
+    size_t row_stride = 0;
+};
+
+// Layout conversions. Both copy the frames and channels the two sides have
+// in common and return the frame count; stereo gets its own loop so the
+// compiler can vectorize the shuffle.
+inline size_t deinterleave(InterleavedSpan<const float> in, PlanarView out) {
+    const size_t frames = std::min(in.frames, out.frames);
+    const size_t channels = std::min(in.channels, out.channels);
+    if (in.channels == 2 && channels == 2) {
+        float* left = out.channel(0);
+        float* right = out.channel(1);
+        for (size_t i = 0; i < frames; ++i) {
+            left[i] = in.data[2 * i];
+            right[i] = in.data[2 * i + 1];
+        }
+        return frames;
+    }
+    for (size_t c = 0; c < channels; ++c) {
+        float* row = out.channel(c);
+        for (size_t i = 0; i < frames; ++i) {
+            row[i] = in.at(i, c);
+        }
+    }
+    return frames;
+}
+
+inline size_t interleave(ConstPlanarView in, InterleavedSpan<float> out) {
+    const size_t frames = std::min(in.frames, out.frames);
+    const size_t channels = std::min(in.channels, out.channels);
+    if (out.channels == 2 && channels == 2) {
+        const float* left = in.channel(0);
+        const float* right = in.channel(1);
+        for (size_t i = 0; i < frames; ++i) {
+            out.data[2 * i] = left[i];
+            out.data[2 * i + 1] = right[i];
+        }
+        return frames;
+    }
+    for (size_t c = 0; c < channels; ++c) {
+        const float* row = in.channel(c);
+        for (size_t i = 0; i < frames; ++i) {
+            out.at(i, c) = row[i];
+        }
+    }
+    return frames;
+}
+
+// Mono average of all channels into out, which may be in's channel 0
+inline void downmix(ConstPlanarView in, float* out) {
+    if (in.channels == 0) {
+        return;
+    }
+    if (out != in.channel(0)) {
+        std::copy(in.channel(0), in.channel(0) + in.frames, out);
+    }
+    for (size_t c = 1; c < in.channels; ++c) {
+        const float* row = in.channel(c);
+        for (size_t i = 0; i < in.frames; ++i) {
+            out[i] += row[i];
+        }
+    }
+    if (in.channels > 1) {
+        kernels::active().scale(out, in.frames, 1.0f / static_cast<float>(in.channels));
+    }
+}
+
+// Interleaved version; out may alias in.data, since frame i only ever
+// writes at or before where it reads
+inline void downmix(InterleavedSpan<const float> in, float* out) {
+    const float scale = 1.0f / static_cast<float>(std::max<size_t>(in.channels, 1));
+    for (size_t i = 0; i < in.frames; ++i) {
+        float sum = 0.0f;
+        for (size_t c = 0; c < in.channels; ++c) {
+            sum += in.at(i, c);
+        }
+        out[i] = sum * scale;
+    }
+}
+
+// Wait-free single-producer/single-consumer sample FIFO. Positions are
+// free-running counters; capacity is a power of two so wrapping is a mask.
+class SampleRing {
+public:
+    explicit SampleRing(size_t capacity_hint = 0) { reset(capacity_hint); }
+
+    // Not thread-safe; call before either side starts
+    void reset(size_t capacity_hint) {
+        size_t capacity = 1;
+        while (capacity < capacity_hint) {
+            capacity *= 2;
+        }
+        buffer.resize(capacity_hint ? capacity : 0);
+        mask = capacity - 1;
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    size_t capacity() const { return buffer.size(); }
+
+    // Producer: copies what fits, returns how many were written
+    size_t write(const float* samples, size_t count) {
+        const size_t w = head.load(std::memory_order_relaxed);
+        const size_t r = tail.load(std::memory_order_acquire);
+        count = std::min(count, buffer.size() - (w - r));
+        const size_t first = std::min(count, buffer.size() - (w & mask));
+        std::copy(samples, samples + first, buffer.data() + (w & mask));
+        std::copy(samples + first, samples + count, buffer.data());
+        head.store(w + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer: copies up to count out, returns how many were read
+    size_t read(float* samples, size_t count) {
+        const size_t r = tail.load(std::memory_order_relaxed);
+        const size_t w = head.load(std::memory_order_acquire);
+        count = std::min(count, w - r);
+        const size_t first = std::min(count, buffer.size() - (r & mask));
+        std::copy(buffer.data() + (r & mask), buffer.data() + (r & mask) + first, samples);
+        std::copy(buffer.data(), buffer.data() + (count - first), samples + first);
+        tail.store(r + count, std::memory_order_release);
+        return count;
+    }
+
+    // Either side; exact for the caller's own end, a lower bound for the other
+    size_t readable() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    size_t writable() const { return buffer.size() - readable(); }
+
+    // Consumer: drop everything written so far, e.g. on seek
+    void discard() { tail.store(head.load(std::memory_order_acquire), std::memory_order_release); }
+
+private:
+    std::vector<float> buffer;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+// Wait-free single-producer/single-consumer queue of small trivially
+// copyable items, for discrete events the audio thread must see in order.
+// Fixed capacity, no allocation after construction.
+template <typename T, size_t CAPACITY>
+class SpscQueue {
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of two");
+    static_assert(std::is_trivially_copyable<T>::value, "items are copied into slots");
+
+public:
+    // Producer; false when full
+    bool try_push(const T& item) {
+        const size_t w = head.load(std::memory_order_relaxed);
+        if (w - tail.load(std::memory_order_acquire) == CAPACITY) {
+            return false;
+        }
+        slots[w & (CAPACITY - 1)] = item;
+        head.store(w + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer; false when empty
+    bool try_pop(T& item) {
+        const size_t r = tail.load(std::memory_order_relaxed);
+        if (r == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = slots[r & (CAPACITY - 1)];
+        tail.store(r + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, CAPACITY> slots{};
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+// Latest-value handoff of a parameter snapshot from one writer to one
+// reader, neither of which ever waits. It is a double buffer with a spare
+// slot: the writer fills its back slot and swaps it for the shared middle
+// one; the reader swaps the middle into its front slot only when the
+// writer has published since, so it never sees a half-written snapshot.
+template <typename T>
+class SnapshotBuffer {
+    static_assert(std::is_trivially_copyable<T>::value, "snapshots are plain data");
+
+public:
+    // Writer: fill back(), then publish()
+    T& back() { return slots[back_index]; }
+
+    void publish() {
+        back_index = middle.exchange(back_index | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Reader: adopt the newest snapshot; true if it changed
+    bool update() {
+        if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+            return false;
+        }
+        front_index = middle.exchange(front_index, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    const T& front() const { return slots[front_index]; }
+
+private:
+    static constexpr unsigned INDEX = 3;
+    static constexpr unsigned FRESH = 4;
+
+    std::array<T, 3> slots{};
+    alignas(64) std::atomic<unsigned> middle{1};
+    alignas(64) unsigned back_index = 2;
+    alignas(64) unsigned front_index = 0;
+};
+
+// Eight cascaded peaking biquads (RBJ cookbook, transposed direct form II).
+// Any thread may call set_gain; the audio thread picks up new gains at the
+// next block boundary and glides toward them, recomputing coefficients once
+// per block and ramping them per sample so gain changes never click.
+// Channels share coefficients and glide but keep their own filter state.
+class ParametricEqualizer {
+public:
+    static constexpr size_t BANDS = 8;
+    static constexpr float CENTER_HZ[BANDS] = {60.0f, 170.0f, 310.0f, 600.0f,
+                                               1000.0f, 3000.0f, 6000.0f, 12000.0f};
+    static constexpr float Q = 1.2f;
+    static constexpr size_t MAX_BLOCK = 128;
+    static constexpr float MIN_GAIN = 1.0f / 16.0f; // -24 dB
+    static constexpr float MAX_GAIN = 3.0f;
+    static constexpr float SMOOTHING_SECONDS = 0.01f;
+
+    ParametricEqualizer() {
+        for (auto& gain : target_gain) {
+            gain.store(1.0f, std::memory_order_relaxed);
+        }
+        for (size_t b = 0; b < BANDS; ++b) {
+            amp[b] = 1.0f;
+            target_amp[b] = 1.0f;
+        }
+        configure(sample_rate.load(std::memory_order_relaxed));
+    }
+
+    // Linear gain at the band's center frequency; 1 is flat
+    void set_gain(size_t band, float gain) {
+        if (band < BANDS) {
+            target_gain[band].store(std::clamp(gain, 0.0f, MAX_GAIN), std::memory_order_relaxed);
+            version.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    float gain(size_t band) const {
+        return band < BANDS ? target_gain[band].load(std::memory_order_relaxed) : 1.0f;
+    }
+
+    void set_sample_rate(float hz) {
+        if (hz > 0.0f) {
+            sample_rate.store(hz, std::memory_order_relaxed);
+            version.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    // Audio thread only; each channel is filtered on its own
+    void process(PlanarView audio) {
+        audio.channels = std::min(audio.channels, MAX_CHANNELS);
+        for (size_t start = 0; start < audio.frames; start += MAX_BLOCK) {
+            process_block(audio.from(start).first(MAX_BLOCK));
+        }
+    }
+
+    void process(float* samples, size_t count) { process(PlanarView{samples, 1, count, count}); }
+
+    // Audio thread only; forgets filter memory, e.g. when the channel layout changes
+    void reset() {
+        std::fill(&z1[0][0], &z1[0][0] + MAX_CHANNELS * BANDS, 0.0f);
+        std::fill(&z2[0][0], &z2[0][0] + MAX_CHANNELS * BANDS, 0.0f);
+    }
+
+private:
+    std::array<std::atomic<float>, BANDS> target_gain;
+    std::atomic<float> sample_rate{48000.0f};
+    std::atomic<uint32_t> version{0};
+
+    // Audio-thread state, one array per coefficient so per-band updates vectorize
+    uint32_t applied_version = 0;
+    float configured_rate = 0.0f;
+    float glide = 1.0f;
+    alignas(32) float cos_w0[BANDS];
+    alignas(32) float alpha[BANDS];
+    alignas(32) float amp[BANDS];
+    alignas(32) float target_amp[BANDS];
+    alignas(32) float b0[BANDS], b1[BANDS], b2[BANDS], a1[BANDS], a2[BANDS];
+    alignas(32) float z1[MAX_CHANNELS][BANDS] = {}, z2[MAX_CHANNELS][BANDS] = {};
+
+    void configure(float rate) {
+        configured_rate = rate;
+        const float nyquist_guard = rate * 0.45f;
+        for (size_t b = 0; b < BANDS; ++b) {
+            const float w0 = 2.0f * static_cast<float>(M_PI) *
+                std::min(CENTER_HZ[b], nyquist_guard) / rate;
+            cos_w0[b] = std::cos(w0);
+            alpha[b] = std::sin(w0) / (2.0f * Q);
+        }
+        reset();
+        glide = 1.0f - std::exp(-static_cast<float>(MAX_BLOCK) / (SMOOTHING_SECONDS * rate));
+        coefficients_for(amp, b0, b1, b2, a1, a2);
+    }
+
+    void coefficients_for(const float* a, float* nb0, float* nb1, float* nb2,
+                          float* na1, float* na2) const {
+        for (size_t b = 0; b < BANDS; ++b) {
+            const float inv_a0 = 1.0f / (1.0f + alpha[b] / a[b]);
+            nb0[b] = (1.0f + alpha[b] * a[b]) * inv_a0;
+            nb1[b] = -2.0f * cos_w0[b] * inv_a0;
+            nb2[b] = (1.0f - alpha[b] * a[b]) * inv_a0;
+            na1[b] = nb1[b];
+            na2[b] = (1.0f - alpha[b] / a[b]) * inv_a0;
+        }
+    }
+
+    void pick_up_parameters() {
+        const uint32_t current = version.load(std::memory_order_acquire);
+        if (current == applied_version) {
+            return;
+        }
+        applied_version = current;
+        const float rate = sample_rate.load(std::memory_order_relaxed);
+        if (rate != configured_rate) {
+            configure(rate);
+        }
+        for (size_t b = 0; b < BANDS; ++b) {
+            // Peak gain is A^2, so the filter wants the square root
+            const float g = std::max(target_gain[b].load(std::memory_order_relaxed), MIN_GAIN);
+            target_amp[b] = std::sqrt(g);
+        }
+    }
+
+    void process_block(PlanarView block) {
+        const size_t count = block.frames;
+        pick_up_parameters();
+
+        alignas(32) float next_amp[BANDS];
+        // Shorter blocks glide proportionally less so the curve is block-size independent
+        const float step = glide * static_cast<float>(count) / MAX_BLOCK;
+        bool gliding = false;
+        bool flat = true;
+        for (size_t b = 0; b < BANDS; ++b) {
+            const float diff = target_amp[b] - amp[b];
+            if (std::abs(diff) < 1e-4f * target_amp[b]) {
+                next_amp[b] = target_amp[b];
+            } else {
+                next_amp[b] = amp[b] + diff * step;
+            }
+            gliding |= next_amp[b] != amp[b];
+            flat &= amp[b] == 1.0f;
+        }
+        if (!gliding && flat) {
+            return; // every band is the identity filter
+        }
+
+        alignas(32) float nb0[BANDS], nb1[BANDS], nb2[BANDS], na1[BANDS], na2[BANDS];
+        if (gliding) {
+            coefficients_for(next_amp, nb0, nb1, nb2, na1, na2);
+        } else {
+            std::copy(b0, b0 + BANDS, nb0);
+            std::copy(b1, b1 + BANDS, nb1);
+            std::copy(b2, b2 + BANDS, nb2);
+            std::copy(a1, a1 + BANDS, na1);
+            std::copy(a2, a2 + BANDS, na2);
+        }
+        for (size_t c = 0; c < block.channels; ++c) {
+            run_cascade(block.channel(c), count, z1[c], z2[c], nb0, nb1, nb2, na1, na2);
+        }
+
+        // Land exactly on the targets rather than on accumulated rounding
+        std::copy(nb0, nb0 + BANDS, b0);
+        std::copy(nb1, nb1 + BANDS, b1);
+        std::copy(nb2, nb2 + BANDS, b2);
+        std::copy(na1, na1 + BANDS, a1);
+        std::copy(na2, na2 + BANDS, a2);
+        std::copy(next_amp, next_amp + BANDS, amp);
+    }
+
+    // The cascade runs as a wavefront with one band per vector lane: at step t
+    // band k filters sample t - k, taking its input from band k - 1's output of
+    // the previous step. All eight filters then advance together in SIMD
+    // registers, and because the block is processed whole nothing is delayed.
+    // Coefficients ramp linearly from their current values to the targets.
+    void run_cascade(float* samples, size_t count, float* state1, float* state2,
+                     const float* t0, const float* t1, const float* t2,
+                     const float* u1, const float* u2) const {
+        alignas(32) float c0[BANDS], c1[BANDS], c2[BANDS], d1[BANDS], d2[BANDS];
+        alignas(32) float dc0[BANDS], dc1[BANDS], dc2[BANDS], dd1[BANDS], dd2[BANDS];
+        alignas(32) float s1[BANDS], s2[BANDS], x[BANDS], y[BANDS] = {};
+        const float inv_count = 1.0f / static_cast<float>(count);
+        for (size_t b = 0; b < BANDS; ++b) {
+            c0[b] = b0[b]; c1[b] = b1[b]; c2[b] = b2[b]; d1[b] = a1[b]; d2[b] = a2[b];
+            dc0[b] = (t0[b] - c0[b]) * inv_count;
+            dc1[b] = (t1[b] - c1[b]) * inv_count;
+            dc2[b] = (t2[b] - c2[b]) * inv_count;
+            dd1[b] = (u1[b] - d1[b]) * inv_count;
+            dd2[b] = (u2[b] - d2[b]) * inv_count;
+            s1[b] = state1[b];
+            s2[b] = state2[b];
+        }
+
+        const size_t steps = count + BANDS - 1;
+        for (size_t t = 0; t < steps; ++t) {
+            for (size_t b = BANDS - 1; b > 0; --b) {
+                x[b] = y[b - 1];
+            }
+            x[0] = t < count ? samples[t] : 0.0f;
+
+            if (t >= BANDS - 1 && t < count) {
+                // Steady state: every band has a sample
+                for (size_t b = 0; b < BANDS; ++b) {
+                    c0[b] += dc0[b]; c1[b] += dc1[b]; c2[b] += dc2[b];
+                    d1[b] += dd1[b]; d2[b] += dd2[b];
+                    y[b] = c0[b] * x[b] + s1[b];
+                    s1[b] = c1[b] * x[b] - d1[b] * y[b] + s2[b];
+                    s2[b] = c2[b] * x[b] - d2[b] * y[b];
+                }
+            } else {
+                // Filling or draining the wavefront
+                for (size_t b = 0; b < BANDS; ++b) {
+                    if (t < b || t - b >= count) {
+                        continue;
+                    }
+                    c0[b] += dc0[b]; c1[b] += dc1[b]; c2[b] += dc2[b];
+                    d1[b] += dd1[b]; d2[b] += dd2[b];
+                    y[b] = c0[b] * x[b] + s1[b];
+                    s1[b] = c1[b] * x[b] - d1[b] * y[b] + s2[b];
+                    s2[b] = c2[b] * x[b] - d2[b] * y[b];
+                }
+            }
+
+            if (t >= BANDS - 1) {
+                samples[t - (BANDS - 1)] = y[BANDS - 1];
+            }
+        }
+
+        // Flush denormals that a decaying filter leaves behind after silence
+        for (size_t b = 0; b < BANDS; ++b) {
+            state1[b] = std::abs(s1[b]) < 1e-20f ? 0.0f : s1[b];
+            state2[b] = std::abs(s2[b]) < 1e-20f ? 0.0f : s2[b];
+        }
+    }
+};
+
+// Real-input FFT: an N/2-point complex radix-2 transform on the even/odd
+// samples packed as re/im, then one split pass. Twiddles are stored per
+// stage so every butterfly loop walks data and twiddles with unit stride.
+class RealFft {
+public:
+    explicit RealFft(size_t size = 0) { resize(size); }
+
+    // Not realtime-safe; size must be a power of two >= 4
+    void resize(size_t size) {
+        n = size;
+        half = size / 2;
+        re.assign(half, 0.0f);
+        im.assign(half, 0.0f);
+        bit_reverse.assign(half, 0);
+        stage_re.clear();
+        stage_im.clear();
+        split_re.assign(half + 1, 0.0f);
+        split_im.assign(half + 1, 0.0f);
+        if (n < 4) {
+            return;
+        }
+
+        size_t bits = 0;
+        while ((size_t{1} << bits) < half) {
+            ++bits;
+        }
+        for (size_t i = 0; i < half; ++i) {
+            size_t r = 0;
+            for (size_t b = 0; b < bits; ++b) {
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            }
+            bit_reverse[i] = static_cast<uint32_t>(r);
+        }
+
+        for (size_t span = 2; span <= half; span *= 2) {
+            for (size_t k = 0; k < span / 2; ++k) {
+                const double angle = -2.0 * M_PI * static_cast<double>(k) / static_cast<double>(span);
+                stage_re.push_back(static_cast<float>(std::cos(angle)));
+                stage_im.push_back(static_cast<float>(std::sin(angle)));
+            }
+        }
+        for (size_t k = 0; k <= half; ++k) {
+            const double angle = -2.0 * M_PI * static_cast<double>(k) / static_cast<double>(n);
+            split_re[k] = static_cast<float>(std::cos(angle));
+            split_im[k] = static_cast<float>(std::sin(angle));
+        }
+    }
+
+    size_t size() const { return n; }
+
+    // Squared magnitude of bins 0..N/2-1 of n real samples into power
+    void power_spectrum(const float* input, float* power) {
+        for (size_t j = 0; j < half; ++j) {
+            const uint32_t r = bit_reverse[j];
+            re[r] = input[2 * j];
+            im[r] = input[2 * j + 1];
+        }
+
+        size_t twiddle = 0;
+        for (size_t span = 2; span <= half; span *= 2) {
+            const size_t mid = span / 2;
+            const float* wr = stage_re.data() + twiddle;
+            const float* wi = stage_im.data() + twiddle;
+            for (size_t start = 0; start < half; start += span) {
+                float* ar = re.data() + start;
+                float* ai = im.data() + start;
+                float* br = ar + mid;
+                float* bi = ai + mid;
+                for (size_t k = 0; k < mid; ++k) {
+                    const float tr = br[k] * wr[k] - bi[k] * wi[k];
+                    const float ti = br[k] * wi[k] + bi[k] * wr[k];
+                    br[k] = ar[k] - tr;
+                    bi[k] = ai[k] - ti;
+                    ar[k] += tr;
+                    ai[k] += ti;
+                }
+            }
+            twiddle += mid;
+        }
+
+        // X[k] = E[k] + W^k O[k], with E and O recovered from Z[k] and conj(Z[N/2-k])
+        for (size_t k = 0; k < half; ++k) {
+            const size_t m = (half - k) & (half - 1);
+            const float er = 0.5f * (re[k] + re[m]);
+            const float ei = 0.5f * (im[k] - im[m]);
+            const float or_ = 0.5f * (im[k] + im[m]);
+            const float oi = -0.5f * (re[k] - re[m]);
+            const float xr = er + split_re[k] * or_ - split_im[k] * oi;
+            const float xi = ei + split_re[k] * oi + split_im[k] * or_;
+            power[k] = xr * xr + xi * xi;
+        }
+    }
+
+private:
+    size_t n = 0;
+    size_t half = 0;
+    std::vector<float> re, im;
+    std::vector<uint32_t> bit_reverse;
+    std::vector<float> stage_re, stage_im;
+    std::vector<float> split_re, split_im;
+};
+
+// Streaming spectrum for visualizers. Samples go into a history ring; each
+// analyze() runs Hann-windowed frames at 50% overlap over the new audio,
+// averages their power and writes linear bins plus log-spaced buckets into
+// buffers that stay put between calls, so JS can hold typed-array views.
+class SpectrumAnalyzer {
+public:
+    static constexpr size_t MIN_FFT = 64;
+    static constexpr size_t MAX_FFT = 16384;
+    static constexpr size_t MAX_FRAMES = 4;
+    static constexpr float MIN_HZ = 20.0f;
+    static constexpr float FLOOR_DB = -90.0f;
+
+    SpectrumAnalyzer() { configure(2048, 64); }
+
+    // Allocates; call from the UI thread, not per frame
+    void configure(size_t fft_size, size_t bucket_count) {
+        size_t size = MIN_FFT;
+        while (size < fft_size && size < MAX_FFT) {
+            size *= 2;
+        }
+        fft.resize(size);
+        // Enough for MAX_FRAMES frames a hop apart
+        history.assign(size + (MAX_FRAMES - 1) * (size / 2), 0.0f);
+        history_pos = 0;
+        pending = 0;
+        input.assign(size * 2, 0.0f);
+        frame.assign(size, 0.0f);
+        power.assign(size / 2, 0.0f);
+        accumulated.assign(size / 2, 0.0f);
+        bins.assign(size / 2, 0.0f);
+
+        window.resize(size);
+        double window_sum = 0.0;
+        for (size_t i = 0; i < size; ++i) {
+            window[i] = 0.5f - 0.5f * static_cast<float>(std::cos(2.0 * M_PI * i / size));
+            window_sum += window[i];
+        }
+        // A full-scale sine centered on a bin reads 1.0
+        magnitude_scale = static_cast<float>(2.0 / window_sum);
+
+        buckets.assign(std::max<size_t>(bucket_count, 1), 0.0f);
+        bucket_lo.resize(buckets.size());
+        bucket_hi.resize(buckets.size());
+        layout_buckets();
+    }
+
+    void set_sample_rate(float hz) {
+        if (hz > 0.0f && hz != sample_rate) {
+            sample_rate = hz;
+            layout_buckets();
+        }
+    }
+
+    // 0 = raw frames, closer to 1 = slower decay (like AnalyserNode.smoothingTimeConstant)
+    void set_smoothing(float amount) { smoothing = std::clamp(amount, 0.0f, 0.99f); }
+
+    // Staging area JS copies samples into before analyze(count)
+    float* input_data() { return input.data(); }
+    size_t input_capacity() const { return input.size(); }
+
+    const float* bin_data() const { return bins.data(); }
+    size_t bin_count() const { return bins.size(); }
+    const float* bucket_data() const { return buckets.data(); }
+    size_t bucket_count() const { return buckets.size(); }
+    size_t fft_size() const { return fft.size(); }
+
+    // Analyze count samples from the staging buffer; returns frames computed
+    size_t analyze(size_t count) {
+        return analyze(input.data(), std::min(count, input.size()));
+    }
+
+    size_t analyze(const float* samples, size_t count) {
+        const size_t n = fft.size();
+        const size_t hop = n / 2;
+        if (count == 0) {
+            return 0;
+        }
+        push(samples, count);
+        pending += count;
+
+        // Every hop crossed since last time is a frame, newest MAX_FRAMES of them;
+        // a short push still refreshes the display with one frame on the latest audio
+        const size_t frames = std::clamp<size_t>(pending / hop, 1, MAX_FRAMES);
+        pending = pending >= hop ? pending % hop : 0;
+
+        std::fill(accumulated.begin(), accumulated.end(), 0.0f);
+        for (size_t f = 0; f < frames; ++f) {
+            const size_t back = (frames - 1 - f) * hop;
+            load_frame(back);
+            fft.power_spectrum(frame.data(), power.data());
+            for (size_t k = 0; k < power.size(); ++k) {
+                accumulated[k] += power[k];
+            }
+        }
+
+        const float frame_scale = 1.0f / static_cast<float>(frames);
+        const float keep = smoothing;
+        for (size_t k = 0; k < bins.size(); ++k) {
+            const float magnitude = std::sqrt(accumulated[k] * frame_scale) * magnitude_scale;
+            bins[k] = keep * bins[k] + (1.0f - keep) * magnitude;
+        }
+
+        const float db_range = -FLOOR_DB;
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            float peak = 0.0f;
+            for (uint32_t k = bucket_lo[b]; k < bucket_hi[b]; ++k) {
+                peak = std::max(peak, bins[k]);
+            }
+            const float db = 20.0f * std::log10(std::max(peak, 1e-9f));
+            buckets[b] = std::clamp((db - FLOOR_DB) / db_range, 0.0f, 1.0f);
+        }
+        return frames;
+    }
+
+    // Magnitudes of one zero-padded frame of samples, no history involved
+    void single_frame(const float* samples, size_t count) {
+        const size_t n = fft.size();
+        const size_t used = std::min(count, n);
+        const size_t offset = count - used;
+        for (size_t i = 0; i < n; ++i) {
+            frame[i] = i < used ? samples[offset + i] * window[i] : 0.0f;
+        }
+        fft.power_spectrum(frame.data(), power.data());
+        for (size_t k = 0; k < bins.size(); ++k) {
+            bins[k] = std::sqrt(power[k]) * magnitude_scale;
+        }
+    }
+
+private:
+    RealFft fft;
+    std::vector<float> window;
+    std::vector<float> history;
+    size_t history_pos = 0;
+    size_t pending = 0;
+    std::vector<float> input;
+    std::vector<float> frame;
+    std::vector<float> power;
+    std::vector<float> accumulated;
+    std::vector<float> bins;
+    std::vector<float> buckets;
+    std::vector<uint32_t> bucket_lo, bucket_hi;
+    float magnitude_scale = 1.0f;
+    float sample_rate = 48000.0f;
+    float smoothing = 0.5f;
+
+    void push(const float* samples, size_t count) {
+        const size_t n = history.size();
+        if (count >= n) {
+            std::copy(samples + count - n, samples + count, history.begin());
+            history_pos = 0;
+            return;
+        }
+        const size_t first = std::min(count, n - history_pos);
+        std::copy(samples, samples + first, history.begin() + history_pos);
+        std::copy(samples + first, samples + count, history.begin());
+        history_pos = (history_pos + count) % n;
+    }
+
+    // Windowed copy of the n samples ending `back` samples before the newest;
+    // back is at most (MAX_FRAMES - 1) hops, so the frame is all in history
+    void load_frame(size_t back) {
+        const size_t n = frame.size();
+        const size_t length = history.size();
+        size_t pos = (history_pos + length - back - n) % length; // oldest sample of the frame
+        for (size_t i = 0; i < n; ++i) {
+            frame[i] = history[pos] * window[i];
+            pos = pos + 1 == length ? 0 : pos + 1;
+        }
+    }
+
+    void layout_buckets() {
+        const size_t count = buckets.size();
+        const size_t bins_total = bins.size();
+        const float bin_hz = sample_rate / static_cast<float>(fft.size());
+        const float lo_hz = std::max(MIN_HZ, bin_hz);
+        const float hi_hz = sample_rate * 0.5f;
+        const float ratio = std::log(hi_hz / lo_hz);
+        uint32_t previous = 1;
+        for (size_t b = 0; b < count; ++b) {
+            const float edge = lo_hz * std::exp(ratio * static_cast<float>(b + 1) / count);
+            uint32_t hi = static_cast<uint32_t>(std::min<float>(std::ceil(edge / bin_hz), bins_total));
+            uint32_t lo = std::min<uint32_t>(previous, static_cast<uint32_t>(bins_total - 1));
+            // Low buckets narrower than a bin reuse their nearest bin
+            hi = std::max(hi, lo + 1);
+            bucket_lo[b] = lo;
+            bucket_hi[b] = hi;
+            previous = hi;
+        }
+    }
+};
+
+// Streaming windowed-sinc resampler that reads `step` input samples per
+// output sample. Below 1x it band-limits to the output rate so pitching
+// up does not alias; the kernel comes from one precomputed table.
+class StreamingResampler {
+public:
+    static constexpr size_t ZERO_CROSSINGS = 8;
+    static constexpr size_t TABLE_RESOLUTION = 256;
+    static constexpr float MAX_STEP = 2.0f;
+    static constexpr float CUTOFF = 0.95f;
+    static constexpr size_t MAX_HALF_WIDTH =
+        static_cast<size_t>(ZERO_CROSSINGS * MAX_STEP / CUTOFF) + 1;
+    static constexpr size_t CAPACITY = 8192;
+
+    StreamingResampler() : buffer(CAPACITY, 0.0f), table(ZERO_CROSSINGS * TABLE_RESOLUTION + 2, 0.0f) {
+        for (size_t i = 0; i < table.size(); ++i) {
+            const double t = static_cast<double>(i) / TABLE_RESOLUTION;
+            if (t >= ZERO_CROSSINGS) {
+                continue;
+            }
+            const double sinc = i == 0 ? 1.0 : std::sin(M_PI * t) / (M_PI * t);
+            const double x = 0.5 + 0.5 * t / ZERO_CROSSINGS; // Blackman over [-ZC, ZC]
+            const double blackman = 0.42 - 0.5 * std::cos(2.0 * M_PI * x) + 0.08 * std::cos(4.0 * M_PI * x);
+            table[i] = static_cast<float>(sinc * blackman);
+        }
+        set_step(1.0f);
+        reset();
+    }
+
+    void reset() {
+        // Zeroed history so the first outputs have a full kernel to read
+        std::fill(buffer.begin(), buffer.end(), 0.0f);
+        length = MAX_HALF_WIDTH;
+        position = static_cast<double>(MAX_HALF_WIDTH);
+    }
+
+    void set_step(float value) {
+        step = std::clamp(value, 1.0f / MAX_STEP, MAX_STEP);
+        cutoff = CUTOFF * std::min(1.0f, 1.0f / step);
+        half_width = std::min(MAX_HALF_WIDTH,
+                              static_cast<size_t>(std::ceil(ZERO_CROSSINGS / cutoff)));
+    }
+
+    // Append input; the caller keeps each feed well under CAPACITY
+    void feed(const float* samples, size_t count) {
+        compact();
+        count = std::min(count, CAPACITY - length);
+        std::copy(samples, samples + count, buffer.begin() + length);
+        length += count;
+    }
+
+    // Write up to max_out resampled samples; returns how many
+    size_t produce(float* out, size_t max_out) {
+        size_t produced = 0;
+        while (produced < max_out) {
+            const size_t center = static_cast<size_t>(position);
+            if (center + half_width + 1 >= length) {
+                break;
+            }
+            const float frac = static_cast<float>(position - center);
+            if (step == 1.0f && frac == 0.0f) {
+                out[produced++] = buffer[center];
+            } else {
+                float sum = 0.0f;
+                float weight = 0.0f;
+                for (size_t k = center + 1 - half_width; k <= center + half_width; ++k) {
+                    const float t = std::abs((static_cast<float>(k) - static_cast<float>(center) - frac) * cutoff);
+                    const float h = kernel(t);
+                    sum += buffer[k] * h;
+                    weight += h;
+                }
+                // Normalizing by the tap sum keeps DC gain exactly 1 at any phase
+                out[produced++] = weight != 0.0f ? sum / weight : 0.0f;
+            }
+            position += step;
+        }
+        return produced;
+    }
+
+    size_t latency() const { return half_width; }
+
+private:
+    std::vector<float> buffer;
+    std::vector<float> table;
+    size_t length = 0;
+    double position = 0.0;
+    float step = 1.0f;
+    float cutoff = CUTOFF;
+    size_t half_width = ZERO_CROSSINGS;
+
+    float kernel(float t) const {
+        const float index = t * TABLE_RESOLUTION;
+        const size_t i = static_cast<size_t>(index);
+        if (i + 1 >= table.size()) {
+            return 0.0f;
+        }
+        const float frac = index - static_cast<float>(i);
+        return table[i] + (table[i + 1] - table[i]) * frac;
+    }
+
+    void compact() {
+        const size_t center = static_cast<size_t>(position);
+        if (center <= MAX_HALF_WIDTH) {
+            return;
+        }
+        const size_t drop = center - MAX_HALF_WIDTH;
+        std::copy(buffer.begin() + drop, buffer.begin() + length, buffer.begin());
+        length -= drop;
+        position -= static_cast<double>(drop);
+    }
+};
+
+// Waveform-similarity overlap-add time stretch. Each output hop places a
+// Hann-windowed frame taken near the nominal input position, nudged within
+// +-SEARCH samples to line up with the natural continuation of the frame
+// before it, so the overlap adds in phase instead of smearing transients.
+// With several channels the search runs once on their sum and every channel
+// takes the same frame, so the stereo image never drifts.
+class WsolaStretcher {
+public:
+    static constexpr size_t HOP = 512;
+    static constexpr size_t FRAME = HOP * 2;
+    static constexpr size_t SEARCH = 256;
+    static constexpr size_t COARSE = 4;
+    static constexpr float MIN_TEMPO = 0.125f;
+    static constexpr float MAX_TEMPO = 8.0f;
+    static constexpr size_t CAPACITY = 16384;
+
+    WsolaStretcher() : window(FRAME) {
+        // Periodic Hann: frames at 50% overlap sum to exactly 1
+        for (size_t i = 0; i < FRAME; ++i) {
+            window[i] = 0.5f - 0.5f * static_cast<float>(std::cos(2.0 * M_PI * i / FRAME));
+        }
+        set_channels(1);
+    }
+
+    // Allocates and resets. Rows 0..channels-1 of `input` hold the audio;
+    // past one channel an extra row holds their sum for the search.
+    void set_channels(size_t count) {
+        channels = std::clamp<size_t>(count, 1, MAX_CHANNELS);
+        rows = channels > 1 ? channels + 1 : 1;
+        input.assign(rows * CAPACITY, 0.0f);
+        overlap.assign(channels * FRAME, 0.0f);
+        reset();
+    }
+
+    size_t channel_count() const { return channels; }
+
+    void reset() {
+        std::fill(input.begin(), input.end(), 0.0f);
+        std::fill(overlap.begin(), overlap.end(), 0.0f);
+        // One hop of leading silence so the first frame fades in from zero
+        length = HOP;
+        nominal = 0.0;
+        previous = -1;
+    }
+
+    // Input samples consumed per output sample
+    void set_tempo(float value) { tempo = std::clamp(value, MIN_TEMPO, MAX_TEMPO); }
+
+    // Buffer as many frames as fit; returns how many were taken. The view
+    // must have channel_count() channels.
+    size_t push(ConstPlanarView samples) {
+        if (CAPACITY - length < samples.frames) {
+            compact();
+        }
+        const size_t count = std::min(samples.frames, CAPACITY - length);
+        for (size_t c = 0; c < channels; ++c) {
+            std::copy(samples.channel(c), samples.channel(c) + count, row(c) + length);
+        }
+        if (channels > 1) {
+            float* sum = row(channels) + length;
+            std::copy(samples.channel(0), samples.channel(0) + count, sum);
+            for (size_t c = 1; c < channels; ++c) {
+                const float* source = samples.channel(c);
+                for (size_t i = 0; i < count; ++i) {
+                    sum[i] += source[i];
+                }
+            }
+        }
+        length += count;
+        return count;
+    }
+
+    // Emit one hop per channel into out when enough input is buffered
+    bool step(PlanarView out) {
+        long chosen;
+        if (previous < 0) {
+            chosen = std::lround(nominal);
+            if (static_cast<size_t>(chosen) + FRAME > length) {
+                return false;
+            }
+        } else if (tempo == 1.0f) {
+            // At unity the natural continuation is perfect reconstruction; no search
+            chosen = previous + static_cast<long>(HOP);
+            if (static_cast<size_t>(chosen) + FRAME > length) {
+                return false;
+            }
+        } else {
+            const long center = std::lround(nominal);
+            if (static_cast<size_t>(center + static_cast<long>(SEARCH + FRAME)) > length) {
+                return false;
+            }
+            chosen = best_alignment(previous + static_cast<long>(HOP),
+                                    std::max(0L, center - static_cast<long>(SEARCH)),
+                                    center + static_cast<long>(SEARCH));
+        }
+
+        for (size_t c = 0; c < channels; ++c) {
+            const float* frame = row(c) + chosen;
+            float* lap = overlap.data() + c * FRAME;
+            for (size_t i = 0; i < FRAME; ++i) {
+                lap[i] += window[i] * frame[i];
+            }
+            std::copy(lap, lap + HOP, out.channel(c));
+            std::copy(lap + HOP, lap + FRAME, lap);
+            std::fill(lap + HOP, lap + FRAME, 0.0f);
+        }
+
+        previous = chosen;
+        nominal = tempo == 1.0f ? static_cast<double>(chosen + static_cast<long>(HOP))
+                                : nominal + static_cast<double>(tempo) * HOP;
+        return true;
+    }
+
+private:
+    std::vector<float> input;
+    std::vector<float> window;
+    std::vector<float> overlap;
+    size_t channels = 1;
+    size_t rows = 1;
+    size_t length = 0;
+    double nominal = 0.0;
+    long previous = -1;
+    float tempo = 1.0f;
+
+    float* row(size_t r) { return input.data() + r * CAPACITY; }
+    const float* row(size_t r) const { return input.data() + r * CAPACITY; }
+
+    // What the alignment search compares: the channel sum, or the only channel
+    const float* guide() const { return row(rows - 1); }
+
+    static float similarity(const float* a, const float* b, size_t count, size_t stride) {
+        float dot = 0.0f;
+        float energy = 1e-9f;
+        for (size_t i = 0; i < count; i += stride) {
+            dot += a[i] * b[i];
+            energy += b[i] * b[i];
+        }
+        return dot / std::sqrt(energy);
+    }
+
+    // Candidate start in [lo, hi] whose first hop best matches the target hop
+    long best_alignment(long target, long lo, long hi) const {
+        const float* signal = guide();
+        const float* reference = signal + target;
+        long best = lo;
+        float best_score = -std::numeric_limits<float>::infinity();
+        // Coarse pass on every COARSE-th offset and sample, then refine around the winner
+        for (long c = lo; c <= hi; c += COARSE) {
+            const float score = similarity(reference, signal + c, HOP, COARSE);
+            if (score > best_score) {
+                best_score = score;
+                best = c;
+            }
+        }
+        const long refine_lo = std::max(lo, best - static_cast<long>(COARSE) + 1);
+        const long refine_hi = std::min(hi, best + static_cast<long>(COARSE) - 1);
+        best_score = -std::numeric_limits<float>::infinity();
+        for (long c = refine_lo; c <= refine_hi; ++c) {
+            const float score = similarity(reference, signal + c, HOP, 1);
+            if (score > best_score) {
+                best_score = score;
+                best = c;
+            }
+        }
+        return best;
+    }
+
+    // Drop input no future frame or search can reach
+    void compact() {
+        long keep = static_cast<long>(nominal) - static_cast<long>(SEARCH);
+        if (previous >= 0) {
+            keep = std::min(keep, previous + static_cast<long>(HOP));
+        }
+        if (keep <= 0) {
+            return;
+        }
+        const size_t drop = std::min(static_cast<size_t>(keep), length);
+        for (size_t r = 0; r < rows; ++r) {
+            std::copy(row(r) + drop, row(r) + length, row(r));
+        }
+        length -= drop;
+        nominal -= static_cast<double>(drop);
+        if (previous >= 0) {
+            previous -= static_cast<long>(drop);
+        }
+    }
+};
+
+// Independent speed and pitch on a stream: WSOLA changes tempo by
+// speed / pitch, then the resampler reads it at `pitch` samples per output
+// sample, which restores the duration and moves the pitch. All state and
+// buffers persist between blocks, so chunk boundaries are seamless. Audio
+// is planar; each channel has its own resampler, all stepping in lockstep.
+class TimeStretcher {
+public:
+    static constexpr float MIN_SPEED = 0.25f;
+    static constexpr float MAX_SPEED = 4.0f;
+    static constexpr float MIN_PITCH = 0.5f;
+    static constexpr float MAX_PITCH = 2.0f;
+    static constexpr size_t OUTPUT_CAPACITY = 16384;
+
+    TimeStretcher() { set_channels(1); }
+
+    // Allocates and resets
+    void set_channels(size_t count) {
+        wsola.set_channels(count);
+        channels = wsola.channel_count();
+        resamplers.resize(channels);
+        for (auto& resampler : resamplers) {
+            resampler.set_step(pitch_step);
+        }
+        hop.resize(channels, WsolaStretcher::HOP);
+        resampled.resize(channels, RESAMPLED_MAX);
+        output.resize(channels, OUTPUT_CAPACITY);
+        reset();
+    }
+
+    size_t channel_count() const { return channels; }
+
+    void reset() {
+        wsola.reset();
+        for (auto& resampler : resamplers) {
+            resampler.reset();
+        }
+        read_pos = write_pos = 0;
+    }
+
+    void set_ratio(float speed, float pitch) {
+        speed = std::clamp(speed, MIN_SPEED, MAX_SPEED);
+        pitch_step = std::clamp(pitch, MIN_PITCH, MAX_PITCH);
+        wsola.set_tempo(speed / pitch_step);
+        for (auto& resampler : resamplers) {
+            resampler.set_step(pitch_step);
+        }
+    }
+
+    // Feed input with channel_count() channels; returns frames taken (less
+    // than given only when the output FIFO is full and needs pulling first)
+    size_t push(ConstPlanarView samples) {
+        size_t consumed = 0;
+        for (;;) {
+            consumed += wsola.push(samples.from(consumed));
+            bool progressed = false;
+            while (space() >= RESAMPLED_MAX && wsola.step(hop.view())) {
+                for (size_t c = 0; c < channels; ++c) {
+                    resamplers[c].feed(hop.channel(c), WsolaStretcher::HOP);
+                }
+                for (;;) {
+                    // Same input and step on every channel, so the same count
+                    size_t produced = 0;
+                    for (size_t c = 0; c < channels; ++c) {
+                        produced = resamplers[c].produce(resampled.channel(c), RESAMPLED_MAX);
+                    }
+                    if (produced == 0) {
+                        break;
+                    }
+                    write(resampled.view().first(produced));
+                }
+                progressed = true;
+            }
+            if (consumed == samples.frames || !progressed) {
+                return consumed;
+            }
+        }
+    }
+
+    size_t available() const { return write_pos - read_pos; }
+
+    // Up to out.frames frames into each channel of out; returns how many
+    size_t pull(PlanarView out) {
+        const size_t count = std::min(out.frames, available());
+        const size_t start = read_pos % OUTPUT_CAPACITY;
+        const size_t first = std::min(count, OUTPUT_CAPACITY - start);
+        for (size_t c = 0; c < channels; ++c) {
+            const float* ring = output.channel(c);
+            std::copy(ring + start, ring + start + first, out.channel(c));
+            std::copy(ring, ring + (count - first), out.channel(c) + first);
+        }
+        read_pos += count;
+        return count;
+    }
+
+private:
+    // One WSOLA hop read at the slowest step (pitch 0.5) plus resampler slack
+    static constexpr size_t RESAMPLED_MAX =
+        WsolaStretcher::HOP * 2 + StreamingResampler::MAX_HALF_WIDTH * 2 + 8;
+
+    WsolaStretcher wsola;
+    std::vector<StreamingResampler> resamplers;
+    PlanarBuffer hop;
+    PlanarBuffer resampled;
+    PlanarBuffer output;
+    size_t channels = 1;
+    float pitch_step = 1.0f;
+    size_t read_pos = 0;
+    size_t write_pos = 0;
+
+    size_t space() const { return OUTPUT_CAPACITY - available(); }
+
+    void write(ConstPlanarView samples) {
+        const size_t start = write_pos % OUTPUT_CAPACITY;
+        const size_t first = std::min(samples.frames, OUTPUT_CAPACITY - start);
+        for (size_t c = 0; c < channels; ++c) {
+            const float* source = samples.channel(c);
+            float* ring = output.channel(c);
+            std::copy(source, source + first, ring + start);
+            std::copy(source + first, source + samples.frames, ring);
+        }
+        write_pos += samples.frames;
+    }
+};
+
+// Channel-linked peak limiter for loudness-normalized playback. The gain
+// drops at once to hold every sample at or below CEILING, then recovers
+// exponentially. There is no lookahead, so it adds no latency; since a
+// track's normalization gain is sized from its measured true peak, it only
+// ever has a few peaks to catch.
+class PeakLimiter {
+public:
+    static constexpr float CEILING = 0.891f;            // -1 dBFS, under the -1 dBTP target
+    static constexpr float RELEASE_SECONDS = 0.1f;
+
+    PeakLimiter() { set_sample_rate(48000.0f); }
+
+    void set_sample_rate(float hz) { release = 1.0f - std::exp(-1.0f / (RELEASE_SECONDS * hz)); }
+    void reset() { gain = 1.0f; }
+
+    // Still recovering from a peak
+    bool active() const { return gain < 1.0f; }
+    float current_gain() const { return gain; }
+
+    void process(PlanarView audio) {
+        if (gain == 1.0f && peak_of(audio) <= CEILING) {
+            return;
+        }
+        for (size_t i = 0; i < audio.frames; ++i) {
+            float peak = 0.0f;
+            for (size_t c = 0; c < audio.channels; ++c) {
+                peak = std::max(peak, std::abs(audio.channel(c)[i]));
+            }
+            gain += (1.0f - gain) * release;
+            if (peak * gain > CEILING) {
+                gain = CEILING / peak;
+            }
+            for (size_t c = 0; c < audio.channels; ++c) {
+                audio.channel(c)[i] *= gain;
+            }
+        }
+        if (gain > 0.9999f) {
+            gain = 1.0f;   // settled; back to the scan-only path
+        }
+    }
+
+private:
+    float release = 0.0f;
+    float gain = 1.0f;
+
+    static float peak_of(PlanarView audio) {
+        float peak = 0.0f;
+        for (size_t c = 0; c < audio.channels; ++c) {
+            const float* row = audio.channel(c);
+            for (size_t i = 0; i < audio.frames; ++i) {
+                peak = std::max(peak, std::abs(row[i]));
+            }
+        }
+        return peak;
+    }
+};
+
+// Gapless track queue with sample-accurate crossfades. A producer thread
+// (the decoder) enqueues each track with its decoded length, encoder delay
+// and padding, and the crossfade into it, then streams the track's
+// interleaved samples into a ring of its own; the audio thread mixes every
+// track that overlaps the block it renders. Tracks sit on one timeline
+// counted in output frames: each starts where the one before ends minus
+// its crossfade. Fade curves are computed from those absolute positions,
+// so they run on unbroken across block boundaries, and with no crossfade
+// one track's last real sample is followed directly by the next one's first.
+class TrackScheduler {
+public:
+    static constexpr size_t SLOTS = 8;              // tracks queued or playing at once
+    static constexpr size_t RING_FRAMES = 16384;    // buffered ahead per track
+    static constexpr size_t STAGING_FRAMES = 4096;
+    static constexpr size_t STOP_FADE = 128;
+    static constexpr size_t MAX_BLOCK = 512;
+
+    TrackScheduler() : gains(MAX_BLOCK), block(MAX_BLOCK * MAX_CHANNELS) { set_channels(1); }
+
+    // Allocates and drops every track; not concurrent with either side
+    void set_channels(size_t count) {
+        channels = std::clamp<size_t>(count, 1, MAX_CHANNELS);
+        for (auto& slot : slots) {
+            slot.ring.reset(RING_FRAMES * channels);
+            slot.state.store(FREE, std::memory_order_relaxed);
+        }
+        Command command;
+        while (commands.try_pop(command)) {
+        }
+        voice.resize(channels, MAX_BLOCK);
+        staging.resize(STAGING_FRAMES * channels);
+        order_count = 0;
+        now = 0;
+        current.store(-1, std::memory_order_relaxed);
+    }
+
+    size_t channel_count() const { return channels; }
+
+    // Producer: queue a track of `frames` decoded frames whose first
+    // `leading_trim` (encoder delay) and last `trailing_trim` (padding) are
+    // not played, faded in over `crossfade` frames against the one before
+    // (0 for a gapless cut). `gain` is its linear normalization gain and
+    // `peak` its linear true peak before that gain, 0 if unmeasured.
+    // Returns the id to write its samples under, or -1 if every slot is
+    // taken or nothing would be left to play.
+    int enqueue(size_t frames, size_t leading_trim, size_t trailing_trim, size_t crossfade,
+                float gain = 1.0f, float peak = 0.0f) {
+        if (leading_trim >= frames || frames - leading_trim <= trailing_trim) {
+            return -1;
+        }
+        for (size_t i = 0; i < SLOTS; ++i) {
+            Slot& slot = slots[i];
+            if (slot.state.load(std::memory_order_acquire) != FREE) {
+                continue;
+            }
+            slot.ring.reset(RING_FRAMES * channels);
+            slot.id = next_id;
+            slot.length = frames - leading_trim - trailing_trim;
+            slot.crossfade = crossfade;
+            slot.gain = gain;
+            slot.peak = peak;
+            slot.skip = leading_trim;
+            slot.written = 0;
+            slot.state.store(BUSY, std::memory_order_relaxed);
+            if (!commands.try_push(Command{Command::Queue, static_cast<uint8_t>(i)})) {
+                slot.state.store(FREE, std::memory_order_relaxed);
+                return -1;
+            }
+            return next_id++;
+        }
+        return -1;
+    }
+
+    // Producer: the next `frames` interleaved frames of track `id`. Delay
+    // and padding are dropped here, so only playable frames reach the ring.
+    // Returns frames taken: fewer than given while the ring is full, all of
+    // them once the track is complete, 0 once it has finished playing.
+    size_t write(int id, const float* samples, size_t frames) {
+        Slot* slot = find(id);
+        if (!slot) {
+            return 0;
+        }
+        const size_t skipped = std::min(frames, slot->skip);
+        slot->skip -= skipped;
+        const size_t wanted = std::min({frames - skipped, slot->length - slot->written,
+                                        slot->ring.writable() / channels});
+        const size_t kept = slot->ring.write(samples + skipped * channels, wanted * channels) / channels;
+        slot->written += kept;
+        return slot->written == slot->length ? frames : skipped + kept;
+    }
+
+    // The same from the staging buffer JS fills through its view
+    size_t write_staged(int id, size_t frames) {
+        return write(id, staging.data(), std::min(frames, STAGING_FRAMES));
+    }
+
+    // Producer: frames the ring of track `id` has room for; 0 once it is complete
+    size_t writable(int id) {
+        const Slot* slot = find(id);
+        if (!slot || slot->written == slot->length) {
+            return 0;
+        }
+        return slot->ring.writable() / channels;
+    }
+
+    float* staging_data() { return staging.data(); }
+    size_t staging_capacity() const { return staging.size(); }
+
+    // Fade out whatever is playing over STOP_FADE frames and drop the
+    // queue, at the next block; false if the command queue is full
+    bool stop() { return commands.try_push(Command{Command::Stop, 0}); }
+
+    // Id of the latest track to start playing, -1 before any; any thread
+    int current_track() const { return current.load(std::memory_order_relaxed); }
+
+    // Audio thread: the highest the scheduled tracks can peak once their
+    // gains are applied, summed since a crossfade plays two at once; 0
+    // when none was measured
+    float peak_level() const {
+        float level = 0.0f;
+        for (size_t v = 0; v < order_count; ++v) {
+            const Slot& slot = slots[order[v]];
+            level += slot.gain * slot.peak;
+        }
+        return level;
+    }
+
+    // Audio thread: out.frames frames of the mix, overwriting out. Returns
+    // how far the timeline moved, which is short only when a playing track's
+    // samples have not arrived: the rest is silence and the timeline waits.
+    // With nothing queued it moves on, rendering silence.
+    size_t render(PlanarView out) {
+        Command command;
+        while (commands.try_pop(command)) {
+            if (command.type == Command::Stop) {
+                stop_all();
+            } else {
+                schedule(command.slot);
+            }
+        }
+        for (size_t c = 0; c < out.channels; ++c) {
+            std::fill(out.channel(c), out.channel(c) + out.frames, 0.0f);
+        }
+        size_t done = 0;
+        while (done < out.frames) {
+            const size_t wanted = std::min(MAX_BLOCK, out.frames - done);
+            const size_t mixed = mix(out.from(done).first(wanted));
+            done += mixed;
+            if (mixed < wanted) {
+                break;
+            }
+        }
+        return done;
+    }
+
+private:
+    static constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+    enum : uint8_t { FREE, BUSY };
+
+    struct Command {
+        enum Type : uint8_t { Queue, Stop } type;
+        uint8_t slot;
+    };
+
+    struct Slot {
+        SampleRing ring;
+        std::atomic<uint8_t> state{FREE};   // BUSY from enqueue until the audio thread lets go
+        // Producer's; all but the last two are fixed once queued
+        int id = -1;
+        size_t length = 0;                  // playable frames
+        size_t crossfade = 0;
+        float gain = 1.0f;
+        float peak = 0.0f;
+        size_t skip = 0;                    // encoder delay still to drop
+        size_t written = 0;
+        // Audio thread's, in frames: start on the timeline, the rest from there
+        uint64_t start = 0;
+        uint64_t end = 0;                   // length, or less once stopped
+        uint64_t played = 0;
+        uint64_t fade_in = 0;
+        uint64_t fade_out_at = 0;
+        uint64_t fade_out = 0;
+        uint64_t stop_at = NEVER;
+    };
+
+    std::array<Slot, SLOTS> slots;
+    SpscQueue<Command, 16> commands;
+    int next_id = 1;
+    std::atomic<int> current{-1};
+    size_t channels = 1;
+    AlignedBuffer staging;
+
+    // Audio thread: scheduled slots in timeline order, and scratch
+    std::array<uint8_t, SLOTS> order{};
+    size_t order_count = 0;
+    uint64_t now = 0;
+    PlanarBuffer voice;
+    AlignedBuffer gains;
+    AlignedBuffer block;
+
+    Slot* find(int id) {
+        for (auto& slot : slots) {
+            if (slot.id == id && slot.state.load(std::memory_order_acquire) == BUSY) {
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+
+    void release(Slot& slot) { slot.state.store(FREE, std::memory_order_release); }
+
+    // Place a newly queued track after the last scheduled one. Queued too
+    // late for its full crossfade, it starts now with what is left of it.
+    void schedule(size_t index) {
+        Slot& slot = slots[index];
+        slot.start = now;
+        slot.end = slot.length;
+        slot.played = 0;
+        slot.fade_in = slot.fade_out_at = slot.fade_out = 0;
+        slot.stop_at = NEVER;
+        if (order_count > 0) {
+            Slot& previous = slots[order[order_count - 1]];
+            const uint64_t previous_end = previous.start + previous.end;
+            const uint64_t fade = std::min<uint64_t>({slot.crossfade, previous.end, slot.length});
+            slot.start = std::max(now, previous_end - fade);
+            slot.fade_in = previous_end - slot.start;
+            if (slot.fade_in > 0 && previous.fade_out == 0) {
+                previous.fade_out_at = slot.start - previous.start;
+                previous.fade_out = slot.fade_in;
+            }
+        }
+        order[order_count++] = static_cast<uint8_t>(index);
+    }
+
+    // Tracks not yet started are dropped; the rest ramp down from wherever
+    // their own fades have them, so the stop never clicks
+    void stop_all() {
+        size_t kept = 0;
+        for (size_t v = 0; v < order_count; ++v) {
+            Slot& slot = slots[order[v]];
+            if (slot.played == 0) {
+                release(slot);
+                continue;
+            }
+            if (slot.stop_at == NEVER) {
+                slot.stop_at = slot.played;
+                slot.end = std::min<uint64_t>(slot.end, slot.played + STOP_FADE);
+            }
+            order[kept++] = order[v];
+        }
+        order_count = kept;
+    }
+
+    // One chunk of at most MAX_BLOCK frames; returns frames mixed
+    size_t mix(PlanarView out) {
+        // The timeline only moves as far as every playing track has samples for
+        size_t frames = out.frames;
+        for (size_t v = 0; v < order_count; ++v) {
+            const Slot& slot = slots[order[v]];
+            if (slot.start >= now + frames) {
+                break;
+            }
+            const size_t offset = static_cast<size_t>(slot.start > now ? slot.start - now : 0);
+            const size_t needed = static_cast<size_t>(std::min<uint64_t>(frames - offset, slot.end - slot.played));
+            const size_t ready = slot.ring.readable() / channels;
+            if (ready < needed) {
+                frames = offset + ready;
+            }
+        }
+
+        const auto& k = kernels::active();
+        for (size_t v = 0; v < order_count; ++v) {
+            Slot& slot = slots[order[v]];
+            if (slot.start >= now + frames) {
+                break;
+            }
+            const size_t offset = static_cast<size_t>(slot.start > now ? slot.start - now : 0);
+            const size_t count = static_cast<size_t>(std::min<uint64_t>(frames - offset, slot.end - slot.played));
+            if (count == 0) {
+                continue;
+            }
+            slot.ring.read(block.data(), count * channels);
+            deinterleave(InterleavedSpan<const float>{block.data(), channels, count}, voice.view());
+            const bool shaped = shape(slot, count);
+            for (size_t c = 0; c < channels; ++c) {
+                if (shaped) {
+                    k.mix_curve(voice.channel(c), gains.data(), out.channel(c) + offset, count);
+                } else {
+                    k.mix(voice.channel(c), out.channel(c) + offset, count, slot.gain);
+                }
+            }
+            if (slot.played == 0) {
+                current.store(slot.id, std::memory_order_relaxed);
+            }
+            slot.played += count;
+        }
+        now += frames;
+
+        size_t kept = 0;
+        for (size_t v = 0; v < order_count; ++v) {
+            Slot& slot = slots[order[v]];
+            if (slot.played == slot.end) {
+                release(slot);
+            } else {
+                order[kept++] = order[v];
+            }
+        }
+        order_count = kept;
+        return frames;
+    }
+
+    // Gains for the next `count` frames of a track, its own gain times
+    // every fade they fall in; false when no fade applies and the plain
+    // mix at the track's gain will do
+    bool shape(const Slot& slot, size_t count) {
+        const uint64_t from = slot.played;
+        const uint64_t to = from + count;
+        const bool fading_in = from < slot.fade_in;
+        const bool fading_out = slot.fade_out > 0 && to > slot.fade_out_at;
+        const bool stopping = to > slot.stop_at;
+        if (!fading_in && !fading_out && !stopping) {
+            return false;
+        }
+        float* g = gains.data();
+        std::fill(g, g + count, slot.gain);
+        if (fading_in) {
+            equal_power(g, static_cast<size_t>(std::min(to, slot.fade_in) - from), from, slot.fade_in, true);
+        }
+        if (fading_out) {
+            const uint64_t at = std::max(from, slot.fade_out_at);
+            equal_power(g + (at - from), static_cast<size_t>(to - at), at - slot.fade_out_at, slot.fade_out, false);
+        }
+        if (stopping) {
+            const uint64_t at = std::max(from, slot.stop_at);
+            equal_power(g + (at - from), static_cast<size_t>(to - at), at - slot.stop_at, STOP_FADE, false);
+        }
+        return true;
+    }
+
+    // gains[i] *= sin (rising) or cos of (pi/2)(at + i)/length. The pair is
+    // rotated one step per sample from an exact value at `at`, which keeps
+    // it exact at every block boundary; a fade out and the matching fade in
+    // sum to constant power.
+    static void equal_power(float* gains, size_t count, uint64_t at, uint64_t length, bool rising) {
+        const double step = 0.5 * M_PI / static_cast<double>(length);
+        double s = std::sin(step * static_cast<double>(at));
+        double c = std::cos(step * static_cast<double>(at));
+        const double ds = std::sin(step);
+        const double dc = std::cos(step);
+        for (size_t i = 0; i < count; ++i) {
+            gains[i] *= static_cast<float>(rising ? s : c);
+            const double next_c = c * dc - s * ds;
+            s = s * dc + c * ds;
+            c = next_c;
+        }
+    }
+};
+
+#ifdef FAST_AUDIO_THREADS
+// Spectrum analysis on its own thread (the SharedArrayBuffer/pthreads
+// build). The audio thread only copies rendered blocks into a wait-free
+// ring; the worker drains it, analyzes, and publishes buckets into one of
+// two buffers at most ~60 times a second, flipping `front` when done.
+class BackgroundAnalyzer {
+public:
+    static constexpr size_t RING_SECONDS_AT_48K = 48000;
+    static constexpr auto PUBLISH_INTERVAL = std::chrono::milliseconds(16);
+
+    BackgroundAnalyzer() : ring(RING_SECONDS_AT_48K / 2) {}
+    ~BackgroundAnalyzer() { stop(); }
+
+    void start(size_t fft_size, size_t buckets) {
+        stop();
+        analyzer.configure(fft_size, buckets);
+        analyzer.set_sample_rate(requested_rate.load(std::memory_order_relaxed));
+        published[0].resize(analyzer.bucket_count());
+        published[1].resize(analyzer.bucket_count());
+        ring.reset(ring.capacity());
+        running.store(true, std::memory_order_release);
+        worker = std::thread([this] { run(); });
+    }
+
+    void stop() {
+        running.store(false, std::memory_order_release);
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    bool active() const { return running.load(std::memory_order_acquire); }
+
+    // Audio thread; drops samples rather than block if the worker is behind
+    void feed(const float* samples, size_t count) {
+        if (active()) {
+            ring.write(samples, count);
+        }
+    }
+
+    // Control thread; the worker owns the analyzer and picks the rate up
+    // before its next analysis
+    void set_sample_rate(float hz) { requested_rate.store(hz, std::memory_order_relaxed); }
+
+    // The worker fills the back buffer and then swaps, so the buffer latest()
+    // returns is overwritten by the publish after next. A reader takes
+    // generation(), copies latest(), and keeps the copy only if generation()
+    // is unchanged afterwards; JS must re-fetch the view each time, since the
+    // view it fetched last is of whichever buffer was front then.
+    const AlignedBuffer& latest() const { return published[front.load(std::memory_order_acquire)]; }
+    uint32_t generation() const { return generations.load(std::memory_order_acquire); }
+
+private:
+    SampleRing ring;
+    SpectrumAnalyzer analyzer;
+    AlignedBuffer published[2];
+    std::atomic<int> front{0};
+    std::atomic<uint32_t> generations{0};
+    std::atomic<bool> running{false};
+    std::atomic<float> requested_rate{48000.0f};
+    std::thread worker;
+
+    void run() {
+        // input_capacity() is MAX_FRAMES hops, all of which the analyzer's
+        // history holds, so a full read is analyzed as that many clean frames
+        std::vector<float> scratch(analyzer.input_capacity());
+        auto next_publish = std::chrono::steady_clock::now();
+        while (running.load(std::memory_order_acquire)) {
+            analyzer.set_sample_rate(requested_rate.load(std::memory_order_relaxed));
+            const size_t count = ring.read(scratch.data(), scratch.size());
+            if (count == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                continue;
+            }
+            analyzer.analyze(scratch.data(), count);
+
+            const auto now = std::chrono::steady_clock::now();
+            if (now < next_publish) {
+                continue;
+            }
+            next_publish = now + PUBLISH_INTERVAL;
+            const int back = 1 - front.load(std::memory_order_relaxed);
+            std::copy(analyzer.bucket_data(), analyzer.bucket_data() + analyzer.bucket_count(),
+                      published[back].data());
+            front.store(back, std::memory_order_release);
+            generations.fetch_add(1, std::memory_order_release);
+        }
+    }
+};
+#endif // FAST_AUDIO_THREADS
+
+// Threading: one control (UI) thread calls the setters, one audio thread
+// calls the processing entry points. Continuous parameters travel as whole
+// snapshots and discrete events through a queue; the audio thread applies
+// both at the start of each block, so it never waits and never sees a
+// half-made change. Allocating calls (set_channel_count, reserve_io,
+// configure_spectrum) must not overlap processing.
+class HighPerformanceAudioProcessor {
+private:
+    struct Params {
+        float volume = 1.0f;
+        float speed = 1.0f;
+        float pitch = 1.0f;
+        bool muted = false;
+        float track_gain = 1.0f;    // loudness normalization, linear
+        float track_peak = 0.0f;    // the track's linear true peak; 0 if unmeasured
+        std::array<float, ParametricEqualizer::BANDS> eq_gains;
+        
+        Params() { eq_gains.fill(1.0f); }
+    };
+    
+    enum class Command : uint8_t {
+        ResetStream, // drop time-stretch state
+        FlushStream  // that, plus whatever the stream ring holds
+    };
+    
+    Params control;                 // control thread's copy, what the getters report
+    SnapshotBuffer<Params> params;
+    Params live;                    // audio thread's copy
+    SpscQueue<Command, 64> commands;
+    float applied_gain = 1.0f;      // audio thread; ramps to the live volume
+    PeakLimiter limiter;
+    float mix_peak = 0.0f;          // audio thread: the track mix's peak_level()
+    
+    ParametricEqualizer equalizer;
+    SpectrumAnalyzer spectrum;
+    TimeStretcher stretcher;
+    TimeStretcher pitch_stream;
+    bool stretching = false;
+    SpectrumAnalyzer oneshot_spectrum;
+    size_t oneshot_fft_size = 0;
+    size_t channel_count = 1;
+    
+    // Planar buffers in wasm linear memory that JS reads and writes through views
+    PlanarBuffer io_input;
+    PlanarBuffer io_aux;
+    PlanarBuffer io_output;
+    uint64_t underruns = 0;
+    
+    // Planar scratch for the interleaved vector API, and a mono downmix for analysis
+    PlanarBuffer scratch_in;
+    PlanarBuffer scratch_out;
+    std::vector<float> downmixed;
+#ifdef FAST_AUDIO_THREADS
+    BackgroundAnalyzer background;
+    AlignedBuffer analysis_mix;
+#endif
+    
+    // Ring buffer for audio samples: interleaved frames from a producer
+    // (decoder, network) to the audio thread, which renders from it
+    static constexpr size_t STREAM_FRAMES = 16384;
+    SampleRing stream;
+    AlignedBuffer stream_staging;   // JS writes here before enqueue_stream
+    AlignedBuffer stream_block;     // audio thread: one quantum, interleaved
+    
+    // Queued tracks, mixed gaplessly or crossfaded
+    TrackScheduler tracks;
+    
+    // Performance counters
+    std::atomic<uint64_t> samples_processed{0};
+    std::chrono::high_resolution_clock::time_point last_performance_check;
+
+public:
+    // One Web Audio render quantum
+    static constexpr size_t RENDER_QUANTUM = 128;
+    static constexpr size_t DEFAULT_IO_FRAMES = 4096;
+    // Interleaved vector calls convert to planar this many frames at a time
+    static constexpr size_t WORK_FRAMES = 1024;
+    
+    HighPerformanceAudioProcessor() : stream_block(RENDER_QUANTUM * MAX_CHANNELS) {
+        last_performance_check = std::chrono::high_resolution_clock::now();
+        reserve_io(DEFAULT_IO_FRAMES);
+    }
+    
+    // Channels in every buffer the processor handles: rows of the planar io
+    // buffers, and the interleave of the vector API. Allocates, resets the
+    // stream and invalidates JS views, so set it before playback starts.
+    void set_channel_count(size_t count) {
+        count = std::clamp<size_t>(count, 1, MAX_CHANNELS);
+        if (count == channel_count) {
+            return;
+        }
+        channel_count = count;
+        stretcher.set_channels(count);
+        pitch_stream.set_channels(count);
+        tracks.set_channels(count);
+        equalizer.reset();
+        stretching = false;
+        reserve_io(io_input.frames());
+    }
+    
+    size_t get_channel_count() const { return channel_count; }
+    
+    // Size the shared buffers, in frames per channel (allocates, invalidating
+    // JS views). Output has room for a 0.25x stretch of a full input plus
+    // what the stretcher holds.
+    void reserve_io(size_t frames) {
+        frames = std::max(frames, RENDER_QUANTUM);
+        io_input.resize(channel_count, frames);
+        io_aux.resize(channel_count, frames);
+        io_output.resize(channel_count, frames * 4 + TimeStretcher::OUTPUT_CAPACITY / 8);
+        scratch_in.resize(channel_count, WORK_FRAMES);
+        scratch_out.resize(channel_count, WORK_FRAMES);
+        stream.reset(STREAM_FRAMES * channel_count);
+        stream_staging.resize(frames * channel_count);
+#ifdef FAST_AUDIO_THREADS
+        analysis_mix.resize(io_output.frames());
+#endif
+    }
+    
+    // Channel rows of the io buffers; *_data() is channel 0, all mono needs
+    float* input_data() { return io_input.channel(0); }
+    float* aux_data() { return io_aux.channel(0); }
+    float* output_data() { return io_output.channel(0); }
+    float* input_channel(size_t c) { return io_input.channel(std::min(c, channel_count - 1)); }
+    float* aux_channel(size_t c) { return io_aux.channel(std::min(c, channel_count - 1)); }
+    float* output_channel(size_t c) { return io_output.channel(std::min(c, channel_count - 1)); }
+    size_t input_capacity() const { return io_input.frames(); }
+    size_t output_capacity() const { return io_output.frames(); }
+    
+    // AudioWorklet entry: RENDER_QUANTUM frames of every channel from the
+    // input buffer to the output buffer. While time-stretching, output the
+    // engine cannot supply yet is silence and counts as an underrun.
+    size_t process_block() {
+        begin_block();
+        if (!engage_stretcher()) {
+            return run_io(RENDER_QUANTUM);
+        }
+        stretcher.push(io_input.view().first(RENDER_QUANTUM));
+        return render_quantum();
+    }
+    
+    // For worklets that own their source and play at speed != 1: push input
+    // until output_available() >= RENDER_QUANTUM, then render_block()
+    size_t push_input(size_t frames) {
+        begin_block();
+        engage_stretcher(true);
+        return stretcher.push(io_input.view().first(frames));
+    }
+    
+    size_t output_available() const { return stretching ? stretcher.available() : 0; }
+    
+    size_t render_block() {
+        begin_block();
+        return render_quantum();
+    }
+    
+    // Producer side of the stream ring: copy up to `frames` interleaved
+    // frames in; returns how many fit. Any one thread, concurrently with
+    // the audio thread.
+    size_t write_stream(const float* samples, size_t frames) {
+        frames = std::min(frames, stream.writable() / channel_count);
+        return stream.write(samples, frames * channel_count) / channel_count;
+    }
+    
+    // The same from the staging buffer JS fills through its view
+    size_t enqueue_stream(size_t frames) {
+        return write_stream(stream_staging.data(), std::min(frames, stream_staging.size() / channel_count));
+    }
+    
+    float* stream_staging_data() { return stream_staging.data(); }
+    size_t stream_staging_capacity() const { return stream_staging.size(); }
+    size_t stream_buffered() const { return stream.readable() / channel_count; }
+    
+    // Consumer side, for the audio thread: one quantum from the stream
+    // ring into the output buffer, time-stretched as set. Returns frames of
+    // real audio rendered; a shortfall is silence and counts as an underrun.
+    size_t render_stream() {
+        begin_block();
+        if (!engage_stretcher()) {
+            const size_t got = read_stream(RENDER_QUANTUM);
+            if (got < RENDER_QUANTUM) {
+                for (size_t c = 0; c < channel_count; ++c) {
+                    std::fill(io_input.channel(c) + got, io_input.channel(c) + RENDER_QUANTUM, 0.0f);
+                }
+                ++underruns;
+            }
+            run_io(RENDER_QUANTUM);
+            return got;
+        }
+        // Feed the stretcher only what this quantum needs, so the ring keeps the rest
+        while (stretcher.available() < RENDER_QUANTUM) {
+            const size_t got = read_stream(RENDER_QUANTUM);
+            if (got == 0) {
+                break;
+            }
+            stretcher.push(io_input.view().first(got));
+        }
+        return render_quantum();
+    }
+    
+    // Seek: drop stretch state and everything buffered in the stream ring.
+    // Takes effect at the next block; false if the command queue is full.
+    bool flush_stream() { return commands.try_push(Command::FlushStream); }
+    
+    // Track playback (see TrackScheduler). Producer side: enqueue a track,
+    // then write its interleaved frames from the track staging buffer.
+    // Each track carries its own normalization, as set_track_gain takes it,
+    // so a crossfade between tracks mastered at different levels stays even
+    int enqueue_track(size_t frames, size_t leading_trim, size_t trailing_trim, size_t crossfade_frames,
+                      float gain_db, float true_peak_db) {
+        return tracks.enqueue(frames, leading_trim, trailing_trim, crossfade_frames,
+                              db_to_gain(clamp_track_gain(gain_db)), peak_from_db(true_peak_db));
+    }
+    
+    size_t write_track(int id, size_t frames) { return tracks.write_staged(id, frames); }
+    size_t track_writable(int id) { return tracks.writable(id); }
+    float* track_staging_data() { return tracks.staging_data(); }
+    size_t track_staging_capacity() const { return tracks.staging_capacity(); }
+    bool stop_tracks() { return tracks.stop(); }
+    int get_current_track() const { return tracks.current_track(); }
+    TrackScheduler& track_scheduler() { return tracks; }
+    
+    // Audio thread: one quantum of the track mix into the output buffer,
+    // through volume, equalizer and time stretch like any other source.
+    // Returns frames of the mix rendered; a shortfall means a track's
+    // samples were late, is silence and counts as an underrun.
+    size_t render_tracks() {
+        begin_block();
+        if (!engage_stretcher()) {
+            const size_t got = tracks.render(io_input.view().first(RENDER_QUANTUM));
+            mix_peak = tracks.peak_level();
+            if (got < RENDER_QUANTUM) {
+                ++underruns;
+            }
+            run_io(RENDER_QUANTUM);
+            return got;
+        }
+        while (stretcher.available() < RENDER_QUANTUM) {
+            const size_t got = tracks.render(io_input.view().first(RENDER_QUANTUM));
+            mix_peak = tracks.peak_level();
+            if (got == 0) {
+                break;
+            }
+            stretcher.push(io_input.view().first(got));
+        }
+        return render_quantum();
+    }
+    
+    // Process `frames` from the input buffer into the output buffer; returns
+    // frames written, which differs from `frames` while time-stretching
+    size_t process_io(size_t frames) {
+        begin_block();
+        return run_io(frames);
+    }
+    
+    // Crossfade input and aux buffers into the output buffer, per channel
+    void crossfade_io(size_t frames, float fade_ratio) {
+        frames = std::min(frames, io_input.frames());
+        for (size_t c = 0; c < channel_count; ++c) {
+            crossfade_into(io_input.channel(c), io_aux.channel(c), io_output.channel(c), frames, fade_ratio);
+        }
+    }
+    
+    size_t pitch_shift_io(size_t frames, float pitch_factor) {
+        begin_block();
+        pitch_stream.set_ratio(1.0f, pitch_factor);
+        return stream_through(pitch_stream, io_input.view().first(frames), io_output.view());
+    }
+    
+    double get_underruns() const { return static_cast<double>(underruns); }
+    
+#ifdef FAST_AUDIO_THREADS
+    // Off-thread spectrum of everything rendered through the io buffers
+    void start_background_analysis(size_t fft_size, size_t buckets) { background.start(fft_size, buckets); }
+    void stop_background_analysis() { background.stop(); }
+    BackgroundAnalyzer& background_analyzer() { return background; }
+#endif
+
+    // Ultra-fast audio processing with SIMD optimizations. Vectors are
+    // interleaved with get_channel_count() channels; a trailing partial
+    // frame is dropped.
+    void process_audio_chunk(const std::vector<float>& input_samples, 
+                           std::vector<float>& output_samples) {
+        const size_t num_samples = whole_frames(input_samples.size());
+        begin_block();
+        
+        if (!engage_stretcher()) {
+            if (output_samples.size() != num_samples) {
+                output_samples.resize(num_samples);
+            }
+            std::copy(input_samples.begin(), input_samples.begin() + num_samples, output_samples.begin());
+            process_interleaved(output_samples.data(), num_samples);
+            return;
+        }
+        
+        // Output length now follows the speed: about num_samples / speed
+        output_samples.clear();
+        drain_stretcher(stretcher, input_samples.data(), num_samples, output_samples);
+        process_interleaved(output_samples.data(), output_samples.size());
+    }
+    
+    // Drop stretcher state, e.g. after a seek; the next block starts fresh.
+    // False if the command queue is full (retry on the next frame).
+    bool reset_stream() { return commands.try_push(Command::ResetStream); }
+    
+    // Volume, equalizer and clamp over a caller-owned interleaved buffer
+    // (num_samples counts every channel); never allocates
+    void process_in_place(float* samples, size_t num_samples) {
+        begin_block();
+        process_interleaved(samples, num_samples);
+    }
+    
+    // Optimized crossfade between tracks. The fade is the same for every
+    // channel, so interleaved tracks mix as they are, cut to whole frames.
+    // One fade for the whole call; for scheduled, per-sample crossfades
+    // between queued tracks use enqueue_track and render_tracks.
+    void crossfade_tracks(const std::vector<float>& track1, 
+                         const std::vector<float>& track2,
+                         std::vector<float>& output,
+                         float fade_ratio) {
+        const size_t num_samples = whole_frames(std::min(track1.size(), track2.size()));
+        if (output.size() != num_samples) {
+            output.resize(num_samples);
+        }
+        crossfade_into(track1.data(), track2.data(), output.data(), num_samples, fade_ratio);
+    }
+    
+    // Crossfade into a caller-owned buffer; out may alias either input
+    void crossfade_into(const float* track1, const float* track2, float* output,
+                        size_t num_samples, float fade_ratio) {
+        kernels::active().crossfade(track1, track2, output, num_samples,
+                                    std::clamp(fade_ratio, 0.0f, 1.0f));
+    }
+    
+    // Pitch shift that keeps duration, on interleaved input. Stateful:
+    // consecutive calls are one continuous stream, so output lags input by
+    // about one WSOLA hop.
+    void pitch_shift(const std::vector<float>& input, 
+                    std::vector<float>& output, 
+                    float pitch_factor) {
+        begin_block();
+        pitch_stream.set_ratio(1.0f, pitch_factor);
+        output.clear();
+        drain_stretcher(pitch_stream, input.data(), whole_frames(input.size()), output);
+    }
+    
+    // Real-time spectrum analysis for visualizations. Returns fft_size/2 bin
+    // magnitudes of the latest samples (interleaved channels are averaged);
+    // prefer analyze_spectrum + the views, which reuse their buffers.
+    std::vector<float> get_spectrum_data(const std::vector<float>& samples, size_t fft_size = 512) {
+        if (oneshot_fft_size != fft_size) {
+            oneshot_spectrum.configure(fft_size, 1);
+            oneshot_fft_size = fft_size;
+        }
+        const float* mono = samples.data();
+        size_t frames = samples.size();
+        if (channel_count > 1) {
+            frames /= channel_count;
+            downmixed.resize(frames);
+            downmix(InterleavedSpan<const float>{samples.data(), channel_count, frames}, downmixed.data());
+            mono = downmixed.data();
+        }
+        oneshot_spectrum.single_frame(mono, frames);
+        return std::vector<float>(oneshot_spectrum.bin_data(),
+                                  oneshot_spectrum.bin_data() + oneshot_spectrum.bin_count());
+    }
+    
+    void configure_spectrum(size_t fft_size, size_t buckets) { spectrum.configure(fft_size, buckets); }
+    void set_spectrum_smoothing(float amount) { spectrum.set_smoothing(amount); }
+    
+    // Analyze `count` frames from the staging buffer. With several channels
+    // JS stages them interleaved and they are averaged in place first.
+    size_t analyze_spectrum(size_t count) {
+        if (channel_count > 1) {
+            float* staging = spectrum.input_data();
+            count = std::min(count, spectrum.input_capacity() / channel_count);
+            downmix(InterleavedSpan<const float>{staging, channel_count, count}, staging);
+        }
+        return spectrum.analyze(count);
+    }
+    SpectrumAnalyzer& spectrum_analyzer() { return spectrum; }
+    
+    // Performance monitoring
+    double get_performance_metrics() {
+        auto now = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            now - last_performance_check).count();
+        
+        if (duration > 0) {
+            double samples_per_second = (samples_processed.load() * 1000.0) / duration;
+            last_performance_check = now;
+            samples_processed.store(0);
+            return samples_per_second;
+        }
+        
+        return 0.0;
+    }
+    
+    // Setters for real-time control (control thread). Each publishes a new
+    // snapshot the audio thread adopts at its next block.
+    void set_volume(float vol) {
+        control.volume = std::clamp(vol, 0.0f, 2.0f);
+        publish_params();
+    }
+    void set_speed(float spd) {
+        control.speed = std::clamp(spd, TimeStretcher::MIN_SPEED, TimeStretcher::MAX_SPEED);
+        publish_params();
+    }
+    void set_pitch(float factor) {
+        control.pitch = std::clamp(factor, TimeStretcher::MIN_PITCH, TimeStretcher::MAX_PITCH);
+        publish_params();
+    }
+    void set_muted(bool mute) {
+        control.muted = mute;
+        publish_params();
+    }
+    
+    // Loudness normalization for what plays through the stream and io
+    // paths, from the server's "loudness" event: the gain to the target
+    // level and the track's true peak. A boost that would push the peak
+    // past PeakLimiter::CEILING is limited rather than clipped. Queued
+    // tracks take theirs in enqueue_track instead.
+    void set_track_gain(float gain_db, float true_peak_db) {
+        control.track_gain = db_to_gain(clamp_track_gain(gain_db));
+        control.track_peak = peak_from_db(true_peak_db);
+        publish_params();
+    }
+    void clear_track_gain() {
+        control.track_gain = 1.0f;
+        control.track_peak = 0.0f;
+        publish_params();
+    }
+    
+    void set_equalizer_band(size_t band, float gain) {
+        if (band < ParametricEqualizer::BANDS) {
+            control.eq_gains[band] = std::clamp(gain, 0.0f, ParametricEqualizer::MAX_GAIN);
+            publish_params();
+        }
+    }
+    
+    void set_sample_rate(float hz) {
+        equalizer.set_sample_rate(hz);
+        spectrum.set_sample_rate(hz);
+        limiter.set_sample_rate(hz);
+#ifdef FAST_AUDIO_THREADS
+        background.set_sample_rate(hz);
+#endif
+    }
+    
+    // Getters (control thread): the latest values set, applied or not
+    float get_volume() const { return control.volume; }
+    float get_speed() const { return control.speed; }
+    float get_pitch() const { return control.pitch; }
+    bool is_muted() const { return control.muted; }
+    float get_track_gain() const { return 20.0f * std::log10(control.track_gain); }
+    
+    std::vector<float> get_equalizer_settings() const {
+        return std::vector<float>(control.eq_gains.begin(), control.eq_gains.end());
+    }
+    
+    // Which kernel set the dispatcher picked, for diagnostics
+    std::string get_kernel_name() const { return kernels::active().name; }
+
+private:
+    // Normalization is capped at +12 dB of boost and 24 dB of cut
+    static float clamp_track_gain(float gain_db) { return std::clamp(gain_db, -24.0f, 12.0f); }
+    static float db_to_gain(float db) { return std::pow(10.0f, db / 20.0f); }
+    // A peak at or below -120 dBTP (the server's floor) counts as unmeasured
+    static float peak_from_db(float db) { return db > -120.0f ? db_to_gain(std::min(db, 24.0f)) : 0.0f; }
+    
+    void publish_params() {
+        params.back() = control;
+        params.publish();
+    }
+    
+    // Block boundary on the audio thread: run queued commands in order, then
+    // adopt the newest parameter snapshot. Wait-free; never allocates.
+    void begin_block() {
+        Command command;
+        while (commands.try_pop(command)) {
+            stretcher.reset();
+            pitch_stream.reset();
+            stretching = false;
+            if (command == Command::FlushStream) {
+                stream.discard();
+            }
+        }
+        if (params.update()) {
+            const Params& next = params.front();
+            for (size_t band = 0; band < ParametricEqualizer::BANDS; ++band) {
+                if (next.eq_gains[band] != live.eq_gains[band]) {
+                    equalizer.set_gain(band, next.eq_gains[band]);
+                }
+            }
+            live = next;
+        }
+    }
+    
+    size_t render_quantum() {
+        const PlanarView out = io_output.view().first(RENDER_QUANTUM);
+        const size_t rendered = stretching ? stretcher.pull(out) : 0;
+        if (rendered < RENDER_QUANTUM) {
+            for (size_t c = 0; c < out.channels; ++c) {
+                std::fill(out.channel(c) + rendered, out.channel(c) + RENDER_QUANTUM, 0.0f);
+            }
+            ++underruns;
+        }
+        process_planar(out.first(rendered));
+        publish_for_analysis(out);
+        return rendered;
+    }
+    
+    size_t run_io(size_t frames) {
+        const ConstPlanarView in = io_input.view().first(frames);
+        const PlanarView out = io_output.view();
+        if (!engage_stretcher()) {
+            for (size_t c = 0; c < in.channels; ++c) {
+                std::copy(in.channel(c), in.channel(c) + in.frames, out.channel(c));
+            }
+            process_planar(out.first(in.frames));
+            publish_for_analysis(out.first(in.frames));
+            return in.frames;
+        }
+        const size_t written = stream_through(stretcher, in, out);
+        process_planar(out.first(written));
+        publish_for_analysis(out.first(written));
+        return written;
+    }
+    
+    // Up to `frames` interleaved frames from the stream ring into the planar
+    // input buffer; returns how many
+    size_t read_stream(size_t frames) {
+        frames = std::min(frames, RENDER_QUANTUM);
+        const size_t got = stream.read(stream_block.data(), frames * channel_count) / channel_count;
+        deinterleave(InterleavedSpan<const float>{stream_block.data(), channel_count, got}, io_input.view());
+        return got;
+    }
+    
+    void process_interleaved(float* samples, size_t num_samples) {
+        if (channel_count == 1) {
+            process_planar(PlanarView{samples, 1, num_samples, num_samples});
+            return;
+        }
+        const size_t frames = num_samples / channel_count;
+        for (size_t start = 0; start < frames; start += WORK_FRAMES) {
+            const InterleavedSpan<float> chunk{samples + start * channel_count, channel_count,
+                                               std::min(WORK_FRAMES, frames - start)};
+            const PlanarView planar = scratch_in.view().first(chunk.frames);
+            deinterleave(chunk, planar);
+            process_planar(planar);
+            interleave(planar, chunk);
+        }
+    }
+    
+    // Volume, equalizer and clamp over planar audio, the equalizer per
+    // channel. A volume or mute change ramps over one render quantum
+    // instead of stepping, so it never clicks. When normalization could
+    // lift a measured peak past the limiter's ceiling, the limiter replaces
+    // the clamp.
+    void process_planar(PlanarView audio) {
+        const float target = live.muted ? 0.0f : live.volume * live.track_gain;
+        const size_t total = audio.frames * audio.channels;
+        if (audio.frames == 0) {
+            return;
+        }
+        
+        if (target == 0.0f && applied_gain == 0.0f) {
+            for (size_t c = 0; c < audio.channels; ++c) {
+                std::fill(audio.channel(c), audio.channel(c) + audio.frames, 0.0f);
+            }
+            samples_processed.fetch_add(total, std::memory_order_relaxed);
+            return;
+        }
+        
+        equalizer.process(audio);
+        const float peak = std::max(applied_gain, target) * std::max(live.track_peak, mix_peak);
+        const bool limiting = limiter.active() || peak > PeakLimiter::CEILING;
+        const float limit = limiting ? std::numeric_limits<float>::max() : 1.0f;   // finite: -ffast-math
+        const auto& k = kernels::active();
+        if (applied_gain == target) {
+            for (size_t c = 0; c < audio.channels; ++c) {
+                k.scale_clamp(audio.channel(c), audio.frames, target, limit);
+            }
+        } else {
+            const size_t ramp = std::min(audio.frames, RENDER_QUANTUM);
+            const float step = (target - applied_gain) / static_cast<float>(ramp);
+            for (size_t c = 0; c < audio.channels; ++c) {
+                float* row = audio.channel(c);
+                for (size_t i = 0; i < ramp; ++i) {
+                    row[i] *= applied_gain + step * static_cast<float>(i + 1);
+                }
+                k.clamp(row, ramp, limit);
+                k.scale_clamp(row + ramp, audio.frames - ramp, target, limit);
+            }
+            applied_gain = target;
+        }
+        if (limiting) {
+            limiter.process(audio);
+        }
+        
+        samples_processed.fetch_add(total, std::memory_order_relaxed);
+    }
+    
+    // The stretcher engages on the first non-unity setting and stays in the
+    // path (exact at 1x) until reset_stream, so returning to 1x never clicks.
+    // Returns whether audio should go through it, with the ratio applied.
+    bool engage_stretcher(bool force = false) {
+        const float spd = live.speed;
+        const float pch = live.pitch;
+        if (!stretching && (force || spd != 1.0f || pch != 1.0f)) {
+            stretcher.reset();
+            stretching = true;
+        }
+        if (stretching) {
+            stretcher.set_ratio(spd, pch);
+        }
+        return stretching;
+    }
+    
+    size_t whole_frames(size_t num_samples) const { return num_samples - num_samples % channel_count; }
+    
+    // The background analyzer sees a mono downmix of what was rendered
+    void publish_for_analysis(ConstPlanarView audio) {
+#ifdef FAST_AUDIO_THREADS
+        if (!background.active()) {
+            return;
+        }
+        if (audio.channels == 1) {
+            background.feed(audio.channel(0), audio.frames);
+            return;
+        }
+        downmix(audio, analysis_mix.data());
+        background.feed(analysis_mix.data(), audio.frames);
+#else
+        (void)audio;
+#endif
+    }
+    
+    // Push all of in through engine, pulling into out as it goes; stops
+    // early only if out fills. Returns frames written.
+    static size_t stream_through(TimeStretcher& engine, ConstPlanarView in, PlanarView out) {
+        size_t consumed = 0;
+        size_t written = 0;
+        for (;;) {
+            consumed += engine.push(in.from(consumed));
+            written += engine.pull(out.from(written));
+            if (consumed == in.frames || written == out.frames) {
+                return written;
+            }
+        }
+    }
+    
+    // Interleaved in, interleaved out, through the planar scratch buffers
+    void drain_stretcher(TimeStretcher& engine, const float* input, size_t num_samples,
+                         std::vector<float>& output) {
+        const size_t channels = channel_count;
+        const size_t frames = num_samples / channels;
+        for (size_t start = 0; start < frames; start += WORK_FRAMES) {
+            const PlanarView in = scratch_in.view().first(std::min(WORK_FRAMES, frames - start));
+            deinterleave(InterleavedSpan<const float>{input + start * channels, channels, in.frames}, in);
+            size_t consumed = 0;
+            for (;;) {
+                consumed += engine.push(in.from(consumed));
+                size_t ready;
+                while ((ready = engine.pull(scratch_out.view())) > 0) {
+                    const size_t end = output.size();
+                    output.resize(end + ready * channels);
+                    interleave(scratch_out.view().first(ready),
+                               InterleavedSpan<float>{output.data() + end, channels, ready});
+                }
+                if (consumed == in.frames) {
+                    break;
+                }
+            }
+        }
+    }
+};
+
+// Advanced audio streaming with compression
+// MSB-first bit packing into a buffer sized by the caller
+class BitWriter {
+public:
+    explicit BitWriter(uint8_t* destination) : out(destination) {}
+
+    void put(uint32_t value, unsigned count) {
+        if (count == 0) {
+            return;
+        }
+        const uint64_t mask = (uint64_t{1} << count) - 1;
+        acc = (acc << count) | (value & mask);
+        bits += count;
+        while (bits >= 8) {
+            bits -= 8;
+            out[written++] = static_cast<uint8_t>(acc >> bits);
+        }
+    }
+
+    void put_signed(int32_t value, unsigned count) { put(static_cast<uint32_t>(value), count); }
+
+    // `zeros` zero bits then a one
+    void put_unary(uint32_t zeros) {
+        while (zeros >= 32) {
+            put(0, 32);
+            zeros -= 32;
+        }
+        put(1, zeros + 1);
+    }
+
+    // Pad to a byte boundary; returns bytes written
+    size_t finish() {
+        if (bits > 0) {
+            out[written++] = static_cast<uint8_t>(acc << (8 - bits));
+            bits = 0;
+        }
+        return written;
+    }
+
 private:
-    std::atomic<float> volume{1.0f};
-    std::atomic<float> speed{1.0f};
-    std::atomic<bool> muted{false};
-    std::vector<float> equalizer_bands{1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f};
-    
-    // Ring buffer for audio samples
-    static const size_t BUFFER_SIZE = 8192;
-    std::vector<float> audio_buffer;
-    std::atomic<size_t> read_pos{0};
-    std::atomic<size_t> write_pos{0};
-    
-    // Performance counters
-    std::atomic<uint64_t> samples_processed{0};
-    std::chrono::high_resolution_clock::time_point last_performance_check;
+    uint8_t* out;
+    size_t written = 0;
+    uint64_t acc = 0;
+    unsigned bits = 0;
+};
 
+class BitReader {
 public:
-    HighPerformanceAudioProcessor() : audio_buffer(BUFFER_SIZE, 0.0f) {
-        last_performance_check = std::chrono::high_resolution_clock::now();
+    BitReader(const uint8_t* source, size_t length) : data(source), size(length) {}
+
+    uint32_t get(unsigned count) {
+        if (count == 0) {
+            return 0;
+        }
+        if (bits < count) {
+            refill();
+            if (bits < count) {
+                overrun = true;
+                return 0;
+            }
+        }
+        const uint32_t value = static_cast<uint32_t>(acc >> (64 - count));
+        acc <<= count;
+        bits -= count;
+        return value;
     }
 
-    // Ultra-fast audio processing with SIMD optimizations
-    void process_audio_chunk(const std::vector<float>& input_samples, 
-                           std::vector<float>& output_samples) {
-        const size_t num_samples = input_samples.size();
-        output_samples.resize(num_samples);
-        
-        const float vol = volume.load();
-        const float spd = speed.load();
-        const bool is_muted = muted.load();
-        
-        if (is_muted) {
-            std::fill(output_samples.begin(), output_samples.end(), 0.0f);
-            return;
+    int32_t get_signed(unsigned count) {
+        const uint32_t raw = get(count);
+        const unsigned unused = 32 - count;
+        return count == 0 ? 0 : static_cast<int32_t>(raw << unused) >> unused;
+    }
+
+    uint32_t get_unary() {
+        uint32_t zeros = 0;
+        for (;;) {
+            refill();
+            if (bits == 0) {
+                overrun = true;
+                return 0;
+            }
+            // acc is MSB-aligned with zeros below the valid bits
+            const unsigned leading = acc == 0 ? 64 : static_cast<unsigned>(__builtin_clzll(acc));
+            if (leading < bits) {
+                zeros += leading;
+                acc = leading + 1 < 64 ? acc << (leading + 1) : 0;
+                bits -= leading + 1;
+                return zeros;
+            }
+            zeros += bits;
+            acc = 0;
+            bits = 0;
         }
-        
-        // Vectorized processing for maximum performance
-        #pragma omp simd
-        for (size_t i = 0; i < num_samples; ++i) {
-            float sample = input_samples[i];
-            
-            // Apply volume
-            sample *= vol;
-            
-            // Apply equalizer (simplified 8-band EQ)
-            sample = apply_equalizer_fast(sample, i);
-            
-            // Clamp to prevent distortion
-            sample = std::clamp(sample, -1.0f, 1.0f);
-            
-            output_samples[i] = sample;
+    }
+
+    bool failed() const { return overrun; }
+
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t pos = 0;
+    uint64_t acc = 0;
+    unsigned bits = 0;
+    bool overrun = false;
+
+    void refill() {
+        while (bits <= 56 && pos < size) {
+            acc |= static_cast<uint64_t>(data[pos++]) << (56 - bits);
+            bits += 8;
         }
-        
-        samples_processed.fetch_add(num_samples);
     }
-    
-    // High-speed equalizer with lookup tables
-    inline float apply_equalizer_fast(float sample, size_t sample_index) {
-        // Use bit operations for ultra-fast band selection
-        size_t band = (sample_index >> 8) & 7; // Fast modulo 8
-        return sample * equalizer_bands[band];
+};
+
+// Lossless coder for 16-bit PCM in independently decodable blocks, after
+// FLAC: each block is predicted (fixed polynomial orders 0-4 or quantized
+// LPC) and the residual is Rice coded in up to 16 partitions, each with its
+// own parameter or a raw escape. A quantization shift drops low bits first
+// when the caller trades accuracy for size.
+//
+// Block layout, byte aligned:
+//   FF C5 | samples u16 | shift u8 | method u8 (type << 4 | order) | payload bytes u16
+//   payload: one 16-bit value for constant blocks (silence), else warmup samples, LPC precision/shift/coefficients, partition
+//   order, then per partition a 5-bit Rice parameter (31 = raw, 5-bit width)
+class PcmBlockCodec {
+public:
+    static constexpr size_t BLOCK_SAMPLES = 4096;
+    static constexpr size_t HEADER_BYTES = 8;
+    static constexpr unsigned MAX_FIXED_ORDER = 4;
+    static constexpr unsigned LPC_ORDER = 8;
+    static constexpr unsigned LPC_PRECISION = 12;
+    static constexpr unsigned MAX_PARTITION_ORDER = 4;
+    static constexpr unsigned ESCAPE = 31;
+    static constexpr uint8_t SYNC0 = 0xFF;
+    static constexpr uint8_t SYNC1 = 0xC5;
+
+    enum Method : uint8_t { VERBATIM = 0, FIXED = 1, LPC = 2, CONSTANT = 3 };
+
+    PcmBlockCodec() : pcm(BLOCK_SAMPLES), residual(BLOCK_SAMPLES), candidate(BLOCK_SAMPLES),
+                      windowed(BLOCK_SAMPLES) {}
+
+    // Worst case bytes for count samples: every block verbatim
+    static size_t max_encoded_size(size_t count) {
+        const size_t blocks = (count + BLOCK_SAMPLES - 1) / BLOCK_SAMPLES;
+        return blocks * (HEADER_BYTES + 2 * BLOCK_SAMPLES + 8);
     }
-    
-    // Optimized crossfade between tracks
-    void crossfade_tracks(const std::vector<float>& track1, 
-                         const std::vector<float>& track2,
-                         std::vector<float>& output,
-                         float fade_ratio) {
-        const size_t num_samples = std::min(track1.size(), track2.size());
-        output.resize(num_samples);
-        
-        const float fade1 = 1.0f - fade_ratio;
-        const float fade2 = fade_ratio;
-        
-        #pragma omp simd
-        for (size_t i = 0; i < num_samples; ++i) {
-            output[i] = (track1[i] * fade1) + (track2[i] * fade2);
+
+    // Encode count samples in [-1, 1]; returns bytes written to out, which
+    // must hold max_encoded_size(count)
+    size_t encode(const float* samples, size_t count, unsigned shift, uint8_t* out) {
+        size_t written = 0;
+        for (size_t start = 0; start < count; start += BLOCK_SAMPLES) {
+            const size_t n = std::min(BLOCK_SAMPLES, count - start);
+            quantize(samples + start, n, shift);
+            written += encode_block(n, shift, out + written);
         }
+        return written;
     }
-    
-    // Fast pitch shifting using time-domain stretching
-    void pitch_shift(const std::vector<float>& input, 
-                    std::vector<float>& output, 
-                    float pitch_factor) {
-        const size_t input_size = input.size();
-        const size_t output_size = static_cast<size_t>(input_size / pitch_factor);
-        output.resize(output_size);
-        
-        for (size_t i = 0; i < output_size; ++i) {
-            float src_pos = i * pitch_factor;
-            size_t src_idx = static_cast<size_t>(src_pos);
-            float frac = src_pos - src_idx;
-            
-            if (src_idx + 1 < input_size) {
-                // Linear interpolation for smooth transitions
-                output[i] = input[src_idx] * (1.0f - frac) + input[src_idx + 1] * frac;
-            } else if (src_idx < input_size) {
-                output[i] = input[src_idx];
+
+    // Decode every complete block; returns samples written to out, which
+    // must hold decoded_size(). Stops at the first corrupt block.
+    size_t decode(const uint8_t* data, size_t size, float* out) {
+        size_t pos = 0;
+        size_t produced = 0;
+        while (pos + HEADER_BYTES <= size) {
+            const size_t used = decode_block(data + pos, size - pos, out + produced);
+            if (used == 0) {
+                break;
             }
+            produced += read_u16(data + pos + 2);
+            pos += used;
         }
+        return produced;
     }
-    
-    // Real-time spectrum analysis for visualizations
-    std::vector<float> get_spectrum_data(const std::vector<float>& samples, size_t fft_size = 512) {
-        std::vector<float> spectrum(fft_size / 2);
-        
-        // Simplified spectral analysis for real-time performance
-        const size_t hop = samples.size() / (fft_size / 2);
-        
-        for (size_t i = 0; i < fft_size / 2; ++i) {
-            float magnitude = 0.0f;
-            size_t start = i * hop;
-            size_t end = std::min(start + hop, samples.size());
-            
-            for (size_t j = start; j < end; ++j) {
-                magnitude += std::abs(samples[j]);
+
+    // Sample count from the block headers alone
+    static size_t decoded_size(const uint8_t* data, size_t size) {
+        size_t pos = 0;
+        size_t total = 0;
+        while (pos + HEADER_BYTES <= size && data[pos] == SYNC0 && data[pos + 1] == SYNC1) {
+            total += read_u16(data + pos + 2);
+            pos += HEADER_BYTES + read_u16(data + pos + 6);
+        }
+        return total;
+    }
+
+private:
+    std::vector<int32_t> pcm;
+    std::vector<int32_t> residual;
+    std::vector<int32_t> candidate;
+    std::vector<float> windowed;
+
+    struct Plan {
+        Method method = VERBATIM;
+        unsigned order = 0;
+        unsigned lpc_shift = 0;
+        int32_t coefficients[LPC_ORDER] = {};
+        unsigned partition_order = 0;
+        unsigned parameters[1u << MAX_PARTITION_ORDER] = {};
+        uint64_t bits = 0;
+    };
+
+    static uint16_t read_u16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+
+    static void write_u16(uint8_t* p, size_t value) {
+        p[0] = static_cast<uint8_t>(value & 0xFF);
+        p[1] = static_cast<uint8_t>((value >> 8) & 0xFF);
+    }
+
+    static uint32_t zigzag(int32_t value) {
+        return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+    }
+
+    static int32_t unzigzag(uint32_t value) {
+        return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+    }
+
+    static unsigned signed_width(int32_t value) {
+        const uint32_t magnitude = static_cast<uint32_t>(value < 0 ? ~value : value);
+        return magnitude == 0 ? 1 : 2 + static_cast<unsigned>(31 - __builtin_clz(magnitude));
+    }
+
+    void quantize(const float* samples, size_t n, unsigned shift) {
+        // Branch-free so it vectorizes; rounds half away from zero
+        const int32_t round = shift ? 1 << (shift - 1) : 0;
+        for (size_t i = 0; i < n; ++i) {
+            const float clean = samples[i] == samples[i] ? samples[i] : 0.0f; // NaN -> 0
+            const float scaled = std::min(std::max(clean, -1.0f), 1.0f) * 32767.0f;
+            const int32_t value = static_cast<int32_t>(scaled + (scaled >= 0.0f ? 0.5f : -0.5f));
+            pcm[i] = (value + round) >> shift;
+        }
+    }
+
+    static void fixed_residual(const int32_t* x, size_t n, unsigned order, int32_t* r) {
+        switch (order) {
+        case 0: for (size_t i = 0; i < n; ++i) r[i] = x[i]; break;
+        case 1: for (size_t i = 1; i < n; ++i) r[i] = x[i] - x[i - 1]; break;
+        case 2: for (size_t i = 2; i < n; ++i) r[i] = x[i] - 2 * x[i - 1] + x[i - 2]; break;
+        case 3:
+            for (size_t i = 3; i < n; ++i) r[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+            break;
+        default:
+            for (size_t i = 4; i < n; ++i)
+                r[i] = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+            break;
+        }
+    }
+
+    // The restores decode untrusted data: they work in int64_t and stop at
+    // the first sample outside [lo, hi], so a corrupt block can neither
+    // overflow nor feed an out-of-range sample into the next prediction
+    static bool fixed_restore(int32_t* x, size_t n, unsigned order, int32_t lo, int32_t hi) {
+        const auto store = [&](size_t i, int64_t value) {
+            if (value < lo || value > hi) return false;
+            x[i] = static_cast<int32_t>(value);
+            return true;
+        };
+        const auto at = [&](size_t i) { return static_cast<int64_t>(x[i]); };
+        switch (order) {
+        case 0: break;
+        case 1:
+            for (size_t i = 1; i < n; ++i)
+                if (!store(i, at(i) + at(i - 1))) return false;
+            break;
+        case 2:
+            for (size_t i = 2; i < n; ++i)
+                if (!store(i, at(i) + 2 * at(i - 1) - at(i - 2))) return false;
+            break;
+        case 3:
+            for (size_t i = 3; i < n; ++i)
+                if (!store(i, at(i) + 3 * at(i - 1) - 3 * at(i - 2) + at(i - 3))) return false;
+            break;
+        default:
+            for (size_t i = 4; i < n; ++i)
+                if (!store(i, at(i) + 4 * at(i - 1) - 6 * at(i - 2) + 4 * at(i - 3) - at(i - 4))) return false;
+            break;
+        }
+        return true;
+    }
+
+    static void lpc_residual(const int32_t* x, size_t n, unsigned order, const int32_t* c,
+                             unsigned shift, int32_t* r) {
+        for (size_t i = order; i < n; ++i) {
+            int64_t prediction = 0;
+            for (unsigned j = 0; j < order; ++j) {
+                prediction += static_cast<int64_t>(c[j]) * x[i - 1 - j];
             }
-            
-            spectrum[i] = magnitude / (end - start);
+            r[i] = x[i] - static_cast<int32_t>(prediction >> shift);
         }
-        
-        return spectrum;
     }
-    
-    // Performance monitoring
-    double get_performance_metrics() {
-        auto now = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-            now - last_performance_check).count();
-        
-        if (duration > 0) {
-            double samples_per_second = (samples_processed.load() * 1000.0) / duration;
-            last_performance_check = now;
-            samples_processed.store(0);
-            return samples_per_second;
+
+    static bool lpc_restore(int32_t* x, size_t n, unsigned order, const int32_t* c, unsigned shift,
+                            int32_t lo, int32_t hi) {
+        for (size_t i = order; i < n; ++i) {
+            int64_t prediction = 0;
+            for (unsigned j = 0; j < order; ++j) {
+                prediction += static_cast<int64_t>(c[j]) * x[i - 1 - j];
+            }
+            const int64_t value = x[i] + (prediction >> shift);
+            if (value < lo || value > hi) return false;
+            x[i] = static_cast<int32_t>(value);
         }
-        
-        return 0.0;
+        return true;
     }
     
-    // Setters for real-time control
-    void set_volume(float vol) { volume.store(std::clamp(vol, 0.0f, 2.0f)); }
-    void set_speed(float spd) { speed.store(std::clamp(spd, 0.25f, 4.0f)); }
-    void set_muted(bool mute) { muted.store(mute); }
-    
-    void set_equalizer_band(size_t band, float gain) {
-        if (band < equalizer_bands.size()) {
-            equalizer_bands[band] = std::clamp(gain, 0.0f, 3.0f);
+    // Largest residual the encoder can produce from 16-bit samples through
+    // this predictor: fixed order-k taps sum to 2^k - 1 in magnitude
+    static uint32_t residual_limit(Method method, unsigned order, const int32_t* c, unsigned shift) {
+        const int64_t sample = 32768;
+        int64_t limit = sample << order;
+        if (method == LPC) {
+            int64_t taps = 0;
+            for (unsigned j = 0; j < order; ++j) {
+                taps += std::abs(static_cast<int64_t>(c[j]));
+            }
+            limit = sample + ((taps * sample) >> shift) + 1;
         }
+        // Zigzagged residuals must fit in 32 bits
+        return static_cast<uint32_t>(std::min<int64_t>(limit, INT32_MAX / 2));
     }
-    
-    // Getters
-    float get_volume() const { return volume.load(); }
-    float get_speed() const { return speed.load(); }
-    bool is_muted() const { return muted.load(); }
-    
-    std::vector<float> get_equalizer_settings() const {
-        return equalizer_bands;
+
+    // Windowed autocorrelation + Levinson-Durbin, coefficients quantized to
+    // LPC_PRECISION bits. Returns false for silence or an unstable fit.
+    bool compute_lpc(size_t n, Plan& plan) {
+        if (n <= LPC_ORDER * 2) {
+            return false;
+        }
+        // Welch window keeps block edges from dominating the fit
+        const float half = 0.5f * static_cast<float>(n - 1);
+        for (size_t i = 0; i < n; ++i) {
+            const float t = (static_cast<float>(i) - half) / half;
+            windowed[i] = static_cast<float>(pcm[i]) * (1.0f - t * t);
+        }
+        double autoc[LPC_ORDER + 1];
+        for (unsigned lag = 0; lag <= LPC_ORDER; ++lag) {
+            double sum = 0.0;
+            for (size_t i = lag; i < n; ++i) {
+                sum += static_cast<double>(windowed[i]) * windowed[i - lag];
+            }
+            autoc[lag] = sum;
+        }
+        if (autoc[0] <= 0.0) {
+            return false;
+        }
+
+        double lpc[LPC_ORDER] = {};
+        double error = autoc[0];
+        for (unsigned i = 0; i < LPC_ORDER; ++i) {
+            double reflection = -autoc[i + 1];
+            for (unsigned j = 0; j < i; ++j) {
+                reflection -= lpc[j] * autoc[i - j];
+            }
+            reflection /= error;
+            double updated[LPC_ORDER];
+            for (unsigned j = 0; j < i; ++j) {
+                updated[j] = lpc[j] + reflection * lpc[i - 1 - j];
+            }
+            for (unsigned j = 0; j < i; ++j) {
+                lpc[j] = updated[j];
+            }
+            lpc[i] = reflection;
+            error *= 1.0 - reflection * reflection;
+            if (error <= 0.0) {
+                return false;
+            }
+        }
+
+        // Prediction is x[i] = -sum(lpc[j] x[i-1-j]); store the negated form
+        double peak = 0.0;
+        for (unsigned j = 0; j < LPC_ORDER; ++j) {
+            peak = std::max(peak, std::abs(lpc[j]));
+        }
+        if (peak <= 0.0) {
+            return false;
+        }
+        int exponent;
+        std::frexp(peak, &exponent);
+        const int shift = std::clamp(static_cast<int>(LPC_PRECISION) - 1 - exponent, 0, 15);
+        const int32_t limit = (1 << (LPC_PRECISION - 1)) - 1;
+        double carried = 0.0;
+        for (unsigned j = 0; j < LPC_ORDER; ++j) {
+            // Error feedback keeps rounding from accumulating across taps
+            const double scaled = -lpc[j] * static_cast<double>(1 << shift) + carried;
+            const int32_t q = std::clamp(static_cast<int32_t>(std::lround(scaled)), -limit - 1, limit);
+            carried = scaled - q;
+            plan.coefficients[j] = q;
+        }
+        plan.lpc_shift = static_cast<unsigned>(shift);
+        plan.order = LPC_ORDER;
+        return true;
+    }
+
+    // Best partitioning and Rice parameters for residual[order..n); exact bit count
+    static uint64_t plan_partitions(const int32_t* r, size_t n, unsigned order, Plan& plan) {
+        uint64_t best_bits = std::numeric_limits<uint64_t>::max();
+        for (unsigned p = 0; p <= MAX_PARTITION_ORDER; ++p) {
+            const size_t parts = size_t{1} << p;
+            if (n % parts != 0 || n / parts <= order) {
+                break;
+            }
+            const size_t span = n / parts;
+            uint64_t total = 4;
+            unsigned parameters[1u << MAX_PARTITION_ORDER];
+            for (size_t part = 0; part < parts; ++part) {
+                const size_t begin = part == 0 ? order : part * span;
+                const size_t end = (part + 1) * span;
+                uint64_t sum = 0;
+                int32_t widest = 0;
+                for (size_t i = begin; i < end; ++i) {
+                    sum += zigzag(r[i]);
+                    widest = std::max(widest, static_cast<int32_t>(std::abs(r[i])));
+                }
+                const size_t count = end - begin;
+                // Mean of the zigzagged values sets k; check its neighbours exactly
+                unsigned guess = 0;
+                while (guess < 30 && (uint64_t{count} << (guess + 1)) < sum) {
+                    ++guess;
+                }
+                uint64_t part_best = 5 + 5 + uint64_t{count} * signed_width(widest);
+                unsigned part_param = ESCAPE;
+                for (unsigned k = guess > 0 ? guess - 1 : 0; k <= std::min(guess + 1, 30u); ++k) {
+                    uint64_t bits = 5 + uint64_t{count} * (k + 1);
+                    for (size_t i = begin; i < end; ++i) {
+                        bits += zigzag(r[i]) >> k;
+                    }
+                    if (bits < part_best) {
+                        part_best = bits;
+                        part_param = k;
+                    }
+                }
+                parameters[part] = part_param;
+                total += part_best;
+            }
+            if (total < best_bits) {
+                best_bits = total;
+                plan.partition_order = p;
+                std::copy(parameters, parameters + parts, plan.parameters);
+            }
+        }
+        return best_bits;
+    }
+
+    size_t encode_block(size_t n, unsigned shift, uint8_t* out) {
+        const uint64_t verbatim_bits = uint64_t{16} * n;
+        Plan best;
+        best.bits = verbatim_bits;
+        if (std::all_of(pcm.begin() + 1, pcm.begin() + n, [&](int32_t v) { return v == pcm[0]; })) {
+            best.method = CONSTANT;
+        } else {
+            // Cheapest fixed order by residual magnitude, then exact Rice cost
+            unsigned fixed_order = 0;
+            uint64_t fixed_score = std::numeric_limits<uint64_t>::max();
+            for (unsigned order = 0; order <= MAX_FIXED_ORDER && order < n; ++order) {
+                fixed_residual(pcm.data(), n, order, candidate.data());
+                uint64_t score = 0;
+                for (size_t i = order; i < n; ++i) {
+                    score += static_cast<uint32_t>(std::abs(candidate[i]));
+                }
+                if (score < fixed_score) {
+                    fixed_score = score;
+                    fixed_order = order;
+                }
+            }
+            if (fixed_order < n) {
+                Plan plan;
+                plan.method = FIXED;
+                plan.order = fixed_order;
+                fixed_residual(pcm.data(), n, fixed_order, candidate.data());
+                plan.bits = uint64_t{16} * fixed_order + plan_partitions(candidate.data(), n, fixed_order, plan);
+                if (plan.bits < best.bits) {
+                    best = plan;
+                    std::swap(residual, candidate);
+                }
+            }
+
+            Plan lpc;
+            lpc.method = LPC;
+            if (compute_lpc(n, lpc)) {
+                lpc_residual(pcm.data(), n, lpc.order, lpc.coefficients, lpc.lpc_shift, candidate.data());
+                lpc.bits = uint64_t{16} * lpc.order + 4 + 5 + uint64_t{LPC_PRECISION} * lpc.order +
+                           plan_partitions(candidate.data(), n, lpc.order, lpc);
+                if (lpc.bits < best.bits) {
+                    best = lpc;
+                    std::swap(residual, candidate);
+                }
+            }
+        }
+
+        out[0] = SYNC0;
+        out[1] = SYNC1;
+        write_u16(out + 2, n);
+        out[4] = static_cast<uint8_t>(shift);
+        out[5] = static_cast<uint8_t>((best.method << 4) | best.order);
+
+        BitWriter writer(out + HEADER_BYTES);
+        if (best.method == CONSTANT) {
+            writer.put_signed(pcm[0], 16);
+        } else if (best.method == VERBATIM) {
+            for (size_t i = 0; i < n; ++i) {
+                writer.put_signed(pcm[i], 16);
+            }
+        } else {
+            for (unsigned i = 0; i < best.order; ++i) {
+                writer.put_signed(pcm[i], 16);
+            }
+            if (best.method == LPC) {
+                writer.put(LPC_PRECISION - 1, 4);
+                writer.put(best.lpc_shift, 5);
+                for (unsigned j = 0; j < best.order; ++j) {
+                    writer.put_signed(best.coefficients[j], LPC_PRECISION);
+                }
+            }
+            write_residual(writer, n, best);
+        }
+        const size_t payload = writer.finish();
+        write_u16(out + 6, payload);
+        return HEADER_BYTES + payload;
+    }
+
+    void write_residual(BitWriter& writer, size_t n, const Plan& plan) {
+        writer.put(plan.partition_order, 4);
+        const size_t parts = size_t{1} << plan.partition_order;
+        const size_t span = n / parts;
+        for (size_t part = 0; part < parts; ++part) {
+            const size_t begin = part == 0 ? plan.order : part * span;
+            const size_t end = (part + 1) * span;
+            const unsigned k = plan.parameters[part];
+            writer.put(k, 5);
+            if (k == ESCAPE) {
+                int32_t widest = 0;
+                for (size_t i = begin; i < end; ++i) {
+                    widest = std::max(widest, static_cast<int32_t>(std::abs(residual[i])));
+                }
+                const unsigned width = signed_width(widest);
+                writer.put(width, 5);
+                for (size_t i = begin; i < end; ++i) {
+                    writer.put_signed(residual[i], width);
+                }
+                continue;
+            }
+            for (size_t i = begin; i < end; ++i) {
+                const uint32_t value = zigzag(residual[i]);
+                writer.put_unary(value >> k);
+                writer.put(value, k);
+            }
+        }
+    }
+
+    // Returns bytes consumed, 0 if the block is malformed
+    size_t decode_block(const uint8_t* data, size_t size, float* out) {
+        if (data[0] != SYNC0 || data[1] != SYNC1) {
+            return 0;
+        }
+        const size_t n = read_u16(data + 2);
+        const unsigned shift = data[4];
+        const auto method = static_cast<Method>(data[5] >> 4);
+        const unsigned order = data[5] & 0x0F;
+        const size_t payload = read_u16(data + 6);
+        if (n == 0 || n > BLOCK_SAMPLES || shift > 15 || order >= n || HEADER_BYTES + payload > size ||
+            method > CONSTANT || (method == FIXED && order > MAX_FIXED_ORDER) ||
+            (method == LPC && order > LPC_ORDER)) {
+            return 0;
+        }
+
+        BitReader reader(data + HEADER_BYTES, payload);
+        int32_t* x = pcm.data();
+        // What quantize() can produce at this shift
+        const int32_t lo = -32768 >> shift;
+        const int32_t hi = 32767 >> shift;
+        if (method == CONSTANT) {
+            std::fill(x, x + n, reader.get_signed(16));
+        } else if (method == VERBATIM) {
+            for (size_t i = 0; i < n; ++i) {
+                x[i] = reader.get_signed(16);
+            }
+        } else {
+            for (unsigned i = 0; i < order; ++i) {
+                x[i] = reader.get_signed(16);
+            }
+            int32_t coefficients[LPC_ORDER] = {};
+            unsigned lpc_shift = 0;
+            if (method == LPC) {
+                const unsigned precision = reader.get(4) + 1;
+                lpc_shift = reader.get(5);
+                for (unsigned j = 0; j < order; ++j) {
+                    coefficients[j] = reader.get_signed(precision);
+                }
+            }
+            const uint32_t limit = residual_limit(method, order, coefficients, lpc_shift);
+            if (!read_residual(reader, n, order, limit, x)) {
+                return 0;
+            }
+            const bool restored = method == FIXED
+                ? fixed_restore(x, n, order, lo, hi)
+                : lpc_restore(x, n, order, coefficients, lpc_shift, lo, hi);
+            if (!restored) {
+                return 0;
+            }
+        }
+        // Verbatim, constant and warmup samples have to be in range too
+        const auto range = std::minmax_element(x, x + n);
+        if (reader.failed() || *range.first < lo || *range.second > hi) {
+            return 0;
+        }
+
+        const float scale = static_cast<float>(1 << shift) / 32767.0f;
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = static_cast<float>(x[i]) * scale;
+        }
+        return HEADER_BYTES + payload;
+    }
+
+    // Residuals beyond `limit` cannot come from the encoder; rejecting them
+    // here bounds the escape width and the Rice quotient
+    static bool read_residual(BitReader& reader, size_t n, unsigned order, uint32_t limit, int32_t* x) {
+        const unsigned partition_order = reader.get(4);
+        if (partition_order > MAX_PARTITION_ORDER) {
+            return false;
+        }
+        const size_t parts = size_t{1} << partition_order;
+        if (n % parts != 0 || n / parts <= order) {
+            return false;
+        }
+        const size_t span = n / parts;
+        const unsigned max_width = signed_width(static_cast<int32_t>(limit));
+        const uint32_t max_zigzag = limit * 2;
+        for (size_t part = 0; part < parts; ++part) {
+            const size_t begin = part == 0 ? order : part * span;
+            const size_t end = (part + 1) * span;
+            const unsigned k = reader.get(5);
+            if (k == ESCAPE) {
+                const unsigned width = reader.get(5);
+                if (width > max_width) {
+                    return false;
+                }
+                for (size_t i = begin; i < end; ++i) {
+                    x[i] = reader.get_signed(width);
+                }
+                continue;
+            }
+            const uint32_t max_high = max_zigzag >> k;
+            for (size_t i = begin; i < end; ++i) {
+                const uint32_t high = reader.get_unary();
+                if (high > max_high) {
+                    return false;
+                }
+                x[i] = unzigzag((high << k) | reader.get(k));
+            }
+            if (reader.failed()) {
+                return false;
+            }
+        }
+        return !reader.failed();
     }
 };
 
 // Advanced audio streaming with compression
 class StreamOptimizer {
 private:
+    PcmBlockCodec codec;
     std::vector<uint8_t> compression_buffer;
+    unsigned quantization_shift = 0;
     
 public:
-    // Fast audio compression for network streaming
+    // Fast audio compression for network streaming: 4096-sample blocks that
+    // each decode on their own, lossless at the default 16 bits
     std::vector<uint8_t> compress_audio_chunk(const std::vector<float>& samples) {
-        compression_buffer.clear();
-        compression_buffer.reserve(samples.size() * 2); // Rough estimate
-        
-        // Simple but effective compression using delta encoding
-        int16_t prev_sample = 0;
-        
-        for (float sample : samples) {
-            // Convert to 16-bit integer
-            int16_t int_sample = static_cast<int16_t>(sample * 32767.0f);
-            
-            // Delta encoding
-            int16_t delta = int_sample - prev_sample;
-            prev_sample = int_sample;
-            
-            // Store delta as bytes
-            compression_buffer.push_back(static_cast<uint8_t>(delta & 0xFF));
-            compression_buffer.push_back(static_cast<uint8_t>((delta >> 8) & 0xFF));
+        const size_t bytes = compress_into(samples.data(), samples.size());
+        return std::vector<uint8_t>(compression_buffer.begin(), compression_buffer.begin() + bytes);
+    }
+    
+    // Encode into the reusable buffer; returns bytes, readable via encoded_data()
+    size_t compress_into(const float* samples, size_t count) {
+        const size_t bound = PcmBlockCodec::max_encoded_size(count);
+        if (compression_buffer.size() < bound) {
+            compression_buffer.resize(bound);
         }
-        
-        return compression_buffer;
+        return codec.encode(samples, count, quantization_shift, compression_buffer.data());
     }
     
+    const uint8_t* encoded_data() const { return compression_buffer.data(); }
+    
     // Fast decompression
     std::vector<float> decompress_audio_chunk(const std::vector<uint8_t>& compressed_data) {
-        std::vector<float> samples;
-        samples.reserve(compressed_data.size() / 2);
-        
-        int16_t current_sample = 0;
-        
-        for (size_t i = 0; i < compressed_data.size(); i += 2) {
-            if (i + 1 < compressed_data.size()) {
-                // Reconstruct delta
-                int16_t delta = static_cast<int16_t>(
-                    compressed_data[i] | (compressed_data[i + 1] << 8));
-                
-                current_sample += delta;
-                
-                // Convert back to float
-                float float_sample = static_cast<float>(current_sample) / 32767.0f;
-                samples.push_back(float_sample);
-            }
-        }
-        
+        std::vector<float> samples(PcmBlockCodec::decoded_size(compressed_data.data(), compressed_data.size()));
+        samples.resize(codec.decode(compressed_data.data(), compressed_data.size(), samples.data()));
         return samples;
     }
+    
+    size_t decompress_into(const uint8_t* data, size_t size, float* out) {
+        return codec.decode(data, size, out);
+    }
+    
+    // Bits kept per sample before entropy coding: 16 is lossless on 16-bit
+    // PCM, fewer trades noise floor (~6 dB per bit) for size
+    void set_quantization_bits(unsigned bits) {
+        quantization_shift = 16 - std::clamp(bits, 8u, 16u);
+    }
+    
+    unsigned get_quantization_bits() const { return 16 - quantization_shift; }
 };
 
 } // namespace fast_audio
 
+#ifdef __EMSCRIPTEN__
 // WebAssembly bindings for JavaScript integration
 using namespace emscripten;
 
+namespace {
+
+// Float32Array views straight onto the analyzer's buffers. They detach if the
+// wasm heap grows or the spectrum is reconfigured; JS re-fetches when
+// view.length reads 0.
+val spectrum_input_view(fast_audio::HighPerformanceAudioProcessor& processor) {
+    auto& analyzer = processor.spectrum_analyzer();
+    return val(typed_memory_view(analyzer.input_capacity(), analyzer.input_data()));
+}
+
+val spectrum_bins_view(fast_audio::HighPerformanceAudioProcessor& processor) {
+    auto& analyzer = processor.spectrum_analyzer();
+    return val(typed_memory_view(analyzer.bin_count(), analyzer.bin_data()));
+}
+
+val spectrum_buckets_view(fast_audio::HighPerformanceAudioProcessor& processor) {
+    auto& analyzer = processor.spectrum_analyzer();
+    return val(typed_memory_view(analyzer.bucket_count(), analyzer.bucket_data()));
+}
+
+// The processor's io buffers, for zero-copy processing. Same detach rule as above;
+// reserveBuffers and setChannelCount also invalidate them. These are channel 0.
+val input_view(fast_audio::HighPerformanceAudioProcessor& processor) {
+    return val(typed_memory_view(processor.input_capacity(), processor.input_data()));
+}
+
+val aux_view(fast_audio::HighPerformanceAudioProcessor& processor) {
+    return val(typed_memory_view(processor.input_capacity(), processor.aux_data()));
+}
+
+val output_view(fast_audio::HighPerformanceAudioProcessor& processor) {
+    return val(typed_memory_view(processor.output_capacity(), processor.output_data()));
+}
+
+// One row of each planar io buffer per channel
+val input_channel_view(fast_audio::HighPerformanceAudioProcessor& processor, size_t channel) {
+    return val(typed_memory_view(processor.input_capacity(), processor.input_channel(channel)));
+}
+
+val aux_channel_view(fast_audio::HighPerformanceAudioProcessor& processor, size_t channel) {
+    return val(typed_memory_view(processor.input_capacity(), processor.aux_channel(channel)));
+}
+
+val output_channel_view(fast_audio::HighPerformanceAudioProcessor& processor, size_t channel) {
+    return val(typed_memory_view(processor.output_capacity(), processor.output_channel(channel)));
+}
+
+// Interleaved staging area for enqueueStream
+val stream_input_view(fast_audio::HighPerformanceAudioProcessor& processor) {
+    return val(typed_memory_view(processor.stream_staging_capacity(), processor.stream_staging_data()));
+}
+
+// Interleaved staging area for writeTrack
+val track_input_view(fast_audio::HighPerformanceAudioProcessor& processor) {
+    return val(typed_memory_view(processor.track_staging_capacity(), processor.track_staging_data()));
+}
+
+// Byte offsets into HEAPF32.buffer, for callers that build their own views
+uintptr_t input_pointer(fast_audio::HighPerformanceAudioProcessor& processor) {
+    return reinterpret_cast<uintptr_t>(processor.input_data());
+}
+
+uintptr_t output_pointer(fast_audio::HighPerformanceAudioProcessor& processor) {
+    return reinterpret_cast<uintptr_t>(processor.output_data());
+}
+
+#ifdef FAST_AUDIO_THREADS
+val background_spectrum_view(fast_audio::HighPerformanceAudioProcessor& processor) {
+    const auto& latest = processor.background_analyzer().latest();
+    return val(typed_memory_view(latest.size(), latest.data()));
+}
+
+uint32_t background_generation(fast_audio::HighPerformanceAudioProcessor& processor) {
+    return processor.background_analyzer().generation();
+}
+#endif
+
+} // namespace
+
 EMSCRIPTEN_BINDINGS(fast_audio_module) {
     class_<fast_audio::HighPerformanceAudioProcessor>("AudioProcessor")
         .constructor<>()
@@ -239,21 +3626,341 @@ EMSCRIPTEN_BINDINGS(fast_audio_module) {
         .function("crossfadeTracks", &fast_audio::HighPerformanceAudioProcessor::crossfade_tracks)
         .function("pitchShift", &fast_audio::HighPerformanceAudioProcessor::pitch_shift)
         .function("getSpectrumData", &fast_audio::HighPerformanceAudioProcessor::get_spectrum_data)
+        .function("configureSpectrum", &fast_audio::HighPerformanceAudioProcessor::configure_spectrum)
+        .function("setSpectrumSmoothing", &fast_audio::HighPerformanceAudioProcessor::set_spectrum_smoothing)
+        .function("analyzeSpectrum", &fast_audio::HighPerformanceAudioProcessor::analyze_spectrum)
+        .function("getSpectrumInputView", &spectrum_input_view)
+        .function("getSpectrumBinsView", &spectrum_bins_view)
+        .function("getSpectrumView", &spectrum_buckets_view)
         .function("getPerformanceMetrics", &fast_audio::HighPerformanceAudioProcessor::get_performance_metrics)
         .function("setVolume", &fast_audio::HighPerformanceAudioProcessor::set_volume)
         .function("setSpeed", &fast_audio::HighPerformanceAudioProcessor::set_speed)
+        .function("setPitch", &fast_audio::HighPerformanceAudioProcessor::set_pitch)
+        .function("resetStream", &fast_audio::HighPerformanceAudioProcessor::reset_stream)
         .function("setMuted", &fast_audio::HighPerformanceAudioProcessor::set_muted)
+        .function("setTrackGain", &fast_audio::HighPerformanceAudioProcessor::set_track_gain)
+        .function("clearTrackGain", &fast_audio::HighPerformanceAudioProcessor::clear_track_gain)
         .function("setEqualizerBand", &fast_audio::HighPerformanceAudioProcessor::set_equalizer_band)
+        .function("setSampleRate", &fast_audio::HighPerformanceAudioProcessor::set_sample_rate)
         .function("getVolume", &fast_audio::HighPerformanceAudioProcessor::get_volume)
         .function("getSpeed", &fast_audio::HighPerformanceAudioProcessor::get_speed)
+        .function("getPitch", &fast_audio::HighPerformanceAudioProcessor::get_pitch)
         .function("isMuted", &fast_audio::HighPerformanceAudioProcessor::is_muted)
-        .function("getEqualizerSettings", &fast_audio::HighPerformanceAudioProcessor::get_equalizer_settings);
+        .function("getTrackGain", &fast_audio::HighPerformanceAudioProcessor::get_track_gain)
+        .function("getEqualizerSettings", &fast_audio::HighPerformanceAudioProcessor::get_equalizer_settings)
+        .function("getKernelName", &fast_audio::HighPerformanceAudioProcessor::get_kernel_name)
+        .function("reserveBuffers", &fast_audio::HighPerformanceAudioProcessor::reserve_io)
+        .function("getInputView", &input_view)
+        .function("getAuxView", &aux_view)
+        .function("getOutputView", &output_view)
+        .function("setChannelCount", &fast_audio::HighPerformanceAudioProcessor::set_channel_count)
+        .function("getChannelCount", &fast_audio::HighPerformanceAudioProcessor::get_channel_count)
+        .function("getInputChannelView", &input_channel_view)
+        .function("getAuxChannelView", &aux_channel_view)
+        .function("getOutputChannelView", &output_channel_view)
+        .function("getInputPointer", &input_pointer)
+        .function("getOutputPointer", &output_pointer)
+        .function("processBlock", &fast_audio::HighPerformanceAudioProcessor::process_block)
+        .function("pushInput", &fast_audio::HighPerformanceAudioProcessor::push_input)
+        .function("outputAvailable", &fast_audio::HighPerformanceAudioProcessor::output_available)
+        .function("renderBlock", &fast_audio::HighPerformanceAudioProcessor::render_block)
+        .function("processBuffer", &fast_audio::HighPerformanceAudioProcessor::process_io)
+        .function("crossfadeBuffers", &fast_audio::HighPerformanceAudioProcessor::crossfade_io)
+        .function("pitchShiftBuffer", &fast_audio::HighPerformanceAudioProcessor::pitch_shift_io)
+        .function("getUnderruns", &fast_audio::HighPerformanceAudioProcessor::get_underruns)
+        .function("getStreamInputView", &stream_input_view)
+        .function("enqueueStream", &fast_audio::HighPerformanceAudioProcessor::enqueue_stream)
+        .function("renderStream", &fast_audio::HighPerformanceAudioProcessor::render_stream)
+        .function("streamBuffered", &fast_audio::HighPerformanceAudioProcessor::stream_buffered)
+        .function("flushStream", &fast_audio::HighPerformanceAudioProcessor::flush_stream)
+        .function("enqueueTrack", &fast_audio::HighPerformanceAudioProcessor::enqueue_track)
+        .function("getTrackInputView", &track_input_view)
+        .function("writeTrack", &fast_audio::HighPerformanceAudioProcessor::write_track)
+        .function("trackWritable", &fast_audio::HighPerformanceAudioProcessor::track_writable)
+        .function("renderTracks", &fast_audio::HighPerformanceAudioProcessor::render_tracks)
+        .function("stopTracks", &fast_audio::HighPerformanceAudioProcessor::stop_tracks)
+        .function("getCurrentTrack", &fast_audio::HighPerformanceAudioProcessor::get_current_track)
+#ifdef FAST_AUDIO_THREADS
+        .function("startBackgroundAnalysis", &fast_audio::HighPerformanceAudioProcessor::start_background_analysis)
+        .function("stopBackgroundAnalysis", &fast_audio::HighPerformanceAudioProcessor::stop_background_analysis)
+        .function("getBackgroundSpectrumView", &background_spectrum_view)
+        .function("getBackgroundSpectrumGeneration", &background_generation)
+#endif
+        ;
     
     class_<fast_audio::StreamOptimizer>("StreamOptimizer")
         .constructor<>()
         .function("compressAudioChunk", &fast_audio::StreamOptimizer::compress_audio_chunk)
-        .function("decompressAudioChunk", &fast_audio::StreamOptimizer::decompress_audio_chunk);
+        .function("decompressAudioChunk", &fast_audio::StreamOptimizer::decompress_audio_chunk)
+        .function("setQuantizationBits", &fast_audio::StreamOptimizer::set_quantization_bits)
+        .function("getQuantizationBits", &fast_audio::StreamOptimizer::get_quantization_bits);
     
     register_vector<float>("VectorFloat");
     register_vector<uint8_t>("VectorUint8");
 }
+#endif // __EMSCRIPTEN__
+
+#ifdef FAST_AUDIO_BENCHMARK
+// Kernel and codec benchmark: ./audio_kernel_bench [block_samples] [iterations]
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+template <typename Fn>
+double samples_per_second(size_t block, size_t iterations, Fn&& fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        fn();
+    }
+    const double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    return seconds > 0.0 ? (static_cast<double>(block) * iterations) / seconds : 0.0;
+}
+
+void bench_table(const fast_audio::kernels::KernelTable& k, size_t block, size_t iterations,
+                 std::vector<float>& a, const std::vector<float>& b, const std::vector<float>& c) {
+    const double scale = samples_per_second(block, iterations, [&] {
+        k.scale(a.data(), block, 0.999f);
+    });
+    const double clamp = samples_per_second(block, iterations, [&] {
+        k.clamp(a.data(), block, 0.5f);
+    });
+    const double gain_clamp = samples_per_second(block, iterations, [&] {
+        k.scale_clamp(a.data(), block, 1.001f, 1.0f);
+    });
+    const double fade = samples_per_second(block, iterations, [&] {
+        k.crossfade(b.data(), c.data(), a.data(), block, 0.3f);
+    });
+    const double mix = samples_per_second(block, iterations, [&] {
+        k.mix_curve(b.data(), c.data(), a.data(), block);
+    });
+    std::printf("%-14s %10.1f %10.1f %10.1f %10.1f %10.1f\n", k.name,
+                scale / 1e6, clamp / 1e6, gain_clamp / 1e6, fade / 1e6, mix / 1e6);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const size_t block = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4096;
+    const size_t iterations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20000;
+
+    std::vector<float> a(block), b(block), c(block);
+    for (size_t i = 0; i < block; ++i) {
+        a[i] = std::sin(static_cast<float>(i) * 0.01f);
+        b[i] = a[i] * 0.5f;
+        c[i] = std::cos(static_cast<float>(i) * 0.013f);
+    }
+
+    std::printf("block=%zu samples, %zu iterations (Msamples/s)\n", block, iterations);
+    std::printf("%-14s %10s %10s %10s %10s %10s\n", "kernels", "gain", "clamp", "gain+clamp", "crossfade",
+                "mix curve");
+    bench_table(fast_audio::kernels::scalar_kernels, block, iterations, a, b, c);
+    bench_table(fast_audio::kernels::active(), block, iterations, a, b, c);
+
+    fast_audio::HighPerformanceAudioProcessor processor;
+    processor.set_equalizer_band(2, 1.5f);
+    const double full = samples_per_second(block, iterations, [&] {
+        processor.process_in_place(a.data(), block);
+    });
+    std::printf("process_in_place (%s): %.1f Msamples/s\n",
+                processor.get_kernel_name().c_str(), full / 1e6);
+    // Interleaved stereo goes through the planar scratch and a per-channel EQ
+    processor.set_channel_count(2);
+    const double stereo = samples_per_second(block, iterations, [&] {
+        processor.process_in_place(a.data(), block);
+    });
+    std::printf("process_in_place, interleaved stereo: %.1f Msamples/s\n", stereo / 1e6);
+
+    // Worst case for the equalizer: every band active, one AudioWorklet quantum at a time
+    fast_audio::ParametricEqualizer equalizer;
+    for (size_t band = 0; band < fast_audio::ParametricEqualizer::BANDS; ++band) {
+        equalizer.set_gain(band, band % 2 ? 0.5f : 2.0f);
+    }
+    const size_t quantum = 128;
+    const double eq_rate = samples_per_second(quantum, iterations, [&] {
+        equalizer.process(a.data(), std::min(quantum, block));
+    });
+    std::printf("equalizer, 8 active bands: %.2f us per %zu-sample block\n",
+                eq_rate > 0.0 ? quantum * 1e6 / eq_rate : 0.0, quantum);
+
+    // One visualizer frame at 60 fps and 48 kHz: 800 new samples into a 2048-point analysis
+    fast_audio::SpectrumAnalyzer analyzer;
+    const size_t frame_samples = std::min<size_t>(800, block);
+    const size_t spectrum_iterations = std::max<size_t>(iterations / 10, 1);
+    const double spectrum_rate = samples_per_second(frame_samples, spectrum_iterations, [&] {
+        analyzer.analyze(a.data(), frame_samples);
+    });
+    std::printf("spectrum, %zu-point FFT + %zu buckets: %.2f us per 60 fps frame\n",
+                analyzer.fft_size(), analyzer.bucket_count(),
+                spectrum_rate > 0.0 ? frame_samples * 1e6 / spectrum_rate : 0.0);
+
+    // A pure tone must stay narrow-band when one push spans several hops;
+    // frames that wrap the history show up as energy far from the tone
+    bool spectrum_ok = true;
+    {
+        fast_audio::SpectrumAnalyzer tone_analyzer;
+        tone_analyzer.set_smoothing(0.0f);
+        std::vector<float> tone(tone_analyzer.fft_size() * 2);
+        for (size_t i = 0; i < tone.size(); ++i) {
+            tone[i] = static_cast<float>(std::sin(2.0 * M_PI * 1000.0 * i / 48000.0));
+        }
+        const size_t frames = tone_analyzer.analyze(tone.data(), tone.size());
+        double total = 0.0, far = 0.0;
+        for (size_t k = 0; k < tone_analyzer.bin_count(); ++k) {
+            const double energy = static_cast<double>(tone_analyzer.bin_data()[k]) * tone_analyzer.bin_data()[k];
+            total += energy;
+            far += k >= 300 && k < 1000 ? energy : 0.0;
+        }
+        const double leakage = total > 0.0 ? far / total : 1.0;
+        spectrum_ok = leakage < 1e-4;
+        std::printf("spectrum, 1 kHz tone in one %zu-sample push (%zu frames): %.2g of energy in bins 300-1000 %s\n",
+                    tone.size(), frames, leakage, spectrum_ok ? "(ok)" : "(FAIL)");
+    }
+
+    // Time stretch at the extremes, as multiples of realtime at 48 kHz
+    const float ratios[][2] = {{0.25f, 1.0f}, {4.0f, 1.0f}, {1.0f, 2.0f}, {0.25f, 2.0f}};
+    std::vector<float> stretched(block * 16);
+    const fast_audio::ConstPlanarView mono_in{a.data(), 1, block, block};
+    const fast_audio::PlanarView mono_out{stretched.data(), 1, stretched.size(), stretched.size()};
+    for (const auto& ratio : ratios) {
+        fast_audio::TimeStretcher stretcher;
+        stretcher.set_ratio(ratio[0], ratio[1]);
+        const double rate = samples_per_second(block, spectrum_iterations, [&] {
+            size_t consumed = 0;
+            while (consumed < block) {
+                consumed += stretcher.push(mono_in.from(consumed));
+                stretcher.pull(mono_out);
+            }
+        });
+        std::printf("stretch speed %.2f pitch %.2f: %.0fx realtime\n",
+                    ratio[0], ratio[1], rate / 48000.0);
+    }
+
+    // Track mixer in the middle of a stereo crossfade: two voices, both on fade curves
+    {
+        fast_audio::TrackScheduler scheduler;
+        scheduler.set_channels(2);
+        const size_t track_frames = std::numeric_limits<uint32_t>::max();
+        const int first = scheduler.enqueue(track_frames, 0, 0, 0);
+        const int second = scheduler.enqueue(track_frames, 0, 0, track_frames);
+        std::vector<float> interleaved(quantum * 2, 0.1f);
+        fast_audio::PlanarBuffer mixed;
+        mixed.resize(2, quantum);
+        const double mix_rate = samples_per_second(quantum, iterations, [&] {
+            scheduler.write(first, interleaved.data(), quantum);
+            scheduler.write(second, interleaved.data(), quantum);
+            scheduler.render(mixed.view());
+        });
+        std::printf("track mixer, 2-voice stereo crossfade: %.2f us per %zu-frame block\n",
+                    mix_rate > 0.0 ? quantum * 1e6 / mix_rate : 0.0, quantum);
+    }
+
+    // Peak limiter holding down a signal that is over its ceiling throughout
+    {
+        fast_audio::PeakLimiter limiter;
+        fast_audio::PlanarBuffer boosted;
+        boosted.resize(2, quantum);
+        const double limit_rate = samples_per_second(quantum, iterations, [&] {
+            for (size_t c = 0; c < 2; ++c) {
+                std::fill(boosted.channel(c), boosted.channel(c) + quantum, 1.2f);
+            }
+            limiter.process(boosted.view());
+        });
+        std::printf("peak limiter, stereo, limiting: %.2f us per %zu-frame block\n",
+                    limit_rate > 0.0 ? quantum * 1e6 / limit_rate : 0.0, quantum);
+    }
+
+    // Codec on ten seconds of a music-like test signal: a few partials with
+    // vibrato and a slow envelope over a -60 dB noise floor
+    const size_t codec_samples = 48000 * 10;
+    std::vector<float> music(codec_samples);
+    uint32_t noise = 12345;
+    for (size_t i = 0; i < codec_samples; ++i) {
+        const double t = static_cast<double>(i) / 48000.0;
+        const double envelope = 0.6 + 0.4 * std::sin(2.0 * M_PI * 0.5 * t);
+        double value = 0.0;
+        for (int partial = 1; partial <= 5; ++partial) {
+            value += std::sin(2.0 * M_PI * 220.0 * partial * t + 0.3 * std::sin(2.0 * M_PI * 5.0 * t)) / partial;
+        }
+        noise = noise * 1664525u + 1013904223u;
+        value = 0.3 * envelope * value + 0.001 * (static_cast<double>(noise >> 8) / (1 << 24) - 0.5);
+        music[i] = static_cast<float>(value);
+    }
+    std::vector<float> decoded(codec_samples);
+    const double pcm_megabytes = codec_samples * 2 / 1e6;
+    for (unsigned bits : {16u, 12u}) {
+        fast_audio::StreamOptimizer optimizer;
+        optimizer.set_quantization_bits(bits);
+        size_t encoded = 0;
+        const int passes = 5;
+        auto start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < passes; ++pass) {
+            encoded = optimizer.compress_into(music.data(), codec_samples);
+        }
+        const double encode_seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count() / passes;
+        std::vector<uint8_t> stream(optimizer.encoded_data(), optimizer.encoded_data() + encoded);
+        size_t restored = 0;
+        start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < passes; ++pass) {
+            restored = optimizer.decompress_into(stream.data(), stream.size(), decoded.data());
+        }
+        const double decode_seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count() / passes;
+        float max_error = 0.0f;
+        for (size_t i = 0; i < restored; ++i) {
+            max_error = std::max(max_error, std::abs(decoded[i] - music[i]));
+        }
+        std::printf("codec %2u-bit: ratio %.2f vs PCM16, encode %.0f MB/s, decode %.0f MB/s, "
+                    "max error %.2g (%zu/%zu samples)\n",
+                    bits, codec_samples * 2.0 / encoded, pcm_megabytes / encode_seconds,
+                    pcm_megabytes / decode_seconds, max_error, restored, codec_samples);
+    }
+
+    // Decoding untrusted data: a FIXED order-4 block whose escaped residuals
+    // are 2^29 must be rejected, while a full-scale square wave, whose
+    // residuals need 18 bits, must still round-trip exactly
+    bool codec_ok = true;
+    {
+        using fast_audio::PcmBlockCodec;
+        const size_t n = 64;
+        std::vector<uint8_t> block(1024);
+        block[0] = PcmBlockCodec::SYNC0;
+        block[1] = PcmBlockCodec::SYNC1;
+        block[2] = static_cast<uint8_t>(n);
+        block[5] = static_cast<uint8_t>((PcmBlockCodec::FIXED << 4) | 4);
+        fast_audio::BitWriter writer(block.data() + PcmBlockCodec::HEADER_BYTES);
+        for (int i = 0; i < 4; ++i) {
+            writer.put_signed(0, 16);
+        }
+        writer.put(0, 4);
+        writer.put(PcmBlockCodec::ESCAPE, 5);
+        writer.put(31, 5);
+        for (size_t i = 4; i < n; ++i) {
+            writer.put_signed(1 << 29, 31);
+        }
+        const size_t payload = writer.finish();
+        block[6] = static_cast<uint8_t>(payload & 0xFF);
+        block[7] = static_cast<uint8_t>(payload >> 8);
+        fast_audio::StreamOptimizer optimizer;
+        std::vector<float> out(n);
+        const size_t malformed = optimizer.decompress_into(block.data(), PcmBlockCodec::HEADER_BYTES + payload,
+                                                           out.data());
+
+        std::vector<float> square(PcmBlockCodec::BLOCK_SAMPLES);
+        for (size_t i = 0; i < square.size(); ++i) {
+            square[i] = (i / 100) % 2 ? 1.0f : -1.0f;
+        }
+        const size_t encoded = optimizer.compress_into(square.data(), square.size());
+        std::vector<uint8_t> stream(optimizer.encoded_data(), optimizer.encoded_data() + encoded);
+        std::vector<float> restored(square.size());
+        const size_t count = optimizer.decompress_into(stream.data(), stream.size(), restored.data());
+        codec_ok = malformed == 0 && count == square.size() && restored == square;
+        std::printf("codec, untrusted input: overflowing block %s, full-scale square wave %s %s\n",
+                    malformed == 0 ? "rejected" : "decoded", restored == square ? "round-trips" : "differs",
+                    codec_ok ? "(ok)" : "(FAIL)");
+    }
+    return spectrum_ok && codec_ok ? 0 : 1;
+}
+#endif // FAST_AUDIO_BENCHMARK
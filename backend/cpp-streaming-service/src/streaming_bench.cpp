@@ -0,0 +1,598 @@
+// End-to-end load generator for streaming_server. Opens thousands of local
+// websocket listeners, drives a play/seek/pause mix against them and reports
+// time to first byte, pacing jitter, throughput and the server's CPU/RSS.
+//
+//   streaming_bench --server ./streaming_server --clients 10000 --duration 60
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <websocketpp/config/asio_no_tls_client.hpp>
+#include <websocketpp/client.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include "latency_histogram.hpp"
+
+namespace catch_streaming {
+
+typedef std::chrono::steady_clock bench_clock;
+typedef websocketpp::client<websocketpp::config::asio_client> ws_client;
+
+struct BenchOptions {
+    std::string url = "ws://127.0.0.1:9001";
+    unsigned clients = 10000;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned duration_seconds = 60;
+    unsigned ramp_per_second = 2000;   // New connections per second
+    double action_interval = 5.0;      // Mean seconds between a listener's actions
+    unsigned mix_seek = 40;            // Relative weights of the action mix
+    unsigned mix_pause = 30;
+    unsigned mix_play = 30;
+    unsigned tracks = 16;
+    unsigned track_seconds = 300;
+    std::string audio_root = "/tmp/catch_bench_audio";
+    std::string server_binary;         // Spawned against audio_root when set
+    pid_t server_pid = 0;              // Or an already running server to sample
+    double max_failure_ratio = 0.01;   // Exit non-zero above these
+    double max_p99_ttfb_ms = 0;
+    double max_p99_jitter_ms = 0;
+};
+
+// The generated tracks are silent MPEG-1 Layer III, 128 kbps, 44.1 kHz:
+// unpadded 417-byte frames of 1152 samples each
+static const size_t DUMMY_FRAME_BYTES = 417;
+static const double DUMMY_FRAME_SECONDS = 1152 / 44100.0;
+static const double DUMMY_BYTES_PER_SECOND = DUMMY_FRAME_BYTES / DUMMY_FRAME_SECONDS;
+
+// Mirrors the server's prebuffer lead; gaps inside the burst are not jitter
+static const double SERVER_PREBUFFER_SECONDS = 1.0;
+
+static std::string dummy_track_id(unsigned index) {
+    char id[32];
+    std::snprintf(id, sizeof(id), "bench_%04u", index);
+    return id;
+}
+
+static bool write_dummy_tracks(const BenchOptions& options) {
+    mkdir(options.audio_root.c_str(), 0755);
+    const std::string tracks_dir = options.audio_root + "/tracks/";
+    mkdir(tracks_dir.c_str(), 0755);
+
+    std::vector<uint8_t> frame(DUMMY_FRAME_BYTES, 0);
+    frame[0] = 0xFF;
+    frame[1] = 0xFB; // MPEG-1 Layer III, no CRC
+    frame[2] = 0x90; // 128 kbps, 44.1 kHz, no padding
+    frame[3] = 0x00;
+    const size_t frames = static_cast<size_t>(options.track_seconds / DUMMY_FRAME_SECONDS);
+
+    for (unsigned i = 0; i < options.tracks; ++i) {
+        const std::string path = tracks_dir + dummy_track_id(i) + ".mp3";
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && static_cast<size_t>(st.st_size) == frames * frame.size()) {
+            continue;
+        }
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        if (!file) return false;
+        bool ok = true;
+        for (size_t f = 0; f < frames && ok; ++f) {
+            ok = std::fwrite(frame.data(), 1, frame.size(), file) == frame.size();
+        }
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok) return false;
+    }
+    return true;
+}
+
+// CPU time and memory of a process, from /proc
+struct ProcessSample {
+    bench_clock::time_point taken;
+    double cpu_seconds = 0;
+    size_t rss_bytes = 0;
+    size_t peak_rss_bytes = 0;
+
+    static bool read(pid_t pid, ProcessSample& out) {
+        out.taken = bench_clock::now();
+        const std::string proc = "/proc/" + std::to_string(pid);
+
+        std::FILE* stat_file = std::fopen((proc + "/stat").c_str(), "r");
+        if (!stat_file) return false;
+        char buffer[1024];
+        const size_t length = std::fread(buffer, 1, sizeof(buffer) - 1, stat_file);
+        std::fclose(stat_file);
+        buffer[length] = '\0';
+        // Fields after the parenthesised command name; utime and stime are 14 and 15
+        const char* fields = std::strrchr(buffer, ')');
+        unsigned long utime = 0, stime = 0;
+        if (!fields || std::sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                                   &utime, &stime) != 2) {
+            return false;
+        }
+        out.cpu_seconds = double(utime + stime) / sysconf(_SC_CLK_TCK);
+
+        std::FILE* status = std::fopen((proc + "/status").c_str(), "r");
+        if (!status) return false;
+        char line[256];
+        while (std::fgets(line, sizeof(line), status)) {
+            unsigned long kb = 0;
+            if (std::sscanf(line, "VmRSS: %lu kB", &kb) == 1) out.rss_bytes = kb * 1024;
+            if (std::sscanf(line, "VmHWM: %lu kB", &kb) == 1) out.peak_rss_bytes = kb * 1024;
+        }
+        std::fclose(status);
+        return true;
+    }
+};
+
+// Listener counters and histograms for one worker. Only that worker's io
+// thread writes them; the progress reporter reads them concurrently.
+struct WorkerStats {
+    LatencyHistogram ttfb;          // play -> first audio byte
+    LatencyHistogram seek_latency;  // seek/resume -> first audio byte
+    LatencyHistogram jitter;        // |inter-arrival gap - expected gap| once paced
+    std::atomic<uint64_t> connected{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<uint64_t> dropped{0};   // Closed by the server mid-run
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> actions{0};
+
+    static void bump(std::atomic<uint64_t>& cell, uint64_t delta = 1) {
+        cell.store(cell.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+};
+
+// One io thread and websocketpp client endpoint driving a slice of the listeners
+class BenchWorker {
+public:
+    BenchWorker(const BenchOptions& opts, unsigned worker_index, unsigned listener_count)
+        : options(opts), work(new boost::asio::io_service::work(io)), ramp_timer(io),
+          rng(0x5eed + worker_index), listeners(listener_count) {
+        endpoint.clear_access_channels(websocketpp::log::alevel::all);
+        endpoint.clear_error_channels(websocketpp::log::elevel::all);
+        endpoint.init_asio(&io);
+        for (auto& listener : listeners) {
+            listener.action_timer.reset(new boost::asio::steady_timer(io));
+        }
+    }
+
+    void start() {
+        thread = std::thread([this] {
+            io.post([this] { ramp_up(); });
+            io.run();
+        });
+    }
+
+    // Closes every connection, then lets the io thread finish
+    void stop() {
+        io.post([this] {
+            stopping = true;
+            ramp_timer.cancel();
+            for (auto& listener : listeners) {
+                listener.action_timer->cancel();
+                if (auto con = listener.connection.lock()) {
+                    websocketpp::lib::error_code ec;
+                    con->close(websocketpp::close::status::going_away, "bench finished", ec);
+                }
+            }
+            work.reset();
+        });
+
+        // Connections that never finish their close handshake must not hang the run
+        auto deadline = bench_clock::now() + std::chrono::seconds(3);
+        while (!io.stopped() && bench_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        io.stop();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    const WorkerStats& get_stats() const { return stats; }
+
+private:
+    struct Listener {
+        std::weak_ptr<ws_client::connection_type> connection;
+        std::unique_ptr<boost::asio::steady_timer> action_timer;
+        bench_clock::time_point requested;     // Last play/seek/resume
+        bench_clock::time_point last_arrival;
+        LatencyHistogram* pending_latency = nullptr; // Where the next first byte is recorded
+        size_t bytes_since_request = 0;
+        unsigned track = 0;
+        bool paused = false;
+    };
+
+    void ramp_up() {
+        // Spread each worker's share of the ramp over 10ms steps
+        const unsigned per_step = std::max(1u, options.ramp_per_second / options.threads / 100);
+        for (unsigned i = 0; i < per_step && next_to_connect < listeners.size(); ++i) {
+            connect(next_to_connect++);
+        }
+        if (next_to_connect < listeners.size() && !stopping) {
+            ramp_timer.expires_after(std::chrono::milliseconds(10));
+            ramp_timer.async_wait([this](const boost::system::error_code& ec) {
+                if (!ec) ramp_up();
+            });
+        }
+    }
+
+    void connect(size_t index) {
+        websocketpp::lib::error_code ec;
+        auto con = endpoint.get_connection(options.url, ec);
+        if (ec) {
+            WorkerStats::bump(stats.failed);
+            return;
+        }
+
+        con->set_open_handler([this, index](websocketpp::connection_hdl) {
+            WorkerStats::bump(stats.connected);
+            Listener& listener = listeners[index];
+            listener.track = std::uniform_int_distribution<unsigned>(0, options.tracks - 1)(rng);
+            send_request(listener, "{\"action\":\"play\",\"track_id\":\"" + dummy_track_id(listener.track) + "\"}",
+                         &stats.ttfb);
+            schedule_action(index);
+        });
+        con->set_fail_handler([this](websocketpp::connection_hdl) {
+            WorkerStats::bump(stats.failed);
+        });
+        con->set_close_handler([this, index](websocketpp::connection_hdl) {
+            listeners[index].action_timer->cancel();
+            if (!stopping) WorkerStats::bump(stats.dropped);
+        });
+        con->set_message_handler([this, index](websocketpp::connection_hdl, ws_client::message_ptr msg) {
+            on_audio(listeners[index], msg->get_payload().size());
+        });
+
+        listeners[index].connection = con;
+        endpoint.connect(con);
+    }
+
+    void send_request(Listener& listener, const std::string& request, LatencyHistogram* latency) {
+        auto con = listener.connection.lock();
+        if (!con) return;
+        listener.requested = bench_clock::now();
+        listener.pending_latency = latency;
+        listener.bytes_since_request = 0;
+        con->send(request, websocketpp::frame::opcode::text);
+        WorkerStats::bump(stats.actions);
+    }
+
+    void on_audio(Listener& listener, size_t size) {
+        const auto now = bench_clock::now();
+        WorkerStats::bump(stats.bytes, size);
+        WorkerStats::bump(stats.messages);
+
+        if (listener.pending_latency) {
+            listener.pending_latency->record(micros(now - listener.requested));
+            listener.pending_latency = nullptr;
+        } else if (listener.bytes_since_request > SERVER_PREBUFFER_SECONDS * DUMMY_BYTES_PER_SECOND) {
+            // Past the prebuffer burst each chunk should trail the last by its own duration
+            const double expected = size / DUMMY_BYTES_PER_SECOND;
+            const double gap = std::chrono::duration<double>(now - listener.last_arrival).count();
+            stats.jitter.record(static_cast<uint64_t>(std::abs(gap - expected) * 1e6));
+        }
+        listener.bytes_since_request += size;
+        listener.last_arrival = now;
+    }
+
+    void schedule_action(size_t index) {
+        std::exponential_distribution<double> wait(1.0 / options.action_interval);
+        Listener& listener = listeners[index];
+        listener.action_timer->expires_after(std::chrono::duration_cast<bench_clock::duration>(
+            std::chrono::duration<double>(wait(rng))));
+        listener.action_timer->async_wait([this, index](const boost::system::error_code& ec) {
+            if (!ec && !stopping) run_action(index);
+        });
+    }
+
+    void run_action(size_t index) {
+        Listener& listener = listeners[index];
+        if (listener.paused) {
+            listener.paused = false;
+            send_request(listener, "{\"action\":\"resume\"}", &stats.seek_latency);
+            schedule_action(index);
+            return;
+        }
+
+        const unsigned total = options.mix_seek + options.mix_pause + options.mix_play;
+        const unsigned pick = std::uniform_int_distribution<unsigned>(0, std::max(total, 1u) - 1)(rng);
+        if (pick < options.mix_seek) {
+            const unsigned position_ms = std::uniform_int_distribution<unsigned>(
+                0, std::max(options.track_seconds, 2u) * 1000 - 1000)(rng);
+            send_request(listener, "{\"action\":\"seek\",\"position_ms\":" + std::to_string(position_ms) + "}",
+                         &stats.seek_latency);
+            schedule_action(index);
+        } else if (pick < options.mix_seek + options.mix_pause) {
+            send_request(listener, "{\"action\":\"pause\"}", nullptr);
+            listener.paused = true;
+            // Resume after a short break
+            listener.action_timer->expires_after(std::chrono::milliseconds(
+                std::uniform_int_distribution<int>(500, 2000)(rng)));
+            listener.action_timer->async_wait([this, index](const boost::system::error_code& ec) {
+                if (!ec && !stopping) run_action(index);
+            });
+        } else {
+            listener.track = std::uniform_int_distribution<unsigned>(0, options.tracks - 1)(rng);
+            send_request(listener, "{\"action\":\"play\",\"track_id\":\"" + dummy_track_id(listener.track) + "\"}",
+                         &stats.ttfb);
+            schedule_action(index);
+        }
+    }
+
+    static uint64_t micros(bench_clock::duration elapsed) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    }
+
+    const BenchOptions& options;
+    boost::asio::io_service io;
+    std::unique_ptr<boost::asio::io_service::work> work;
+    ws_client endpoint;
+    boost::asio::steady_timer ramp_timer;
+    std::mt19937 rng;
+    std::vector<Listener> listeners;
+    size_t next_to_connect = 0;
+    bool stopping = false;
+    WorkerStats stats;
+    std::thread thread;
+};
+
+class StreamingBench {
+public:
+    explicit StreamingBench(const BenchOptions& opts) : options(opts) {}
+
+    int run() {
+        if (!write_dummy_tracks(options)) {
+            std::cerr << "Could not write dummy tracks under " << options.audio_root << std::endl;
+            return 1;
+        }
+        raise_fd_limit();
+
+        if (!options.server_binary.empty() && !spawn_server()) {
+            return 1;
+        }
+
+        std::cout << "streaming_bench: " << options.clients << " clients on " << options.threads
+                  << " threads against " << options.url << " for " << options.duration_seconds << " s"
+                  << std::endl;
+
+        const unsigned threads = std::max(1u, std::min(options.threads, options.clients));
+        for (unsigned i = 0; i < threads; ++i) {
+            const unsigned share = options.clients / threads + (i < options.clients % threads ? 1 : 0);
+            workers.emplace_back(new BenchWorker(options, i, share));
+        }
+
+        ProcessSample server_start;
+        const bool sample_server = options.server_pid > 0 &&
+                                   ProcessSample::read(options.server_pid, server_start);
+        const auto started = bench_clock::now();
+        for (auto& worker : workers) {
+            worker->start();
+        }
+
+        uint64_t last_bytes = 0;
+        auto last_report = started;
+        while (bench_clock::now() - started < std::chrono::seconds(options.duration_seconds)) {
+            std::this_thread::sleep_for(std::chrono::seconds(5));
+            const auto now = bench_clock::now();
+            const uint64_t bytes = sum(&WorkerStats::bytes);
+            std::printf("[%5.1fs] connected %llu  failed %llu  dropped %llu  %.2f MB/s\n",
+                        std::chrono::duration<double>(now - started).count(),
+                        static_cast<unsigned long long>(sum(&WorkerStats::connected)),
+                        static_cast<unsigned long long>(sum(&WorkerStats::failed)),
+                        static_cast<unsigned long long>(sum(&WorkerStats::dropped)),
+                        (bytes - last_bytes) / 1e6 / std::chrono::duration<double>(now - last_report).count());
+            std::fflush(stdout);
+            last_bytes = bytes;
+            last_report = now;
+        }
+
+        ProcessSample server_end;
+        const bool have_server = sample_server && ProcessSample::read(options.server_pid, server_end);
+        const double elapsed = std::chrono::duration<double>(bench_clock::now() - started).count();
+        for (auto& worker : workers) {
+            worker->stop();
+        }
+
+        const int status = report(elapsed, have_server ? &server_start : nullptr, &server_end);
+        stop_server();
+        return status;
+    }
+
+private:
+    uint64_t sum(std::atomic<uint64_t> WorkerStats::*field) const {
+        uint64_t total = 0;
+        for (const auto& worker : workers) {
+            total += (worker->get_stats().*field).load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    LatencyHistogram::Snapshot merged(LatencyHistogram WorkerStats::*field) const {
+        LatencyHistogram::Snapshot snapshot;
+        for (const auto& worker : workers) {
+            snapshot.add(worker->get_stats().*field);
+        }
+        return snapshot;
+    }
+
+    static void print_latency(const char* label, const LatencyHistogram::Snapshot& snapshot) {
+        std::printf("%-22s n=%-9llu p50 %8.2f ms  p90 %8.2f ms  p99 %8.2f ms  max %8.2f ms\n", label,
+                    static_cast<unsigned long long>(snapshot.total),
+                    snapshot.value_at_quantile(0.50) / 1e3, snapshot.value_at_quantile(0.90) / 1e3,
+                    snapshot.value_at_quantile(0.99) / 1e3, snapshot.value_at_quantile(1.0) / 1e3);
+    }
+
+    int report(double elapsed, const ProcessSample* server_start, const ProcessSample* server_end) const {
+        const uint64_t connected = sum(&WorkerStats::connected);
+        const uint64_t failed = sum(&WorkerStats::failed);
+        const uint64_t bytes = sum(&WorkerStats::bytes);
+        const auto ttfb = merged(&WorkerStats::ttfb);
+        const auto jitter = merged(&WorkerStats::jitter);
+
+        std::printf("\nconnected %llu  failed %llu  dropped %llu  actions %llu\n",
+                    static_cast<unsigned long long>(connected), static_cast<unsigned long long>(failed),
+                    static_cast<unsigned long long>(sum(&WorkerStats::dropped)),
+                    static_cast<unsigned long long>(sum(&WorkerStats::actions)));
+        print_latency("time to first byte", ttfb);
+        print_latency("seek/resume latency", merged(&WorkerStats::seek_latency));
+        print_latency("pacing jitter", jitter);
+        std::printf("throughput             %.2f MB/s, %.0f messages/s (real-time rate for %llu listeners: %.2f MB/s)\n",
+                    bytes / 1e6 / elapsed, sum(&WorkerStats::messages) / elapsed,
+                    static_cast<unsigned long long>(connected), connected * DUMMY_BYTES_PER_SECOND / 1e6);
+        if (server_start) {
+            const double wall = std::chrono::duration<double>(server_end->taken - server_start->taken).count();
+            std::printf("server                 cpu %.1f%% of one core, rss %.1f MB, peak rss %.1f MB\n",
+                        100.0 * (server_end->cpu_seconds - server_start->cpu_seconds) / wall,
+                        server_end->rss_bytes / 1e6, server_end->peak_rss_bytes / 1e6);
+        }
+
+        int status = 0;
+        if (failed > options.max_failure_ratio * options.clients) {
+            std::printf("FAIL: %llu of %u connections failed\n", static_cast<unsigned long long>(failed),
+                        options.clients);
+            status = 1;
+        }
+        if (options.max_p99_ttfb_ms > 0 && ttfb.value_at_quantile(0.99) / 1e3 > options.max_p99_ttfb_ms) {
+            std::printf("FAIL: p99 time to first byte above %.2f ms\n", options.max_p99_ttfb_ms);
+            status = 1;
+        }
+        if (options.max_p99_jitter_ms > 0 && jitter.value_at_quantile(0.99) / 1e3 > options.max_p99_jitter_ms) {
+            std::printf("FAIL: p99 pacing jitter above %.2f ms\n", options.max_p99_jitter_ms);
+            status = 1;
+        }
+        return status;
+    }
+
+    void raise_fd_limit() const {
+        rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return;
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur < options.clients + 64) {
+            std::cerr << "Warning: open file limit " << limit.rlim_cur << " is below " << options.clients
+                      << " clients; raise it with ulimit -n" << std::endl;
+        }
+    }
+
+    bool spawn_server() {
+        const pid_t pid = fork();
+        if (pid < 0) {
+            std::perror("fork");
+            return false;
+        }
+        if (pid == 0) {
+            setenv("AUDIO_STORAGE_PATH", options.audio_root.c_str(), 1);
+            setenv("METRICS_PORT", "0", 0);
+            execl(options.server_binary.c_str(), options.server_binary.c_str(), static_cast<char*>(nullptr));
+            std::perror("exec streaming_server");
+            _exit(127);
+        }
+
+        options.server_pid = pid;
+        spawned_server = true;
+        // Give it time to map tracks and start listening before the ramp begins
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        int status = 0;
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            std::cerr << "streaming_server exited during startup" << std::endl;
+            spawned_server = false;
+            return false;
+        }
+        return true;
+    }
+
+    void stop_server() {
+        if (!spawned_server) return;
+        kill(options.server_pid, SIGTERM);
+        int status = 0;
+        waitpid(options.server_pid, &status, 0);
+        spawned_server = false;
+    }
+
+    BenchOptions options;
+    std::vector<std::unique_ptr<BenchWorker>> workers;
+    bool spawned_server = false;
+};
+
+static void print_usage() {
+    std::cout << "Usage: streaming_bench [options]\n"
+              << "  --url <ws-url>           server to load (default ws://127.0.0.1:9001)\n"
+              << "  --server <path>          spawn this streaming_server against the dummy tracks\n"
+              << "  --server-pid <pid>       sample CPU/RSS of an already running server\n"
+              << "  --clients <n>            concurrent listeners (default 10000)\n"
+              << "  --threads <n>            client io threads (default: hardware threads)\n"
+              << "  --duration <s>           run time in seconds (default 60)\n"
+              << "  --ramp <n>               connections opened per second (default 2000)\n"
+              << "  --action-interval <s>    mean time between a listener's actions (default 5)\n"
+              << "  --mix <seek,pause,play>  relative action weights (default 40,30,30)\n"
+              << "  --tracks <n>             dummy tracks to generate (default 16)\n"
+              << "  --track-seconds <s>      length of each dummy track (default 300)\n"
+              << "  --audio-root <dir>       where dummy tracks are written (default /tmp/catch_bench_audio)\n"
+              << "  --max-p99-ttfb-ms <ms>   exit non-zero if p99 time to first byte is higher\n"
+              << "  --max-p99-jitter-ms <ms> exit non-zero if p99 pacing jitter is higher\n";
+}
+
+static bool parse_options(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string flag = argv[i];
+        if (flag == "--help" || flag == "-h") return false;
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << flag << std::endl;
+            return false;
+        }
+        const char* value = argv[++i];
+        if (flag == "--url") options.url = value;
+        else if (flag == "--server") options.server_binary = value;
+        else if (flag == "--server-pid") options.server_pid = static_cast<pid_t>(std::atoi(value));
+        else if (flag == "--clients") options.clients = std::max(1, std::atoi(value));
+        else if (flag == "--threads") options.threads = std::max(1, std::atoi(value));
+        else if (flag == "--duration") options.duration_seconds = std::max(1, std::atoi(value));
+        else if (flag == "--ramp") options.ramp_per_second = std::max(1, std::atoi(value));
+        else if (flag == "--action-interval") options.action_interval = std::max(0.1, std::atof(value));
+        else if (flag == "--tracks") options.tracks = std::max(1, std::atoi(value));
+        else if (flag == "--track-seconds") options.track_seconds = std::max(10, std::atoi(value));
+        else if (flag == "--audio-root") options.audio_root = value;
+        else if (flag == "--max-p99-ttfb-ms") options.max_p99_ttfb_ms = std::atof(value);
+        else if (flag == "--max-p99-jitter-ms") options.max_p99_jitter_ms = std::atof(value);
+        else if (flag == "--mix") {
+            if (std::sscanf(value, "%u,%u,%u", &options.mix_seek, &options.mix_pause, &options.mix_play) != 3) {
+                std::cerr << "--mix expects seek,pause,play weights" << std::endl;
+                return false;
+            }
+        } else {
+            std::cerr << "Unknown option: " << flag << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace catch_streaming
+
+int main(int argc, char** argv) {
+    catch_streaming::BenchOptions options;
+    if (!catch_streaming::parse_options(argc, argv, options)) {
+        catch_streaming::print_usage();
+        return 2;
+    }
+
+    try {
+        return catch_streaming::StreamingBench(options).run();
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark error: " << e.what() << std::endl;
+        return 1;
+    }
+}
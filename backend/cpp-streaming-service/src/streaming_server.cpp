@@ -4,99 +4,2647 @@
 #include <memory>
 #include <thread>
 #include <mutex>
-#include <queue>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <shared_mutex>
+#include <new>
+#include <type_traits>
+#include <string_view>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <cmath>
+#include <cstdio>
+#include <cerrno>
+#include <array>
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
 #include <websocketpp/config/asio_no_tls.hpp>
 #include <websocketpp/server.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/beast.hpp>
-#include <fstream>
+
+#include "control_parser.hpp"
+#include "latency_histogram.hpp"
+#include "loudness_meter.hpp"
 
 namespace catch_streaming {
 
-class AudioChunk {
+typedef std::chrono::steady_clock pacing_clock;
+typedef websocketpp::config::asio::message_type frame_message;
+
+static const size_t STREAM_CHUNK_SIZE = 4096; // 4KB chunks
+
+// Adaptive bitrate: renditions below the source bitrate, and the media
+// duration after which a session may switch between them
+static const int32_t RENDITION_KBPS[] = {64, 128};
+static const double SEGMENT_SECONDS = 4.0;
+
+// Loudness normalization: the programme level every measured track is
+// brought to, and the most a quiet track is boosted or a loud one cut
+static const double LOUDNESS_TARGET_LUFS = -14.0;
+static const double LOUDNESS_MAX_BOOST_DB = 12.0;
+static const double LOUDNESS_MAX_CUT_DB = 24.0;
+
+#ifdef CATCH_COUNT_ALLOCATIONS
+// Per-thread heap allocation counter, read by the --bench alloc mode
+thread_local uint64_t heap_allocations = 0;
+#endif
+
+// Process-wide hot-path metrics. Every thread writes only its own shard, so
+// recording is a couple of uncontended relaxed stores; a scrape sums the
+// shards. Shards outlive their threads so totals stay monotonic.
+class ServerMetrics {
+public:
+    enum Counter {
+        BYTES_SENT,
+        CHUNKS_SENT,
+        SEND_ERRORS,
+        CHUNKS_DROPPED,
+        BACKPRESSURE_STALLS,
+        SLOW_CLIENT_DISCONNECTS,
+        QUALITY_DOWNGRADES,
+        RENDITION_SWITCHES,
+        SESSIONS_OPENED,
+        SESSIONS_CLOSED,
+        CONTROL_MESSAGES,
+        MALFORMED_MESSAGES,
+        COUNTER_COUNT
+    };
+    
+    enum Histogram {
+        SEND_LATENCY,  // Time inside websocketpp's send()
+        PACING_JITTER, // How late a chunk was produced relative to its deadline
+        QUEUE_WAIT,    // Control message enqueue to execution
+        HISTOGRAM_COUNT
+    };
+    
+    static void add(Counter counter, uint64_t delta = 1) {
+        auto& cell = local_shard().counters[counter];
+        cell.store(cell.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+    
+    static void record(Histogram histogram, uint64_t micros) {
+        local_shard().histograms[histogram].record(micros);
+    }
+    
+    static void record(Histogram histogram, pacing_clock::duration elapsed) {
+        const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        record(histogram, static_cast<uint64_t>(std::max<int64_t>(0, micros)));
+    }
+    
+    static uint64_t counter_total(Counter counter) {
+        uint64_t total = 0;
+        for_each_shard([&](const Shard& shard) {
+            total += shard.counters[counter].load(std::memory_order_relaxed);
+        });
+        return total;
+    }
+    
+    static LatencyHistogram::Snapshot histogram_snapshot(Histogram histogram) {
+        LatencyHistogram::Snapshot snapshot;
+        for_each_shard([&](const Shard& shard) { snapshot.add(shard.histograms[histogram]); });
+        return snapshot;
+    }
+    
+    static const char* counter_name(Counter counter) {
+        static const char* names[COUNTER_COUNT] = {
+            "catch_stream_bytes_sent_total",
+            "catch_stream_chunks_sent_total",
+            "catch_stream_send_errors_total",
+            "catch_stream_chunks_dropped_total",
+            "catch_backpressure_stalls_total",
+            "catch_slow_client_disconnects_total",
+            "catch_quality_downgrades_total",
+            "catch_rendition_switches_total",
+            "catch_sessions_opened_total",
+            "catch_sessions_closed_total",
+            "catch_control_messages_total",
+            "catch_control_messages_malformed_total"
+        };
+        return names[counter];
+    }
+    
+    static const char* histogram_name(Histogram histogram) {
+        static const char* names[HISTOGRAM_COUNT] = {
+            "catch_send_latency_seconds",
+            "catch_pacing_jitter_seconds",
+            "catch_control_queue_wait_seconds"
+        };
+        return names[histogram];
+    }
+    
+    // Prometheus text exposition of the counters and histograms; gauges
+    // owned by other components are appended by the caller
+    static void write_prometheus(std::string& out) {
+        char line[160];
+        for (int c = 0; c < COUNTER_COUNT; ++c) {
+            const char* name = counter_name(static_cast<Counter>(c));
+            std::snprintf(line, sizeof(line), "# TYPE %s counter\n%s %llu\n", name, name,
+                          static_cast<unsigned long long>(counter_total(static_cast<Counter>(c))));
+            out += line;
+        }
+        
+        for (int h = 0; h < HISTOGRAM_COUNT; ++h) {
+            const char* name = histogram_name(static_cast<Histogram>(h));
+            const auto snapshot = histogram_snapshot(static_cast<Histogram>(h));
+            std::snprintf(line, sizeof(line), "# TYPE %s histogram\n", name);
+            out += line;
+            // Power-of-two edges from 1us to ~33s line up with bucket boundaries
+            for (unsigned k = 0; k <= 25; ++k) {
+                const uint64_t edge = uint64_t(1) << k;
+                std::snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %llu\n", name, edge / 1e6,
+                              static_cast<unsigned long long>(snapshot.count_below(edge)));
+                out += line;
+            }
+            std::snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %g\n%s_count %llu\n",
+                          name, static_cast<unsigned long long>(snapshot.total),
+                          name, snapshot.sum / 1e6,
+                          name, static_cast<unsigned long long>(snapshot.total));
+            out += line;
+        }
+    }
+    
+private:
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, COUNTER_COUNT> counters{};
+        std::array<LatencyHistogram, HISTOGRAM_COUNT> histograms;
+    };
+    
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Shard>> shards;
+    };
+    
+    static Registry& registry() {
+        static Registry* instance = new Registry(); // Never destroyed; threads may outlive main
+        return *instance;
+    }
+    
+    static Shard& local_shard() {
+        thread_local Shard* shard = nullptr;
+        if (!shard) {
+            auto& reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            reg.shards.emplace_back(new Shard());
+            shard = reg.shards.back().get();
+        }
+        return *shard;
+    }
+    
+    template <typename Fn>
+    static void for_each_shard(Fn&& fn) {
+        auto& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (const auto& shard : reg.shards) {
+            fn(*shard);
+        }
+    }
+};
+
+// Log sink for the serving paths. Callers only format a line and append it
+// to a bounded queue; a background thread does the actual (blocking) write.
+// When the writer falls behind, new lines are dropped and counted.
+class AsyncLog {
+public:
+    static void info(std::string line) { instance().push(std::move(line), false); }
+    static void error(std::string line) { instance().push(std::move(line), true); }
+    
+    // Writes out anything queued; call before exiting
+    static void flush() { instance().drain(); }
+    
+    static uint64_t dropped_lines() { return instance().dropped.load(std::memory_order_relaxed); }
+    
+private:
+    static const size_t MAX_QUEUED_LINES = 8192;
+    
+    struct Line {
+        std::string text;
+        bool is_error;
+    };
+    
+    static AsyncLog& instance() {
+        static AsyncLog* log = new AsyncLog(); // Never destroyed; see ServerMetrics::registry
+        return *log;
+    }
+    
+    AsyncLog() : writer([this] { run(); }) {
+        writer.detach();
+    }
+    
+    void push(std::string text, bool is_error) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (pending.size() >= MAX_QUEUED_LINES) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            pending.push_back(Line{std::move(text), is_error});
+        }
+        wake.notify_one();
+    }
+    
+    void run() {
+        std::vector<Line> batch;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                wake.wait(lock, [this] { return !pending.empty(); });
+                batch.swap(pending);
+            }
+            write(batch);
+        }
+    }
+    
+    void drain() {
+        std::vector<Line> batch;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            batch.swap(pending);
+        }
+        write(batch);
+    }
+    
+    void write(std::vector<Line>& batch) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        for (const auto& line : batch) {
+            (line.is_error ? std::cerr : std::cout) << line.text << '\n';
+        }
+        std::cout.flush();
+        batch.clear();
+    }
+    
+    std::mutex queue_mutex;
+    std::mutex write_mutex;
+    std::condition_variable wake;
+    std::vector<Line> pending;
+    std::atomic<uint64_t> dropped{0};
+    std::thread writer;
+};
+
+// Minimal MPEG audio frame header decoder, used to pace streams at the
+// track's real bitrate instead of a fixed interval.
+struct Mp3FrameHeader {
+    uint32_t bitrate_kbps = 0;
+    uint32_t sample_rate = 0;
+    uint32_t samples_per_frame = 0;
+    uint32_t frame_length = 0;
+
+    static uint32_t bitrate_kbps_for(bool mpeg1, uint32_t layer_index, uint32_t bitrate_index) {
+        static const uint16_t bitrates[2][3][16] = {
+            { // MPEG-1: layer I, II, III
+                {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0},
+                {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0},
+                {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0}
+            },
+            { // MPEG-2 / 2.5: layer I, II, III
+                {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0},
+                {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},
+                {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0}
+            }
+        };
+        return bitrates[mpeg1 ? 0 : 1][layer_index][bitrate_index];
+    }
+
+    static bool parse(const uint8_t* p, size_t avail, Mp3FrameHeader& out) {
+        static const uint32_t sample_rates[3] = {44100, 48000, 32000};
+
+        if (avail < 4 || p[0] != 0xFF || (p[1] & 0xE0) != 0xE0) return false;
+
+        const uint32_t version = (p[1] >> 3) & 3;   // 0: 2.5, 2: 2, 3: 1
+        const uint32_t layer = (p[1] >> 1) & 3;     // 1: III, 2: II, 3: I
+        const uint32_t bitrate_index = (p[2] >> 4) & 15;
+        const uint32_t rate_index = (p[2] >> 2) & 3;
+        const uint32_t padding = (p[2] >> 1) & 1;
+        if (version == 1 || layer == 0 || bitrate_index == 0 ||
+            bitrate_index == 15 || rate_index == 3) {
+            return false;
+        }
+
+        const bool mpeg1 = version == 3;
+        const uint32_t layer_index = 3 - layer; // 0: I, 1: II, 2: III
+        out.bitrate_kbps = bitrate_kbps_for(mpeg1, layer_index, bitrate_index);
+        out.sample_rate = sample_rates[rate_index] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+
+        if (layer_index == 0) {
+            out.samples_per_frame = 384;
+            out.frame_length = (12000 * out.bitrate_kbps / out.sample_rate + padding) * 4;
+        } else {
+            out.samples_per_frame = (layer_index == 2 && !mpeg1) ? 576 : 1152;
+            out.frame_length = (out.samples_per_frame / 8) * 1000 * out.bitrate_kbps /
+                               out.sample_rate + padding;
+        }
+        return out.frame_length >= 4;
+    }
+
+    // Points the (already valid) header at `kbps` without padding. False if
+    // the header's version and layer have no such bitrate.
+    static bool rewrite_bitrate(uint8_t* p, uint32_t kbps) {
+        const bool mpeg1 = ((p[1] >> 3) & 3) == 3;
+        const uint32_t layer_index = 3 - ((p[1] >> 1) & 3);
+        for (uint32_t index = 1; index < 15; ++index) {
+            if (bitrate_kbps_for(mpeg1, layer_index, index) == kbps) {
+                p[2] = static_cast<uint8_t>((index << 4) | (p[2] & 0x0D));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Size of a leading ID3v2 tag, if any
+    static size_t skip_id3v2(const uint8_t* p, size_t avail) {
+        if (avail < 10 || p[0] != 'I' || p[1] != 'D' || p[2] != '3') return 0;
+        size_t size = (size_t(p[6] & 0x7F) << 21) | (size_t(p[7] & 0x7F) << 14) |
+                      (size_t(p[8] & 0x7F) << 7) | size_t(p[9] & 0x7F);
+        size += (p[5] & 0x10) ? 20 : 10; // footer present
+        return std::min(size, avail);
+    }
+};
+
+// Byte offset <-> media time map over a track's MPEG frames. Built once per
+// track by scanning frame headers and cached in a sidecar file next to it,
+// so seeks are a binary search that lands on a frame boundary.
+class FrameIndex {
 public:
-    std::vector<uint8_t> data;
-    size_t size;
-    std::chrono::milliseconds timestamp;
+    bool empty() const { return offsets.empty(); }
+    size_t frame_count() const { return offsets.size(); }
+    double duration_seconds() const { return total_ms / 1000.0; }
+    
+    // Media time of a byte offset, interpolated within its frame
+    double time_at_offset(size_t offset) const {
+        auto it = std::upper_bound(offsets.begin(), offsets.end(), offset);
+        if (it == offsets.begin()) return 0.0; // Leading tag
+        const size_t i = (it - offsets.begin()) - 1;
+        const uint32_t next_offset = i + 1 < offsets.size() ? offsets[i + 1] : end_offset;
+        const uint32_t next_ms = i + 1 < offsets.size() ? start_ms[i + 1] : total_ms;
+        const double within = next_offset > offsets[i]
+            ? double(std::min<size_t>(offset, next_offset) - offsets[i]) / (next_offset - offsets[i])
+            : 0.0;
+        return (start_ms[i] + within * (next_ms - start_ms[i])) / 1000.0;
+    }
+    
+    // First frame boundary at or after `offset` (end of audio if none)
+    size_t frame_offset_at_or_after(size_t offset) const {
+        auto it = std::lower_bound(offsets.begin(), offsets.end(), offset);
+        return it != offsets.end() ? *it : end_offset;
+    }
+    
+    // Start of the frame that is playing at `seconds`
+    size_t frame_offset_for_time(double seconds) const {
+        if (offsets.empty()) return 0;
+        const double ms = std::max(seconds, 0.0) * 1000.0;
+        auto it = std::upper_bound(start_ms.begin(), start_ms.end(), ms,
+                                   [](double value, uint32_t start) { return value < start; });
+        const size_t i = it == start_ms.begin() ? 0 : (it - start_ms.begin()) - 1;
+        return offsets[i];
+    }
+    
+    static std::shared_ptr<const FrameIndex> load_or_build(const uint8_t* data, size_t size,
+                                                            int64_t mtime, const std::string& sidecar_path) {
+        auto index = std::make_shared<FrameIndex>();
+        if (index->load(sidecar_path, size, mtime)) {
+            return index;
+        }
+        index->build(data, size);
+        index->save(sidecar_path, size, mtime); // Best effort; the index still works from memory
+        return index;
+    }
+    
+private:
+    struct SidecarHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t track_size;
+        int64_t track_mtime;
+        uint32_t frame_count;
+        uint32_t end_offset;
+        uint32_t total_ms;
+        uint32_t reserved;
+    };
+    static const uint32_t SIDECAR_VERSION = 1;
+    
+    void build(const uint8_t* data, size_t size) {
+        size_t pos = Mp3FrameHeader::skip_id3v2(data, size);
+        double elapsed_ms = 0.0;
+        Mp3FrameHeader header;
+        Mp3FrameHeader next;
+        while (pos + 4 <= size && size <= UINT32_MAX) {
+            // Require the following header to line up too, so stray sync
+            // bytes inside tags or payload are not taken for frames
+            if (Mp3FrameHeader::parse(data + pos, size - pos, header) &&
+                pos + header.frame_length <= size &&
+                (pos + header.frame_length + 4 > size ||
+                 Mp3FrameHeader::parse(data + pos + header.frame_length,
+                                       size - pos - header.frame_length, next))) {
+                offsets.push_back(static_cast<uint32_t>(pos));
+                start_ms.push_back(static_cast<uint32_t>(elapsed_ms));
+                elapsed_ms += header.samples_per_frame * 1000.0 / header.sample_rate;
+                pos += header.frame_length;
+                end_offset = static_cast<uint32_t>(pos);
+            } else {
+                ++pos;
+            }
+        }
+        total_ms = static_cast<uint32_t>(elapsed_ms);
+    }
+    
+    bool load(const std::string& path, size_t track_size, int64_t mtime) {
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return false;
+        
+        SidecarHeader header;
+        bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+                  std::memcmp(header.magic, "CIDX", 4) == 0 &&
+                  header.version == SIDECAR_VERSION &&
+                  header.track_size == track_size && header.track_mtime == mtime;
+        if (ok) {
+            offsets.resize(header.frame_count);
+            start_ms.resize(header.frame_count);
+            ok = std::fread(offsets.data(), sizeof(uint32_t), header.frame_count, file) == header.frame_count &&
+                 std::fread(start_ms.data(), sizeof(uint32_t), header.frame_count, file) == header.frame_count;
+            end_offset = header.end_offset;
+            total_ms = header.total_ms;
+        }
+        std::fclose(file);
+        
+        if (!ok) {
+            offsets.clear();
+            start_ms.clear();
+        }
+        return ok;
+    }
+    
+    void save(const std::string& path, size_t track_size, int64_t mtime) const {
+        const std::string temp_path = path + ".tmp";
+        std::FILE* file = std::fopen(temp_path.c_str(), "wb");
+        if (!file) return;
+        
+        SidecarHeader header{{'C', 'I', 'D', 'X'}, SIDECAR_VERSION, track_size, mtime,
+                             static_cast<uint32_t>(offsets.size()), end_offset, total_ms, 0};
+        const bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                        std::fwrite(offsets.data(), sizeof(uint32_t), offsets.size(), file) == offsets.size() &&
+                        std::fwrite(start_ms.data(), sizeof(uint32_t), start_ms.size(), file) == start_ms.size();
+        if (std::fclose(file) == 0 && ok) {
+            std::rename(temp_path.c_str(), path.c_str());
+        } else {
+            std::remove(temp_path.c_str());
+        }
+    }
+    
+    std::vector<uint32_t> offsets;   // Frame start offsets, ascending
+    std::vector<uint32_t> start_ms;  // Media time at each frame start
+    uint32_t end_offset = 0;         // One past the last frame
+    uint32_t total_ms = 0;
+};
+
+// Measured loudness of a track, kept in an <id>.loud sidecar next to it by
+// streaming_server --analyze-loudness. Like the frame index, the sidecar is
+// tied to the source file's size and mtime, so a replaced file reads as
+// unmeasured until it is analyzed again.
+struct TrackLoudness {
+    bool measured = false;
+    float integrated_lufs = 0.0f;   // LoudnessMeter::FLOOR_DB for silence
+    float true_peak_db = 0.0f;      // dBTP, also floored
+    
+    // Gain that brings the track to LOUDNESS_TARGET_LUFS (0 if unmeasured)
+    double gain_db() const {
+        if (!measured) return 0.0;
+        return std::clamp(LOUDNESS_TARGET_LUFS - integrated_lufs, -LOUDNESS_MAX_CUT_DB, LOUDNESS_MAX_BOOST_DB);
+    }
+    
+    static TrackLoudness load(const std::string& path, size_t track_size, int64_t mtime) {
+        TrackLoudness loudness;
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return loudness;
+        
+        Sidecar sidecar;
+        loudness.measured = std::fread(&sidecar, sizeof(sidecar), 1, file) == 1 &&
+                            std::memcmp(sidecar.magic, "CLUF", 4) == 0 &&
+                            sidecar.version == SIDECAR_VERSION &&
+                            sidecar.track_size == track_size && sidecar.track_mtime == mtime;
+        std::fclose(file);
+        if (loudness.measured) {
+            loudness.integrated_lufs = sidecar.integrated_lufs;
+            loudness.true_peak_db = sidecar.true_peak_db;
+        }
+        return loudness;
+    }
+    
+    bool save(const std::string& path, size_t track_size, int64_t mtime) const {
+        const std::string temp_path = path + ".tmp";
+        std::FILE* file = std::fopen(temp_path.c_str(), "wb");
+        if (!file) return false;
+        
+        const Sidecar sidecar{{'C', 'L', 'U', 'F'}, SIDECAR_VERSION, track_size, mtime,
+                              integrated_lufs, true_peak_db};
+        const bool ok = std::fwrite(&sidecar, sizeof(sidecar), 1, file) == 1;
+        if (std::fclose(file) == 0 && ok && std::rename(temp_path.c_str(), path.c_str()) == 0) {
+            return true;
+        }
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    
+private:
+    struct Sidecar {
+        char magic[4];
+        uint32_t version;
+        uint64_t track_size;
+        int64_t track_mtime;
+        float integrated_lufs;
+        float true_peak_db;
+    };
+    static const uint32_t SIDECAR_VERSION = 1;
+};
+
+// The source a rendition was rendered from, kept in a <kbps>.src sidecar
+// next to it. A rendition is only current while its source still has the
+// recorded size and mtime. Stand-in renditions are marked as such so they
+// are not served unless stand-ins were asked for.
+struct RenditionSource {
+    bool known = false;
+    bool stand_in = false;
+    uint64_t source_size = 0;
+    int64_t source_mtime = 0;
+    
+    bool matches(size_t size, int64_t mtime) const {
+        return known && source_size == size && source_mtime == mtime;
+    }
+    
+    static RenditionSource load(const std::string& path) {
+        RenditionSource source;
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return source;
+        
+        Sidecar sidecar;
+        source.known = std::fread(&sidecar, sizeof(sidecar), 1, file) == 1 &&
+                       std::memcmp(sidecar.magic, "CREN", 4) == 0 &&
+                       sidecar.version == SIDECAR_VERSION;
+        std::fclose(file);
+        if (source.known) {
+            source.stand_in = sidecar.stand_in != 0;
+            source.source_size = sidecar.source_size;
+            source.source_mtime = sidecar.source_mtime;
+        }
+        return source;
+    }
+    
+    bool save(const std::string& path) const {
+        const std::string temp_path = path + ".tmp";
+        std::FILE* file = std::fopen(temp_path.c_str(), "wb");
+        if (!file) return false;
+        
+        const Sidecar sidecar{{'C', 'R', 'E', 'N'}, SIDECAR_VERSION, source_size, source_mtime,
+                              stand_in ? 1u : 0u, 0};
+        const bool ok = std::fwrite(&sidecar, sizeof(sidecar), 1, file) == 1;
+        if (std::fclose(file) == 0 && ok && std::rename(temp_path.c_str(), path.c_str()) == 0) {
+            return true;
+        }
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    
+private:
+    struct Sidecar {
+        char magic[4];
+        uint32_t version;
+        uint64_t source_size;
+        int64_t source_mtime;
+        uint32_t stand_in;
+        uint32_t reserved;
+    };
+    static const uint32_t SIDECAR_VERSION = 1;
+};
+
+// Read-only mapping of one track file. The mapping stays valid for as long
+// as any session (or the cache) holds a reference.
+class MappedTrack {
+private:
     std::string track_id;
+    const uint8_t* mapped = nullptr;
+    size_t mapped_size = 0;
+    int64_t mapped_mtime = 0;
+    
+    // Ready-to-write websocket frames, one per STREAM_CHUNK_SIZE slice, built
+    // on first use and shared by every listener. Server frames are unmasked,
+    // so the same bytes are valid on every connection. Each frame owns a heap
+    // copy of its slice, so once every chunk has been sent the track holds
+    // the whole file twice: mapped, and in these frames.
+    mutable std::vector<frame_message::ptr> prepared_frames;
+    static const size_t PREPARED_FRAME_OVERHEAD = 192; // Message object, header, control block
+    
+    std::shared_ptr<const FrameIndex> index;
+    TrackLoudness loudness_info;
+    RenditionSource source_info; // Renditions only
+    
+    MappedTrack(const std::string& id, const uint8_t* addr, size_t size, int64_t mtime)
+        : track_id(id), mapped(addr), mapped_size(size), mapped_mtime(mtime),
+          prepared_frames((size + STREAM_CHUNK_SIZE - 1) / STREAM_CHUNK_SIZE) {}
+    
+public:
+    MappedTrack(const MappedTrack&) = delete;
+    MappedTrack& operator=(const MappedTrack&) = delete;
+    
+    ~MappedTrack() {
+        if (mapped) {
+            munmap(const_cast<uint8_t*>(mapped), mapped_size);
+        }
+    }
+    
+    // Maps the file and loads (or builds and saves) its frame index sidecar,
+    // plus its loudness or rendition source sidecar when a path is given
+    static std::shared_ptr<const MappedTrack> open(const std::string& id, const std::string& path,
+                                                   const std::string& index_path,
+                                                   const std::string& loudness_path = "",
+                                                   const std::string& source_path = "") {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return nullptr;
+        }
+        
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return nullptr;
+        }
+        
+        const size_t size = static_cast<size_t>(st.st_size);
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd); // The mapping keeps the file alive
+        if (addr == MAP_FAILED) {
+            return nullptr;
+        }
+        std::shared_ptr<MappedTrack> track(new MappedTrack(id, static_cast<const uint8_t*>(addr), size,
+                                                            st.st_mtime));
+        track->index = FrameIndex::load_or_build(track->data(), size, st.st_mtime, index_path);
+        if (!loudness_path.empty()) {
+            track->loudness_info = TrackLoudness::load(loudness_path, size, st.st_mtime);
+        }
+        if (!source_path.empty()) {
+            track->source_info = RenditionSource::load(source_path);
+        }
+        madvise(addr, size, MADV_SEQUENTIAL); // The index scan may have reset readahead hints
+        return track;
+    }
+    
+    const uint8_t* data() const { return mapped; }
+    size_t size() const { return mapped_size; }
+    int64_t mtime() const { return mapped_mtime; }
+    const std::string& get_track_id() const { return track_id; }
+    const FrameIndex& frame_index() const { return *index; }
+    
+    // Most memory the track can pin: the mapping plus every prepared frame
+    size_t memory_cost() const {
+        return mapped_size * 2 + prepared_frames.size() * PREPARED_FRAME_OVERHEAD;
+    }
+    const TrackLoudness& loudness() const { return loudness_info; }
+    const RenditionSource& rendered_from() const { return source_info; }
+    
+    // Bitrate of the first valid frame header, or 0 if none is found
+    uint32_t nominal_kbps() const {
+        size_t pos = Mp3FrameHeader::skip_id3v2(mapped, mapped_size);
+        const size_t scan_end = std::min(mapped_size, pos + 8192);
+        Mp3FrameHeader header;
+        for (; pos + 4 <= scan_end; ++pos) {
+            if (Mp3FrameHeader::parse(mapped + pos, mapped_size - pos, header)) {
+                return header.bitrate_kbps;
+            }
+        }
+        return 0;
+    }
+    
+    // Shared frame for the slice, or null if it is not a whole grid chunk
+    frame_message::ptr prepared_frame(size_t offset, size_t length) const {
+        if (offset % STREAM_CHUNK_SIZE != 0 || offset >= mapped_size ||
+            length != std::min(STREAM_CHUNK_SIZE, mapped_size - offset)) {
+            return nullptr;
+        }
+        
+        auto& slot = prepared_frames[offset / STREAM_CHUNK_SIZE];
+        auto frame = std::atomic_load(&slot);
+        if (frame) {
+            return frame;
+        }
+        
+        frame = std::make_shared<frame_message>(frame_message::con_msg_man_ptr(),
+                                                websocketpp::frame::opcode::binary, length);
+        frame->set_header(websocketpp::frame::prepare_header(
+            websocketpp::frame::basic_header(websocketpp::frame::opcode::binary, length, true, false),
+            websocketpp::frame::extended_header(length)));
+        frame->set_payload(mapped + offset, length);
+        frame->set_prepared(true);
+        
+        // Racing builders produce identical frames; keep whichever landed first
+        frame_message::ptr expected;
+        if (!std::atomic_compare_exchange_strong(&slot, &expected, frame)) {
+            return expected;
+        }
+        return frame;
+    }
+};
+
+// One bitrate rendition of a track
+struct Rendition {
+    int32_t kbps;
+    std::shared_ptr<const MappedTrack> track;
+};
+typedef std::vector<Rendition> RenditionLadder; // Lowest bitrate first
+
+// Shared, refcounted track cache. Each file is mapped once and handed to
+// every listener; the LRU tail is dropped once the byte budget is exceeded
+// (sessions still playing an evicted track keep their mapping alive). A
+// track is charged its memory_cost(), so the budget covers the prepared
+// frames it builds as well as the mapping.
+class TrackCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t bytes_mapped;  // Total bytes ever mapped
+        size_t cached_tracks;
+        size_t cached_bytes;    // Charged at memory_cost(), prepared frames included
+    };
+    
+    TrackCache(const std::string& root, size_t budget)
+        : tracks_dir(root + "/tracks/"), renditions_dir(root + "/renditions/"), budget_bytes(budget) {}
+    
+    std::shared_ptr<const MappedTrack> acquire(const std::string& track_id) {
+        if (!is_valid_track_id(track_id)) {
+            return nullptr;
+        }
+        return acquire_file(track_id, track_id, tracks_dir + track_id, FileKind::source);
+    }
+    
+    // A pre-rendered lower bitrate copy, <root>/renditions/<id>/<kbps>.mp3
+    std::shared_ptr<const MappedTrack> acquire_rendition(const std::string& track_id, int32_t kbps) {
+        if (!is_valid_track_id(track_id)) {
+            return nullptr;
+        }
+        return acquire_file(rendition_key(track_id, kbps), track_id,
+                            renditions_dir + track_id + "/" + std::to_string(kbps), FileKind::rendition);
+    }
+    
+    // Every current rendition of `source` on disk, lowest bitrate first and
+    // ending with the source itself. Empty when there is nothing to switch
+    // to. `missing` is set when a rung is absent, stale or an unwanted
+    // stand-in, i.e. when building renditions would add to the ladder.
+    RenditionLadder acquire_ladder(const std::string& track_id,
+                                   const std::shared_ptr<const MappedTrack>& source,
+                                   bool allow_stand_in, bool& missing) {
+        RenditionLadder ladder;
+        missing = false;
+        const int32_t source_kbps = static_cast<int32_t>(source->nominal_kbps());
+        if (source->frame_index().empty()) {
+            return ladder; // Segment boundaries need the frame index
+        }
+        for (int32_t kbps : RENDITION_KBPS) {
+            if (kbps >= source_kbps) break;
+            auto rendition = acquire_rendition(track_id, kbps);
+            if (rendition && !rendition->rendered_from().matches(source->size(), source->mtime())) {
+                // Rendered from an older copy of the source; remap once rebuilt
+                forget(rendition_key(track_id, kbps));
+                rendition = nullptr;
+            }
+            if (rendition && rendition->rendered_from().stand_in && !allow_stand_in) {
+                rendition = nullptr;
+            }
+            if (rendition && !rendition->frame_index().empty()) {
+                ladder.push_back(Rendition{kbps, std::move(rendition)});
+            } else {
+                missing = true;
+            }
+        }
+        if (!ladder.empty()) {
+            ladder.push_back(Rendition{source_kbps, source});
+        }
+        return ladder;
+    }
+    
+    Stats get_stats() const {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        return Stats{hits, misses, evictions, bytes_mapped, entries.size(), cached_bytes};
+    }
+    
+private:
+    struct Entry {
+        std::shared_ptr<const MappedTrack> track;
+        std::list<std::string>::iterator lru_position;
+    };
+    
+    enum class FileKind { source, rendition };
+    
+    static std::string rendition_key(const std::string& track_id, int32_t kbps) {
+        return track_id + "@" + std::to_string(kbps);
+    }
+    
+    // `base` is the file path without the .mp3/.idx extension. Renditions
+    // share the source's loudness, so only sources read a .loud sidecar and
+    // only renditions read a .src one.
+    std::shared_ptr<const MappedTrack> acquire_file(const std::string& key, const std::string& track_id,
+                                                    const std::string& base, FileKind kind) {
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            auto it = entries.find(key);
+            if (it != entries.end()) {
+                lru.splice(lru.begin(), lru, it->second.lru_position);
+                hits++;
+                return it->second.track;
+            }
+        }
+        
+        // Map outside the lock so a cold track never stalls hot ones
+        const bool is_source = kind == FileKind::source;
+        auto track = MappedTrack::open(track_id, base + ".mp3", base + ".idx",
+                                       is_source ? base + ".loud" : "", is_source ? "" : base + ".src");
+        
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        misses++;
+        if (!track) {
+            return nullptr;
+        }
+        
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            // Lost a race with another loader; share theirs
+            return it->second.track;
+        }
+        
+        lru.push_front(key);
+        entries.emplace(key, Entry{track, lru.begin()});
+        cached_bytes += track->memory_cost();
+        bytes_mapped += track->size();
+        evict_locked();
+        return track;
+    }
+    
+    // Drops a cached entry so the next acquire maps the file afresh
+    void forget(const std::string& key) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            cached_bytes -= it->second.track->memory_cost();
+            lru.erase(it->second.lru_position);
+            entries.erase(it);
+        }
+    }
+    
+    void evict_locked() {
+        // Always keep the most recently used track, even if it alone is over budget
+        while (cached_bytes > budget_bytes && entries.size() > 1) {
+            auto it = entries.find(lru.back());
+            cached_bytes -= it->second.track->memory_cost();
+            entries.erase(it);
+            lru.pop_back();
+            evictions++;
+        }
+    }
+    
+public:
+    static bool is_valid_track_id(const std::string& id) {
+        // Track ids become file names; keep them to a safe character set
+        if (id.empty() || id.size() > 128) return false;
+        for (char c : id) {
+            if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-') {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+private:
+    const std::string tracks_dir;
+    const std::string renditions_dir;
+    const size_t budget_bytes;
+    mutable std::mutex cache_mutex;
+    std::list<std::string> lru;
+    std::unordered_map<std::string, Entry> entries;
+    size_t cached_bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t bytes_mapped = 0;
+};
+
+// Splits a configured command line into argv words and fills in its {name}
+// placeholders. Words split on whitespace, and '...' or "..." group one.
+// The result is run without a shell and substituted values are never
+// rescanned, so a path reaches the program verbatim whatever it contains.
+static std::vector<std::string> expand_command(const std::string& command,
+                                               std::initializer_list<std::pair<const char*, std::string>> fields) {
+    std::vector<std::string> words;
+    std::string word;
+    bool in_word = false;
+    char quote = 0;
+    for (size_t pos = 0; pos < command.size(); ++pos) {
+        const char c = command[pos];
+        if (c == '{') {
+            auto field = std::find_if(fields.begin(), fields.end(), [&](const auto& f) {
+                return command.compare(pos, std::strlen(f.first), f.first) == 0;
+            });
+            if (field != fields.end()) {
+                word += field->second;
+                in_word = true;
+                pos += std::strlen(field->first) - 1;
+                continue;
+            }
+        }
+        if (quote) {
+            if (c == quote) quote = 0;
+            else word += c;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            in_word = true;
+        } else if (std::isspace(static_cast<unsigned char>(c))) {
+            if (in_word) words.push_back(std::move(word));
+            word.clear();
+            in_word = false;
+        } else {
+            word += c;
+            in_word = true;
+        }
+    }
+    if (in_word) {
+        words.push_back(std::move(word));
+    }
+    return words;
+}
+
+// Starts words[0] from PATH, with its stdout on `stdout_fd` unless that is
+// -1. Returns the child's pid, or -1.
+static pid_t spawn_command(const std::vector<std::string>& words, int stdout_fd = -1) {
+    if (words.empty()) {
+        return -1;
+    }
+    std::vector<char*> argv;
+    for (const auto& word : words) {
+        argv.push_back(const_cast<char*>(word.c_str()));
+    }
+    argv.push_back(nullptr);
+    
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (stdout_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+    }
+    pid_t pid = -1;
+    const int error = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    return error == 0 ? pid : -1;
+}
+
+// True if the child exited with status 0
+static bool wait_command(pid_t pid) {
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Renders the RENDITION_KBPS copies of tracks, either on demand from a
+// background thread or offline (streaming_server --build-renditions).
+//
+// RENDITION_ENCODER names the encoder command, run without a shell (see
+// expand_command), with {input}, {output} and {kbps} placeholders, e.g.
+//   ffmpeg -v error -y -i {input} -codec:a libmp3lame -b:a {kbps}k {output}
+// For benchmarks and tests, RENDITION_STAND_IN=1 allows a stand-in when no
+// encoder is set: it re-frames the source at the target bitrate, every frame
+// keeping its header fields and duration with its payload truncated or
+// zero-padded. That gives real MP3 framing and timing, so pacing, seeking and
+// segment switching behave exactly as with encoded renditions, but not
+// decodable audio, so stand-ins are only built and served when opted into.
+// With neither, nothing is built and listeners get the source bitrate.
+class RenditionBuilder {
+public:
+    explicit RenditionBuilder(const std::string& root)
+        : tracks_dir(root + "/tracks/"), renditions_dir(root + "/renditions/") {}
+    
+    ~RenditionBuilder() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    
+    void start() {
+        worker = std::thread([this] { run(); });
+    }
+    
+    // Queues a build unless one is already pending for the track
+    void enqueue(const std::string& track_id) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (!queued.insert(track_id).second) {
+                return;
+            }
+            pending.push_back(track_id);
+        }
+        wake.notify_one();
+    }
+    
+    // True when build() has something to render with
+    static bool can_render() {
+        return !encoder_command().empty() || stand_in_enabled();
+    }
+    
+    static bool stand_in_enabled() {
+        const char* value = std::getenv("RENDITION_STAND_IN");
+        return value && std::strcmp(value, "1") == 0;
+    }
+    
+    // Renders whichever renditions are missing or stale. Returns false on
+    // failure, or when can_render() is false.
+    bool build(const std::string& track_id) {
+        if (!TrackCache::is_valid_track_id(track_id) || !can_render()) {
+            return false;
+        }
+        const bool stand_in = encoder_command().empty();
+        const std::string source_path = tracks_dir + track_id + ".mp3";
+        auto source = MappedTrack::open(track_id, source_path, tracks_dir + track_id + ".idx");
+        if (!source) {
+            return false;
+        }
+        
+        const std::string output_dir = renditions_dir + track_id + "/";
+        mkdir(renditions_dir.c_str(), 0755);
+        mkdir(output_dir.c_str(), 0755);
+        
+        bool ok = true;
+        for (int32_t kbps : RENDITION_KBPS) {
+            if (static_cast<uint32_t>(kbps) >= source->nominal_kbps()) break;
+            const std::string output = output_dir + std::to_string(kbps) + ".mp3";
+            const std::string source_info_path = output_dir + std::to_string(kbps) + ".src";
+            const RenditionSource built = RenditionSource::load(source_info_path);
+            struct stat st;
+            if (stat(output.c_str(), &st) == 0 && built.matches(source->size(), source->mtime()) &&
+                (!built.stand_in || stand_in)) {
+                continue; // Current, and no stand-in left to replace with an encode
+            }
+            
+            // Render to a temporary name so readers never map a partial file.
+            // The old .src goes before the rename, so the new file reads as
+            // stale rather than current until its own .src is written.
+            const std::string partial = output + ".partial";
+            const bool rendered = stand_in
+                ? reframe(*source, kbps, partial)
+                : run_encoder(source_path, kbps, partial);
+            std::remove(source_info_path.c_str());
+            if (!rendered || std::rename(partial.c_str(), output.c_str()) != 0) {
+                std::remove(partial.c_str());
+                ok = false;
+                continue;
+            }
+            
+            RenditionSource rendered_from;
+            rendered_from.known = true;
+            rendered_from.stand_in = stand_in;
+            rendered_from.source_size = source->size();
+            rendered_from.source_mtime = source->mtime();
+            ok = rendered_from.save(source_info_path) && ok;
+        }
+        return ok;
+    }
+    
+private:
+    void run() {
+        for (;;) {
+            std::string track_id;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                wake.wait(lock, [this] { return stopping || !pending.empty(); });
+                if (stopping) return;
+                track_id = std::move(pending.front());
+                pending.pop_front();
+            }
+            
+            if (!build(track_id)) {
+                AsyncLog::error("Rendition build failed for " + track_id);
+            }
+            
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            queued.erase(track_id);
+        }
+    }
+    
+    static std::string encoder_command() {
+        const char* command = std::getenv("RENDITION_ENCODER");
+        return command ? command : "";
+    }
+    
+    static bool run_encoder(const std::string& input, int32_t kbps, const std::string& output) {
+        const pid_t pid = spawn_command(expand_command(encoder_command(), {
+            {"{input}", input}, {"{output}", output}, {"{kbps}", std::to_string(kbps)}
+        }));
+        return pid >= 0 && wait_command(pid);
+    }
+    
+    static bool reframe(const MappedTrack& source, int32_t kbps, const std::string& output) {
+        std::FILE* file = std::fopen(output.c_str(), "wb");
+        if (!file) return false;
+        
+        std::vector<uint8_t> frame;
+        bool ok = true;
+        size_t pos = Mp3FrameHeader::skip_id3v2(source.data(), source.size());
+        Mp3FrameHeader header;
+        while (ok && pos + 4 <= source.size()) {
+            if (!Mp3FrameHeader::parse(source.data() + pos, source.size() - pos, header) ||
+                pos + header.frame_length > source.size()) {
+                ++pos; // Resync
+                continue;
+            }
+            
+            uint8_t rewritten[4] = {source.data()[pos], source.data()[pos + 1],
+                                    source.data()[pos + 2], source.data()[pos + 3]};
+            Mp3FrameHeader target;
+            if (!Mp3FrameHeader::rewrite_bitrate(rewritten, kbps) ||
+                !Mp3FrameHeader::parse(rewritten, 4, target)) {
+                ok = false;
+                break;
+            }
+            frame.assign(target.frame_length, 0);
+            std::memcpy(frame.data(), rewritten, 4);
+            std::memcpy(frame.data() + 4, source.data() + pos + 4,
+                        std::min(header.frame_length, target.frame_length) - 4);
+            ok = std::fwrite(frame.data(), 1, frame.size(), file) == frame.size();
+            pos += header.frame_length;
+        }
+        return std::fclose(file) == 0 && ok;
+    }
+    
+    const std::string tracks_dir;
+    const std::string renditions_dir;
+    std::mutex queue_mutex;
+    std::condition_variable wake;
+    std::deque<std::string> pending;
+    std::unordered_set<std::string> queued;
+    bool stopping = false;
+    std::thread worker;
+};
+
+// Measures tracks for loudness normalization (streaming_server
+// --analyze-loudness) and writes their .loud sidecars. Sources are decoded
+// by LOUDNESS_DECODER, a command with an {input} placeholder that writes
+// interleaved 32-bit float stereo at 48 kHz to stdout; by default ffmpeg.
+class LoudnessAnalyzer {
+public:
+    static constexpr size_t CHANNELS = 2;
+    static constexpr double SAMPLE_RATE = 48000.0;
+    
+    explicit LoudnessAnalyzer(const std::string& root) : tracks_dir(root + "/tracks/") {}
+    
+    // The track's loudness, measured now unless its sidecar is still
+    // current. Unmeasured on failure. Safe to call from several threads.
+    TrackLoudness analyze(const std::string& track_id) const {
+        TrackLoudness loudness;
+        if (!TrackCache::is_valid_track_id(track_id)) {
+            return loudness;
+        }
+        const std::string source_path = tracks_dir + track_id + ".mp3";
+        const std::string sidecar_path = tracks_dir + track_id + ".loud";
+        struct stat st;
+        if (stat(source_path.c_str(), &st) != 0) {
+            return loudness;
+        }
+        const size_t size = static_cast<size_t>(st.st_size);
+        loudness = TrackLoudness::load(sidecar_path, size, st.st_mtime);
+        if (loudness.measured) {
+            return loudness;
+        }
+        
+        fast_audio::LoudnessMeter meter;
+        meter.configure(SAMPLE_RATE, CHANNELS);
+        if (!decode(source_path, meter) || meter.frames_measured() == 0) {
+            return loudness;
+        }
+        loudness.integrated_lufs = static_cast<float>(meter.integrated_lufs());
+        loudness.true_peak_db = static_cast<float>(meter.true_peak_db());
+        loudness.measured = loudness.save(sidecar_path, size, st.st_mtime);
+        return loudness;
+    }
+    
+private:
+    static std::string decoder_command() {
+        const char* command = std::getenv("LOUDNESS_DECODER");
+        return command ? command : "ffmpeg -v error -i {input} -f f32le -ac 2 -ar 48000 -";
+    }
+    
+    static bool decode(const std::string& input, fast_audio::LoudnessMeter& meter) {
+        // Close-on-exec, so decoders started by other threads do not inherit
+        // the write end and hold this pipe open
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0) return false;
+        const pid_t pid = spawn_command(expand_command(decoder_command(), {{"{input}", input}}), fds[1]);
+        ::close(fds[1]);
+        if (pid < 0) {
+            ::close(fds[0]);
+            return false;
+        }
+        std::FILE* pipe = fdopen(fds[0], "r");
+        if (!pipe) {
+            ::close(fds[0]);
+            wait_command(pid);
+            return false;
+        }
+        
+        std::vector<float> buffer(4096 * CHANNELS);
+        for (size_t frames; (frames = std::fread(buffer.data(), sizeof(float) * CHANNELS, 4096, pipe)) > 0;) {
+            meter.add(buffer.data(), frames);
+        }
+        std::fclose(pipe);
+        return wait_command(pid);
+    }
+    
+    const std::string tracks_dir;
+};
+
+// Non-owning slice of a cached track. Copying a chunk only bumps the
+// track's refcount; the audio bytes themselves are never duplicated.
+class AudioChunk {
+public:
+    std::shared_ptr<const MappedTrack> track;
+    size_t offset = 0;
+    size_t size = 0;
+    std::chrono::milliseconds timestamp{0};
+    
+    AudioChunk() = default;
+    
+    AudioChunk(std::shared_ptr<const MappedTrack> source, size_t chunk_offset, size_t chunk_size) 
+        : track(std::move(source)), offset(chunk_offset), size(chunk_size) {
+        timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch());
+    }
+    
+    const uint8_t* data() const { return track->data() + offset; }
+    const std::string& get_track_id() const { return track->get_track_id(); }
+    frame_message::ptr prepared_frame() const { return track->prepared_frame(offset, size); }
+};
+
+// What a producer does when a session's chunk ring is full. There is no
+// blocking policy: the pacer both fills and drains a session's ring on one
+// thread, so waiting for the consumer could never end.
+enum class OverflowPolicy {
+    drop_oldest,   // Discard the oldest queued chunk to make room
+    backpressure   // Refuse the chunk; the pacer stops producing until the ring drains
+};
+
+// Fixed-capacity single-producer/single-consumer ring. Every slot carries a
+// sequence number (Vyukov-style), so the producer may also retire the oldest
+// entry for drop_oldest by claiming head with the same CAS the consumer uses.
+// That second popper is only safe because StreamingSession makes every push
+// and pop under its stream_mutex; a ring with a producer and a consumer on
+// different threads must not use drop_oldest. Head and tail live on their
+// own cache lines.
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t min_capacity)
+        : capacity(round_up_pow2(std::max<size_t>(min_capacity, 2))),
+          mask(capacity - 1),
+          slots(new Slot[capacity]) {
+        for (size_t i = 0; i < capacity; ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+    
+    // Producer only
+    bool try_push(T&& item) {
+        const size_t pos = tail.load(std::memory_order_relaxed);
+        Slot& slot = slots[pos & mask];
+        if (slot.sequence.load(std::memory_order_acquire) != pos) {
+            return false; // Full, or the consumer is still moving out of this slot
+        }
+        slot.value = std::move(item);
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        tail.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    
+    // Consumer, or the producer discarding the oldest entry
+    bool try_pop(T& out) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots[pos & mask];
+            const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(sequence - (pos + 1));
+            if (diff < 0) {
+                return false; // Empty
+            }
+            if (diff > 0) {
+                pos = head.load(std::memory_order_relaxed); // Someone else popped
+                continue;
+            }
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_acq_rel,
+                                           std::memory_order_relaxed)) {
+                out = std::move(slot.value);
+                slot.value = T(); // Drop the slot's references now, not on reuse
+                slot.sequence.store(pos + capacity, std::memory_order_release);
+                return true;
+            }
+        }
+    }
+    
+    size_t size() const {
+        const size_t t = tail.load(std::memory_order_acquire);
+        const size_t h = head.load(std::memory_order_acquire);
+        return t > h ? t - h : 0;
+    }
+    
+    size_t get_capacity() const { return capacity; }
+    
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    
+    static size_t round_up_pow2(size_t n) {
+        size_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+    
+    const size_t capacity;
+    const size_t mask;
+    std::unique_ptr<Slot[]> slots;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+// Receives paced chunks; implemented by the server on top of websocketpp.
+class ChunkSink {
+public:
+    virtual ~ChunkSink() = default;
+    virtual bool send_chunk(websocketpp::connection_hdl hdl, const AudioChunk& chunk) = 0;
+    
+    // Flow control hooks. A sink without an outbound queue reports it empty.
+    virtual size_t buffered_amount(websocketpp::connection_hdl) { return 0; }
+    virtual void disconnect(websocketpp::connection_hdl, const std::string& /*reason*/) {}
+    virtual void suggest_quality(websocketpp::connection_hdl, int32_t /*kbps*/) {}
+    virtual void announce_loudness(websocketpp::connection_hdl, const std::string& /*track_id*/,
+                                   const TrackLoudness&) {}
+};
+
+// Per-session limits on websocketpp's outbound queue. Above the high
+// watermark the session stops producing until the queue drains below the
+// low one; a client that stays stalled too long, or whose queue passes
+// max_buffered anyway (channel bursts, control replies), is disconnected.
+struct FlowLimits {
+    size_t high_watermark = 256 * 1024;
+    size_t low_watermark = 64 * 1024;
+    size_t max_buffered = 1024 * 1024;
+    std::chrono::seconds stall_timeout{20};
+    bool downgrade_quality = true; // Ask stalled clients to step down a rendition
+};
+
+// Anything the PacingScheduler can drive. pump() sends whatever is due at
+// `now` and returns the next send deadline, or time_point::max() when done.
+class PacedStream {
+public:
+    virtual ~PacedStream() = default;
+    virtual pacing_clock::time_point pump(pacing_clock::time_point now) = 0;
+
+private:
+    friend class PacingScheduler;
+    // Bumped on every schedule/cancel so stale wheel entries are ignored
+    std::atomic<uint64_t> pacing_generation{0};
+};
+
+// Hashed timer wheel on top of the server's asio io_service. One steady_timer
+// ticks the wheel; due streams are posted back to the io_service so whichever
+// io thread is free sends for them. No thread is ever parked on a stream.
+class PacingScheduler {
+public:
+    PacingScheduler(boost::asio::io_service& io,
+                    std::chrono::milliseconds tick = std::chrono::milliseconds(5),
+                    size_t slots = 1024)
+        : io_service(io), timer(io), tick_duration(tick), wheel(slots) {}
+
+    void start() {
+        std::lock_guard<std::mutex> lock(wheel_mutex);
+        origin = pacing_clock::now();
+        current_tick = 0;
+        running.store(true);
+        arm_timer();
+    }
+
+    void stop() {
+        running.store(false);
+        boost::system::error_code ec;
+        timer.cancel(ec);
+    }
+
+    void schedule(const std::shared_ptr<PacedStream>& stream, pacing_clock::time_point deadline) {
+        const uint64_t generation = ++stream->pacing_generation;
+        std::lock_guard<std::mutex> lock(wheel_mutex);
+        insert_locked(Entry{stream, generation, tick_for(deadline)});
+    }
+
+    void cancel(PacedStream& stream) {
+        ++stream.pacing_generation;
+    }
+
+    size_t scheduled_count() const { return scheduled.load(); }
+
+private:
+    struct Entry {
+        std::weak_ptr<PacedStream> stream;
+        uint64_t generation;
+        uint64_t due_tick;
+    };
+
+    uint64_t tick_for(pacing_clock::time_point deadline) const {
+        if (deadline <= origin) return 0;
+        return static_cast<uint64_t>((deadline - origin) / tick_duration);
+    }
+
+    void insert_locked(Entry&& entry) {
+        // Anything already due fires on the next tick
+        entry.due_tick = std::max(entry.due_tick, current_tick + 1);
+        wheel[entry.due_tick % wheel.size()].push_back(std::move(entry));
+        scheduled++;
+    }
+
+    void arm_timer() {
+        timer.expires_at(origin + tick_duration * (current_tick + 1));
+        timer.async_wait([this](const boost::system::error_code& ec) { this->on_tick(ec); });
+    }
+
+    void on_tick(const boost::system::error_code& ec) {
+        if (ec || !running.load()) return;
+
+        std::vector<Entry> due;
+        {
+            std::lock_guard<std::mutex> lock(wheel_mutex);
+            const uint64_t target = tick_for(pacing_clock::now());
+            // Catch up on every slot we slept through, but never lap the wheel
+            const uint64_t last = std::max(current_tick + 1,
+                                           std::min(target, current_tick + wheel.size()));
+            for (uint64_t t = current_tick + 1; t <= last; ++t) {
+                auto& slot = wheel[t % wheel.size()];
+                for (size_t i = 0; i < slot.size();) {
+                    if (slot[i].due_tick <= t) {
+                        due.push_back(std::move(slot[i]));
+                        slot[i] = std::move(slot.back());
+                        slot.pop_back();
+                        scheduled--;
+                    } else {
+                        ++i;
+                    }
+                }
+            }
+            current_tick = last;
+            arm_timer();
+        }
+
+        for (auto& entry : due) {
+            io_service.post([this, entry]() mutable { this->run_due(std::move(entry)); });
+        }
+    }
+
+    void run_due(Entry entry) {
+        auto stream = entry.stream.lock();
+        if (!stream || stream->pacing_generation.load() != entry.generation) return;
+
+        const auto next = stream->pump(pacing_clock::now());
+        if (next == pacing_clock::time_point::max() || !running.load()) return;
+
+        std::lock_guard<std::mutex> lock(wheel_mutex);
+        // A schedule()/cancel() that raced with the pump wins
+        if (stream->pacing_generation.load() != entry.generation) return;
+        entry.due_tick = tick_for(next);
+        insert_locked(std::move(entry));
+    }
+
+    boost::asio::io_service& io_service;
+    boost::asio::steady_timer timer;
+    const std::chrono::milliseconds tick_duration;
+    std::vector<std::vector<Entry>> wheel;
+    std::mutex wheel_mutex;
+    pacing_clock::time_point origin;
+    uint64_t current_tick = 0;
+    std::atomic<size_t> scheduled{0};
+    std::atomic<bool> running{false};
+};
+
+// Maps a track's byte offsets to wall-clock send deadlines. Media time comes
+// from the frame index, or from the first frame's bitrate for unindexed files.
+class StreamClock {
+public:
+    static constexpr double PREBUFFER_SECONDS = 1.0; // Lead over playback position
+    
+    void reset(const MappedTrack& track) {
+        bytes_per_second = estimate_bytes_per_second(track);
+        restart(0.0);
+    }
+    
+    // Anchors `media_seconds` to now
+    void restart(double media_seconds) {
+        stream_start = pacing_clock::now();
+        stream_origin = media_seconds;
+    }
+    
+    double media_time(const MappedTrack& track, size_t offset) const {
+        const FrameIndex& index = track.frame_index();
+        return index.empty() ? offset / bytes_per_second : index.time_at_offset(offset);
+    }
+    
+    // Media time a listener who started in sync is hearing at `now`
+    double playback_position(pacing_clock::time_point now) const {
+        return stream_origin + std::chrono::duration<double>(now - stream_start).count();
+    }
+    
+    // Start of the frame playing at `seconds`
+    size_t offset_for_time(const MappedTrack& track, double seconds) const {
+        const FrameIndex& index = track.frame_index();
+        return index.empty()
+            ? std::min(static_cast<size_t>(std::max(seconds, 0.0) * bytes_per_second), track.size())
+            : index.frame_offset_for_time(seconds);
+    }
+    
+    // First frame boundary at or after `offset`
+    size_t offset_at_or_after(const MappedTrack& track, size_t offset) const {
+        const FrameIndex& index = track.frame_index();
+        const size_t clamped = std::min(offset, track.size());
+        return index.empty() ? clamped : index.frame_offset_at_or_after(clamped);
+    }
+    
+    // Each byte is due PREBUFFER_SECONDS before the client will play it
+    pacing_clock::time_point deadline_for(const MappedTrack& track, size_t offset) const {
+        const double seconds = media_time(track, offset) - stream_origin - PREBUFFER_SECONDS;
+        return stream_start + std::chrono::duration_cast<pacing_clock::duration>(
+            std::chrono::duration<double>(seconds));
+    }
+    
+    // Length of the chunk starting at `offset`. After a seek or a late join
+    // the first chunk only runs up to the next grid boundary, so the rest
+    // line up with the track's shared prepared frames.
+    static size_t chunk_size_at(const MappedTrack& track, size_t offset) {
+        return std::min(STREAM_CHUNK_SIZE - offset % STREAM_CHUNK_SIZE, track.size() - offset);
+    }
+    
+private:
+    static constexpr double DEFAULT_BYTES_PER_SECOND = 128000 / 8.0;
+    
+    static double estimate_bytes_per_second(const MappedTrack& data) {
+        // Use the first valid frame header; fall back to 128 kbps
+        const uint32_t kbps = data.nominal_kbps();
+        return kbps ? kbps * 1000 / 8.0 : DEFAULT_BYTES_PER_SECOND;
+    }
+    
+    double bytes_per_second = DEFAULT_BYTES_PER_SECOND; // Only for tracks without a frame index
+    pacing_clock::time_point stream_start;
+    double stream_origin = 0.0; // Media time (seconds) that stream_start corresponds to
+};
+
+class StreamingSession : public PacedStream {
+private:
+    std::string session_id;
+    std::string user_id;
+    std::atomic<bool> is_active{true};
+    std::atomic<bool> paused{false};
+    
+    // Chunks produced by the pacer and not yet handed to the socket
+    SpscRing<AudioChunk> buffer;
+    const OverflowPolicy overflow_policy;
+    std::atomic<uint64_t> dropped_chunks{0};
+    std::atomic<uint64_t> backpressure_events{0};
+    std::atomic<size_t> buffer_high_water{0};
+    
+    // Pacing state, touched only by whoever holds stream_mutex
+    static constexpr std::chrono::milliseconds BACKPRESSURE_RETRY{50};
+    std::mutex stream_mutex;
+    std::shared_ptr<const MappedTrack> track;
+    size_t stream_offset = 0;
+    StreamClock clock;
+    std::atomic<pacing_clock::rep> next_deadline{pacing_clock::time_point::max().time_since_epoch().count()};
+    websocketpp::connection_hdl connection;
+    ChunkSink& sink;
+    
+    // Flow control against the socket's outbound queue, under stream_mutex
+    enum class FlowState { flowing, recovered, stalled, hopeless };
+    const FlowLimits flow_limits;
+    pacing_clock::time_point stalled_since = pacing_clock::time_point::max();
+    std::atomic<size_t> buffered_bytes{0};
+    std::atomic<size_t> peak_buffered_bytes{0};
+    std::atomic<uint64_t> stall_events{0};
+    std::atomic<int32_t> quality_kbps{0}; // Ceiling; 0: no preference
+    bool quality_from_backpressure = false;
+    uint64_t bytes_sent = 0;
+    
+    // Adaptive bitrate, under stream_mutex. `track` is always
+    // ladder[rendition] while a ladder is loaded.
+    static constexpr int32_t START_KBPS = 128;
+    static const int HEALTHY_SEGMENTS_TO_UPSWITCH = 3;
+    RenditionLadder ladder;
+    size_t rendition = 0;
+    size_t segment_end = 0; // Where the current segment stops in `track`
+    pacing_clock::time_point segment_started;
+    uint64_t drained_at_segment_start = 0;
+    int healthy_segments = 0;
+    std::atomic<int32_t> current_kbps{0};
+    std::atomic<uint64_t> rendition_switches{0};
+    
+public:
+    static const size_t DEFAULT_BUFFER_CAPACITY = 64; // Chunks in buffer
+    
+    StreamingSession(const std::string& sid, const std::string& uid,
+                     websocketpp::connection_hdl hdl, ChunkSink& chunk_sink,
+                     size_t buffer_capacity = DEFAULT_BUFFER_CAPACITY,
+                     OverflowPolicy policy = OverflowPolicy::backpressure,
+                     const FlowLimits& limits = FlowLimits()) 
+        : session_id(sid), user_id(uid), buffer(buffer_capacity), overflow_policy(policy),
+          connection(hdl), sink(chunk_sink), flow_limits(limits) {}
+    
+    // Producer side, under stream_mutex. Returns false only under backpressure.
+    bool add_chunk(AudioChunk chunk) {
+        while (!buffer.try_push(std::move(chunk))) {
+            if (overflow_policy == OverflowPolicy::drop_oldest) {
+                AudioChunk oldest;
+                if (buffer.try_pop(oldest)) {
+                    dropped_chunks++;
+                    ServerMetrics::add(ServerMetrics::CHUNKS_DROPPED);
+                }
+            } else {
+                backpressure_events++;
+                return false;
+            }
+        }
+        
+        const size_t depth = buffer.size();
+        if (depth > buffer_high_water.load(std::memory_order_relaxed)) {
+            buffer_high_water.store(depth, std::memory_order_relaxed);
+        }
+        return true;
+    }
+    
+    // Consumer side, under stream_mutex
+    bool get_next_chunk(AudioChunk& chunk) {
+        return buffer.try_pop(chunk);
+    }
+    
+    bool is_session_active() const { return is_active.load(); }
+    void terminate_session() { is_active.store(false); }
+    std::string get_session_id() const { return session_id; }
+    std::string get_user_id() const { return user_id; }
+    int get_buffer_size() const { return static_cast<int>(buffer.size()); }
+    size_t get_buffer_capacity() const { return buffer.get_capacity(); }
+    size_t get_buffer_high_water() const { return buffer_high_water.load(); }
+    uint64_t get_dropped_chunks() const { return dropped_chunks.load(); }
+    uint64_t get_backpressure_events() const { return backpressure_events.load(); }
+    size_t get_buffered_bytes() const { return buffered_bytes.load(); }
+    size_t get_peak_buffered_bytes() const { return peak_buffered_bytes.load(); }
+    uint64_t get_stall_events() const { return stall_events.load(); }
+    
+    int32_t get_quality() const { return quality_kbps.load(); }
+    void set_quality(int32_t kbps) {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        quality_kbps.store(kbps);
+        quality_from_backpressure = false;
+    }
+    int32_t get_current_kbps() const { return current_kbps.load(); }
+    uint64_t get_rendition_switches() const { return rendition_switches.load(); }
+    
+    // Replaces whatever is playing; the caller hands the session to the pacer.
+    // With a rendition ladder the session starts at a middle rung and then
+    // switches at segment boundaries as measured throughput allows.
+    void start_track(std::shared_ptr<const MappedTrack> mapped_track, RenditionLadder renditions = {}) {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        discard_buffered_chunks();
+        announce_loudness(*mapped_track);
+        ladder = std::move(renditions);
+        if (!ladder.empty()) {
+            rendition = 0;
+            const int32_t ceiling = quality_kbps.load();
+            const int32_t start = ceiling > 0 ? std::min(ceiling, START_KBPS) : START_KBPS;
+            while (rendition + 1 < ladder.size() && ladder[rendition + 1].kbps <= start) {
+                rendition++;
+            }
+            mapped_track = ladder[rendition].track;
+            current_kbps.store(ladder[rendition].kbps);
+        }
+        track = std::move(mapped_track);
+        stream_offset = 0;
+        clock.reset(*track);
+        begin_segment(pacing_clock::now());
+        next_deadline.store(pacing_clock::time_point::max().time_since_epoch().count());
+        paused.store(false);
+    }
+    
+    // Tells the client the track's normalization gain ahead of its first
+    // chunk. Renditions share the source's measurement, so pass the source.
+    void announce_loudness(const MappedTrack& source) {
+        if (source.loudness().measured) {
+            sink.announce_loudness(connection, source.get_track_id(), source.loudness());
+        }
+    }
+    
+    // Jumps to the frame playing at `seconds`. Returns false if nothing is loaded.
+    bool seek(double seconds) {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        if (!track) return false;
+        
+        discard_buffered_chunks();
+        stream_offset = clock.offset_for_time(*track, seconds);
+        clock.restart(clock.media_time(*track, stream_offset));
+        begin_segment(pacing_clock::now());
+        next_deadline.store(pacing_clock::time_point::max().time_since_epoch().count());
+        paused.store(false);
+        return true;
+    }
+    
+    // Parks the session; the pacer drops it until resume()
+    void pause() {
+        paused.store(true);
+    }
+    
+    // Continues where the stream stopped, or from the first frame at or after
+    // `offset` when one is given. The client still holds what was already
+    // sent, so no new prebuffer burst is needed.
+    bool resume(int64_t offset = -1) {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        if (!track) {
+            // Channel listeners rejoin the live stream; nothing to schedule
+            paused.store(false);
+            return false;
+        }
+        
+        if (offset >= 0) {
+            discard_buffered_chunks();
+            stream_offset = clock.offset_at_or_after(*track, static_cast<size_t>(offset));
+            clock.restart(clock.media_time(*track, stream_offset));
+        } else {
+            clock.restart(clock.media_time(*track, stream_offset) - StreamClock::PREBUFFER_SECONDS);
+        }
+        begin_segment(pacing_clock::now());
+        next_deadline.store(pacing_clock::time_point::max().time_since_epoch().count());
+        paused.store(false);
+        return true;
+    }
+    
+    bool is_paused() const { return paused.load(); }
+    
+    // Drops the current track and anything queued from it
+    void stop_track() {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        discard_buffered_chunks();
+        track.reset();
+        ladder.clear();
+        next_deadline.store(pacing_clock::time_point::max().time_since_epoch().count());
+    }
+    
+    // Pushes chunks produced elsewhere (a broadcast channel) straight through
+    // this session's ring to the socket. A listener too slow to keep up with
+    // a live channel loses chunks rather than stalling everyone else.
+    bool deliver(const AudioChunk* chunks, size_t count) {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        if (!is_session_active()) return false;
+        const FlowState flow = check_flow(pacing_clock::now());
+        if (flow == FlowState::hopeless) {
+            drop_slow_client();
+            return false;
+        }
+        if (is_paused() || flow == FlowState::stalled) {
+            // A live stream does not wait; a paused or stalled listener misses this stretch
+            dropped_chunks += count;
+            ServerMetrics::add(ServerMetrics::CHUNKS_DROPPED, count);
+            return true;
+        }
+        
+        for (size_t i = 0; i < count; ++i) {
+            if (!add_chunk(chunks[i])) {
+                dropped_chunks++;
+                ServerMetrics::add(ServerMetrics::CHUNKS_DROPPED);
+            }
+        }
+        return flush_buffered(nullptr);
+    }
+    
+    // When the pacer next needs to send for this session
+    pacing_clock::time_point get_next_send_deadline() const {
+        return pacing_clock::time_point(pacing_clock::duration(next_deadline.load()));
+    }
+    
+    pacing_clock::time_point pump(pacing_clock::time_point now) override {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        auto next = pacing_clock::time_point::max();
+        
+        const auto scheduled_for = get_next_send_deadline();
+        if (scheduled_for != pacing_clock::time_point::max() && now >= scheduled_for) {
+            ServerMetrics::record(ServerMetrics::PACING_JITTER, now - scheduled_for);
+        }
+        
+        if (is_session_active() && track && !is_paused()) {
+            const FlowState flow = check_flow(now);
+            if (flow == FlowState::hopeless) {
+                drop_slow_client();
+                discard_buffered_chunks();
+                track.reset();
+                next_deadline.store(next.time_since_epoch().count());
+                return next;
+            }
+            if (flow == FlowState::stalled) {
+                // Hold production until the client drains its queue
+                next = now + BACKPRESSURE_RETRY;
+                next_deadline.store(next.time_since_epoch().count());
+                return next;
+            }
+            if (flow == FlowState::recovered) {
+                // The client stalled too; carry on from here instead of
+                // bursting everything that fell due meanwhile
+                clock.restart(clock.media_time(*track, stream_offset) - StreamClock::PREBUFFER_SECONDS);
+            }
+            
+            bool sink_failed = false;
+            for (;;) {
+                // Queue every chunk whose deadline has passed
+                bool ring_full = false;
+                while (stream_offset < track->size()) {
+                    if (!ladder.empty() && stream_offset >= segment_end) {
+                        end_segment(now);
+                    }
+                    const auto due = clock.deadline_for(*track, stream_offset);
+                    if (due > now) {
+                        next = due;
+                        break;
+                    }
+                    
+                    size_t chunk_size = StreamClock::chunk_size_at(*track, stream_offset);
+                    if (!ladder.empty()) {
+                        // Never straddle a segment boundary, so a switch lands on one
+                        chunk_size = std::min(chunk_size, segment_end - stream_offset);
+                    }
+                    if (!add_chunk(AudioChunk(track, stream_offset, chunk_size))) {
+                        ring_full = true;
+                        break;
+                    }
+                    stream_offset += chunk_size;
+                }
+                
+                // Send chunk to client
+                size_t sent = 0;
+                if (!flush_buffered(&sent)) {
+                    sink_failed = true;
+                    break;
+                }
+                
+                if (!ring_full) break;
+                if (sent == 0) {
+                    // Nothing drained; come back once the consumer catches up
+                    next = now + BACKPRESSURE_RETRY;
+                    break;
+                }
+            }
+            
+            if (sink_failed) {
+                next = pacing_clock::time_point::max();
+            }
+            if (next == pacing_clock::time_point::max()) {
+                // Finished or failed; release the track
+                discard_buffered_chunks();
+                track.reset();
+            }
+        }
+        
+        next_deadline.store(next.time_since_epoch().count());
+        return next;
+    }
+    
+private:
+    FlowState check_flow(pacing_clock::time_point now) {
+        const size_t queued = sink.buffered_amount(connection);
+        buffered_bytes.store(queued, std::memory_order_relaxed);
+        if (queued > peak_buffered_bytes.load(std::memory_order_relaxed)) {
+            peak_buffered_bytes.store(queued, std::memory_order_relaxed);
+        }
+        
+        if (queued > flow_limits.max_buffered) {
+            return FlowState::hopeless;
+        }
+        if (stalled_since != pacing_clock::time_point::max()) {
+            if (queued > flow_limits.low_watermark) {
+                return now - stalled_since > flow_limits.stall_timeout ? FlowState::hopeless : FlowState::stalled;
+            }
+            stalled_since = pacing_clock::time_point::max();
+            return FlowState::recovered;
+        }
+        if (queued > flow_limits.high_watermark) {
+            stalled_since = now;
+            stall_events++;
+            ServerMetrics::add(ServerMetrics::BACKPRESSURE_STALLS);
+            if (flow_limits.downgrade_quality) {
+                downgrade_quality();
+            }
+            return FlowState::stalled;
+        }
+        return FlowState::flowing;
+    }
+    
+    // Steps the preferred rendition down one rung (320 -> 128 -> 64 kbps)
+    void downgrade_quality() {
+        const int32_t current = quality_kbps.load();
+        const int32_t lower = (current == 0 || current > 128) ? 128 : current > 64 ? 64 : 0;
+        if (lower == 0) return;
+        quality_kbps.store(lower);
+        quality_from_backpressure = true;
+        ServerMetrics::add(ServerMetrics::QUALITY_DOWNGRADES);
+        sink.suggest_quality(connection, lower);
+    }
+    
+    // Starts measuring a new segment at the current position
+    void begin_segment(pacing_clock::time_point now) {
+        if (ladder.empty()) return;
+        segment_started = now;
+        drained_at_segment_start = bytes_sent - std::min<uint64_t>(bytes_sent, buffered_bytes.load());
+        
+        const double position = clock.media_time(*track, stream_offset);
+        double boundary = (std::floor(position / SEGMENT_SECONDS + 1e-6) + 1) * SEGMENT_SECONDS;
+        segment_end = clock.offset_for_time(*track, boundary);
+        while (segment_end <= stream_offset && segment_end < track->size()) {
+            boundary += SEGMENT_SECONDS;
+            segment_end = clock.offset_for_time(*track, boundary);
+        }
+        if (segment_end <= stream_offset) {
+            segment_end = track->size();
+        }
+    }
+    
+    // At a segment boundary: pick the rendition for the next segment from
+    // what the client actually drained during this one
+    void end_segment(pacing_clock::time_point now) {
+        const double elapsed = std::chrono::duration<double>(now - segment_started).count();
+        const uint64_t drained = bytes_sent - std::min<uint64_t>(bytes_sent, buffered_bytes.load());
+        const double throughput_kbps = elapsed > 0.5
+            ? (drained - drained_at_segment_start) * 8 / 1000.0 / elapsed : 0.0;
+        
+        size_t target = rendition;
+        if (throughput_kbps > 0 && throughput_kbps < 0.9 * ladder[rendition].kbps) {
+            // Falling behind: the highest rung the link carries with headroom
+            target = 0;
+            while (target + 1 < rendition && ladder[target + 1].kbps <= 0.8 * throughput_kbps) {
+                target++;
+            }
+            healthy_segments = 0;
+        } else if (buffered_bytes.load() <= flow_limits.low_watermark) {
+            if (++healthy_segments >= HEALTHY_SEGMENTS_TO_UPSWITCH && rendition + 1 < ladder.size()) {
+                target = rendition + 1;
+                healthy_segments = 0;
+                // A ceiling imposed by an earlier stall lifts as the link proves itself
+                if (quality_from_backpressure && ladder[target].kbps > quality_kbps.load()) {
+                    const bool top = target + 1 == ladder.size();
+                    quality_kbps.store(top ? 0 : ladder[target].kbps);
+                    quality_from_backpressure = !top;
+                }
+            }
+        } else {
+            healthy_segments = 0;
+        }
+        
+        const int32_t ceiling = quality_kbps.load();
+        while (target > 0 && ceiling > 0 && ladder[target].kbps > ceiling) {
+            target--;
+        }
+        
+        if (target != rendition) {
+            // Same media time in the other rendition; frames line up across
+            // renditions, so this is also a segment boundary there
+            const double position = clock.media_time(*track, stream_offset);
+            rendition = target;
+            track = ladder[rendition].track;
+            stream_offset = clock.offset_for_time(*track, position);
+            current_kbps.store(ladder[rendition].kbps);
+            rendition_switches++;
+            ServerMetrics::add(ServerMetrics::RENDITION_SWITCHES);
+        }
+        begin_segment(now);
+    }
+    
+    void drop_slow_client() {
+        terminate_session();
+        ServerMetrics::add(ServerMetrics::SLOW_CLIENT_DISCONNECTS);
+        sink.disconnect(connection, "client too slow");
+    }
+    
+    // Hands queued chunks to the socket; false if the connection failed
+    bool flush_buffered(size_t* sent) {
+        AudioChunk chunk;
+        while (get_next_chunk(chunk)) {
+            if (!sink.send_chunk(connection, chunk)) {
+                return false;
+            }
+            bytes_sent += chunk.size;
+            if (sent) ++*sent;
+        }
+        return true;
+    }
+    
+    void discard_buffered_chunks() {
+        AudioChunk chunk;
+        while (buffer.try_pop(chunk)) {}
+    }
+};
+
+// A live stream shared by many sessions (radio, listening parties). The
+// channel is paced once; each due chunk is a single shared slice that every
+// subscriber queues, so the per-listener cost is a refcount and a socket
+// write regardless of audience size.
+class BroadcastChannel : public PacedStream {
+public:
+    BroadcastChannel(const std::string& id, std::shared_ptr<const MappedTrack> mapped_track)
+        : channel_id(id), track(std::move(mapped_track)) {
+        clock.reset(*track);
+    }
+    
+    // Late joiners start at the frame boundary nearest to what the channel
+    // is playing now and get the already-paced lead, then follow live
+    void subscribe(const std::shared_ptr<StreamingSession>& session) {
+        std::lock_guard<std::mutex> lock(channel_mutex);
+        subscribers.push_back(session);
+        session->announce_loudness(*track);
+        
+        const size_t join_offset = std::min(
+            clock.offset_for_time(*track, clock.playback_position(pacing_clock::now())), stream_offset);
+        std::array<AudioChunk, 16> catch_up;
+        size_t count = 0;
+        for (size_t offset = join_offset; offset < stream_offset;) {
+            const size_t size = std::min(StreamClock::chunk_size_at(*track, offset), stream_offset - offset);
+            catch_up[count++] = AudioChunk(track, offset, size);
+            offset += size;
+            if (count == catch_up.size() || offset == stream_offset) {
+                session->deliver(catch_up.data(), count);
+                count = 0;
+            }
+        }
+    }
+    
+    void unsubscribe(const StreamingSession& session) {
+        std::lock_guard<std::mutex> lock(channel_mutex);
+        subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(),
+            [&](const std::weak_ptr<StreamingSession>& weak) {
+                auto subscriber = weak.lock();
+                return !subscriber || subscriber.get() == &session;
+            }), subscribers.end());
+    }
+    
+    size_t subscriber_count() const {
+        std::lock_guard<std::mutex> lock(channel_mutex);
+        return subscribers.size();
+    }
+    
+    bool is_finished() const { return finished.load(); }
+    const std::string& get_channel_id() const { return channel_id; }
+    const std::string& get_track_id() const { return track->get_track_id(); }
+    
+    pacing_clock::time_point pump(pacing_clock::time_point now) override {
+        std::lock_guard<std::mutex> lock(channel_mutex);
+        std::array<AudioChunk, 16> due_chunks;
+        
+        if (scheduled_for != pacing_clock::time_point::max() && now >= scheduled_for) {
+            ServerMetrics::record(ServerMetrics::PACING_JITTER, now - scheduled_for);
+        }
+        
+        while (stream_offset < track->size()) {
+            size_t count = 0;
+            while (count < due_chunks.size() && stream_offset < track->size() &&
+                   clock.deadline_for(*track, stream_offset) <= now) {
+                const size_t size = StreamClock::chunk_size_at(*track, stream_offset);
+                due_chunks[count++] = AudioChunk(track, stream_offset, size);
+                stream_offset += size;
+            }
+            if (count == 0) {
+                scheduled_for = clock.deadline_for(*track, stream_offset);
+                return scheduled_for;
+            }
+            
+            // Fan out; closed or failed listeners drop off here
+            subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(),
+                [&](const std::weak_ptr<StreamingSession>& weak) {
+                    auto subscriber = weak.lock();
+                    return !subscriber || !subscriber->deliver(due_chunks.data(), count);
+                }), subscribers.end());
+        }
+        
+        finished.store(true);
+        scheduled_for = pacing_clock::time_point::max();
+        return scheduled_for;
+    }
+    
+private:
+    const std::string channel_id;
+    const std::shared_ptr<const MappedTrack> track;
+    mutable std::mutex channel_mutex;
+    size_t stream_offset = 0;
+    StreamClock clock;
+    pacing_clock::time_point scheduled_for = pacing_clock::time_point::max();
+    std::vector<std::weak_ptr<StreamingSession>> subscribers;
+    std::atomic<bool> finished{false};
+};
+
+// Session registry split into independently locked, cache-line aligned
+// shards. A lookup takes only its shard's reader lock, so message dispatch,
+// open/close storms and long-running streams for unrelated sessions never
+// serialize on one mutex.
+template <typename Key, typename T>
+class ShardedRegistry {
+public:
+    static const size_t SHARD_COUNT = 64;
+    
+    bool insert(const Key& key, std::shared_ptr<T> value) {
+        Shard& shard = shard_for(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        const bool inserted = shard.entries.emplace(key, std::move(value)).second;
+        if (inserted) {
+            count.fetch_add(1, std::memory_order_relaxed);
+        }
+        return inserted;
+    }
+    
+    std::shared_ptr<T> find(const Key& key) const {
+        const Shard& shard = shard_for(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        return it != shard.entries.end() ? it->second : nullptr;
+    }
+    
+    std::shared_ptr<T> erase(const Key& key) {
+        Shard& shard = shard_for(key);
+        std::shared_ptr<T> removed;
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end()) {
+            removed = std::move(it->second);
+            shard.entries.erase(it);
+            count.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return removed;
+    }
+    
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+    
+    // Visits every entry, one shard at a time
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (const Shard& shard : shards) {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            for (const auto& entry : shard.entries) {
+                fn(entry.first, entry.second);
+            }
+        }
+    }
+    
+private:
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<Key, std::shared_ptr<T>> entries;
+    };
+    
+    Shard& shard_for(const Key& key) {
+        return shards[shard_index(key)];
+    }
+    
+    const Shard& shard_for(const Key& key) const {
+        return shards[shard_index(key)];
+    }
+    
+    static size_t shard_index(const Key& key) {
+        // Fibonacci mix so aligned pointer keys still spread across shards
+        const uint64_t h = static_cast<uint64_t>(std::hash<Key>()(key)) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(h >> 58) % SHARD_COUNT;
+    }
+    
+    std::array<Shard, SHARD_COUNT> shards;
+    std::atomic<size_t> count{0};
+};
+
+// Sessions are keyed by the numeric part of their id (the connection address)
+typedef uintptr_t session_key;
+
+// Move-only void() callable stored inline. Anything that does not fit is a
+// compile error rather than a silent heap allocation.
+class InlineTask {
+public:
+    static const size_t CAPACITY = 48;
+    
+    InlineTask() = default;
+    
+    template <typename Fn, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<Fn>::type, InlineTask>::value>::type>
+    InlineTask(Fn&& fn) {
+        typedef typename std::decay<Fn>::type Callable;
+        static_assert(sizeof(Callable) <= CAPACITY, "task captures too much state");
+        static_assert(alignof(Callable) <= alignof(std::max_align_t), "task over-aligned");
+        new (&storage) Callable(std::forward<Fn>(fn));
+        invoke_fn = [](void* p) { (*static_cast<Callable*>(p))(); };
+        relocate_fn = [](void* dst, void* src) {
+            if (dst) new (dst) Callable(std::move(*static_cast<Callable*>(src)));
+            static_cast<Callable*>(src)->~Callable();
+        };
+    }
+    
+    InlineTask(InlineTask&& other) noexcept { take(other); }
+    
+    InlineTask& operator=(InlineTask&& other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+    
+    ~InlineTask() { reset(); }
+    
+    void operator()() { invoke_fn(&storage); }
+    explicit operator bool() const { return invoke_fn != nullptr; }
+    
+private:
+    void take(InlineTask& other) {
+        if (other.invoke_fn) {
+            other.relocate_fn(&storage, &other.storage);
+            invoke_fn = other.invoke_fn;
+            relocate_fn = other.relocate_fn;
+            other.invoke_fn = nullptr;
+            other.relocate_fn = nullptr;
+        }
+    }
+    
+    void reset() {
+        if (invoke_fn) {
+            relocate_fn(nullptr, &storage); // Destroy only
+            invoke_fn = nullptr;
+            relocate_fn = nullptr;
+        }
+    }
+    
+    typename std::aligned_storage<CAPACITY, alignof(std::max_align_t)>::type storage;
+    void (*invoke_fn)(void*) = nullptr;
+    void (*relocate_fn)(void*, void*) = nullptr;
+};
+
+// Worker pool with one queue pair per thread. Affine tasks (everything for
+// one session) always run, in order, on the worker that owns their key, so a
+// session's state stays in one core's cache. Unkeyed tasks go to a shared
+// deque that idle workers steal from.
+class WorkStealingExecutor {
+public:
+    struct Stats {
+        uint64_t executed;
+        uint64_t stolen;
+        size_t queue_depth;
+        double avg_wait_us;  // Enqueue to start of execution
+        double max_wait_us;
+    };
+    
+    explicit WorkStealingExecutor(unsigned num_workers)
+        : workers(std::max(1u, num_workers)) {
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].thread = std::thread([this, i] { this->worker_loop(i); });
+        }
+    }
+    
+    ~WorkStealingExecutor() {
+        stopping.store(true);
+        for (auto& worker : workers) {
+            {
+                std::lock_guard<std::mutex> lock(worker.mutex);
+            }
+            worker.wake.notify_all();
+        }
+        for (auto& worker : workers) {
+            if (worker.thread.joinable()) {
+                worker.thread.join();
+            }
+        }
+    }
     
-    AudioChunk(const std::vector<uint8_t>& chunk_data, const std::string& id) 
-        : data(chunk_data), size(chunk_data.size()), track_id(id) {
-        timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch());
+    void submit_affine(uint64_t affinity, InlineTask task) {
+        const uint64_t mixed = affinity * 0x9E3779B97F4A7C15ull;
+        push(workers[(mixed >> 32) % workers.size()], std::move(task), false);
     }
-};
-
-class StreamingSession {
+    
+    void submit(InlineTask task) {
+        const size_t target = next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+        push(workers[target], std::move(task), true);
+    }
+    
+    size_t worker_count() const { return workers.size(); }
+    
+    Stats get_stats() const {
+        Stats stats{0, 0, 0, 0.0, 0.0};
+        uint64_t wait_ns = 0;
+        uint64_t max_wait_ns = 0;
+        for (const auto& worker : workers) {
+            stats.executed += worker.executed.load(std::memory_order_relaxed);
+            stats.stolen += worker.stolen.load(std::memory_order_relaxed);
+            stats.queue_depth += worker.depth.load(std::memory_order_relaxed);
+            wait_ns += worker.wait_ns_total.load(std::memory_order_relaxed);
+            max_wait_ns = std::max(max_wait_ns, worker.wait_ns_max.load(std::memory_order_relaxed));
+        }
+        if (stats.executed > 0) {
+            stats.avg_wait_us = wait_ns / 1000.0 / stats.executed;
+        }
+        stats.max_wait_us = max_wait_ns / 1000.0;
+        return stats;
+    }
+    
 private:
-    std::string session_id;
-    std::string user_id;
-    std::queue<std::shared_ptr<AudioChunk>> buffer;
-    std::mutex buffer_mutex;
-    std::atomic<bool> is_active{true};
-    std::atomic<int> buffer_size{0};
-    static const int MAX_BUFFER_SIZE = 50; // Maximum chunks in buffer
+    struct QueuedTask {
+        InlineTask task;
+        pacing_clock::time_point enqueued;
+    };
     
-public:
-    StreamingSession(const std::string& sid, const std::string& uid) 
-        : session_id(sid), user_id(uid) {}
+    // Growable circular buffer; steady-state pushes and pops never allocate
+    class TaskDeque {
+    public:
+        bool empty() const { return count == 0; }
+        
+        void push_back(QueuedTask&& item) {
+            if (count == slots.size()) {
+                grow();
+            }
+            slots[(first + count) % slots.size()] = std::move(item);
+            count++;
+        }
+        
+        QueuedTask pop_front() {
+            QueuedTask item = std::move(slots[first]);
+            first = (first + 1) % slots.size();
+            count--;
+            return item;
+        }
+        
+        QueuedTask pop_back() {
+            count--;
+            return std::move(slots[(first + count) % slots.size()]);
+        }
+        
+    private:
+        void grow() {
+            std::vector<QueuedTask> bigger(std::max<size_t>(16, slots.size() * 2));
+            for (size_t i = 0; i < count; ++i) {
+                bigger[i] = std::move(slots[(first + i) % slots.size()]);
+            }
+            slots.swap(bigger);
+            first = 0;
+        }
+        
+        std::vector<QueuedTask> slots;
+        size_t first = 0;
+        size_t count = 0;
+    };
+    
+    struct alignas(64) Worker {
+        std::mutex mutex;
+        std::condition_variable wake;
+        TaskDeque affine;    // Owner only, FIFO
+        TaskDeque shared;    // Owner pops the front, thieves take the back
+        std::thread thread;
+        std::atomic<size_t> depth{0};
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> stolen{0};
+        std::atomic<uint64_t> wait_ns_total{0};
+        std::atomic<uint64_t> wait_ns_max{0};
+    };
+    
+    void push(Worker& worker, InlineTask&& task, bool stealable) {
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            (stealable ? worker.shared : worker.affine).push_back(
+                QueuedTask{std::move(task), pacing_clock::now()});
+            worker.depth.fetch_add(1, std::memory_order_relaxed);
+        }
+        worker.wake.notify_one();
+    }
+    
+    bool try_take_own(Worker& worker, QueuedTask& out) {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.affine.empty()) {
+            out = worker.affine.pop_front();
+        } else if (!worker.shared.empty()) {
+            out = worker.shared.pop_front();
+        } else {
+            return false;
+        }
+        worker.depth.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    
+    bool try_steal(size_t thief, QueuedTask& out) {
+        for (size_t i = 1; i < workers.size(); ++i) {
+            Worker& victim = workers[(thief + i) % workers.size()];
+            if (victim.depth.load(std::memory_order_relaxed) == 0) continue;
+            std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+            if (!lock.owns_lock() || victim.shared.empty()) continue;
+            out = victim.shared.pop_back();
+            victim.depth.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
     
-    bool add_chunk(std::shared_ptr<AudioChunk> chunk) {
-        std::lock_guard<std::mutex> lock(buffer_mutex);
-        if (buffer_size >= MAX_BUFFER_SIZE) {
-            // Remove oldest chunk if buffer is full
-            if (!buffer.empty()) {
-                buffer.pop();
-                buffer_size--;
+    void worker_loop(size_t index) {
+        Worker& self = workers[index];
+        QueuedTask item;
+        while (!stopping.load()) {
+            bool stolen = false;
+            if (!try_take_own(self, item)) {
+                stolen = try_steal(index, item);
+                if (!stolen) {
+                    // Sleep until work arrives; wake periodically to look for steals
+                    std::unique_lock<std::mutex> lock(self.mutex);
+                    self.wake.wait_for(lock, std::chrono::milliseconds(5), [&] {
+                        return stopping.load() || !self.affine.empty() || !self.shared.empty();
+                    });
+                    continue;
+                }
+            }
+            
+            const uint64_t waited = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                pacing_clock::now() - item.enqueued).count();
+            self.wait_ns_total.fetch_add(waited, std::memory_order_relaxed);
+            ServerMetrics::record(ServerMetrics::QUEUE_WAIT, waited / 1000);
+            if (waited > self.wait_ns_max.load(std::memory_order_relaxed)) {
+                self.wait_ns_max.store(waited, std::memory_order_relaxed);
+            }
+            
+            item.task();
+            item.task = InlineTask();
+            self.executed.fetch_add(1, std::memory_order_relaxed);
+            if (stolen) {
+                self.stolen.fetch_add(1, std::memory_order_relaxed);
             }
         }
-        buffer.push(chunk);
-        buffer_size++;
+    }
+    
+    std::vector<Worker> workers;
+    std::atomic<size_t> next_worker{0};
+    std::atomic<bool> stopping{false};
+};
+
+// Local HTTP scrape endpoint (/metrics in Prometheus text format, /health).
+// It runs on its own io_context and thread so scrapes never share a thread
+// with audio delivery.
+class MetricsEndpoint {
+public:
+    typedef std::function<void(std::string&)> GaugeWriter;
+    
+    explicit MetricsEndpoint(GaugeWriter gauges)
+        : acceptor(io), gauge_writer(std::move(gauges)) {}
+    
+    ~MetricsEndpoint() { stop(); }
+    
+    bool start(const std::string& address, uint16_t port) {
+        boost::system::error_code ec;
+        const tcp::endpoint endpoint(boost::asio::ip::make_address(address, ec), port);
+        if (!ec) acceptor.open(endpoint.protocol(), ec);
+        if (!ec) acceptor.set_option(boost::asio::socket_base::reuse_address(true), ec);
+        if (!ec) acceptor.bind(endpoint, ec);
+        if (!ec) acceptor.listen(boost::asio::socket_base::max_listen_connections, ec);
+        if (ec) {
+            std::cerr << "Metrics endpoint unavailable on " << address << ":" << port
+                      << ": " << ec.message() << std::endl;
+            return false;
+        }
+        
+        accept_next();
+        worker = std::thread([this] { io.run(); });
         return true;
     }
     
-    std::shared_ptr<AudioChunk> get_next_chunk() {
-        std::lock_guard<std::mutex> lock(buffer_mutex);
-        if (buffer.empty()) {
-            return nullptr;
+    void stop() {
+        io.stop();
+        if (worker.joinable()) {
+            worker.join();
         }
-        auto chunk = buffer.front();
-        buffer.pop();
-        buffer_size--;
-        return chunk;
     }
     
-    bool is_session_active() const { return is_active.load(); }
-    void terminate_session() { is_active.store(false); }
-    std::string get_session_id() const { return session_id; }
-    std::string get_user_id() const { return user_id; }
-    int get_buffer_size() const { return buffer_size.load(); }
+private:
+    typedef boost::asio::ip::tcp tcp;
+    
+    struct Exchange {
+        explicit Exchange(tcp::socket socket) : stream(std::move(socket)) {}
+        boost::beast::tcp_stream stream;
+        boost::beast::flat_buffer buffer;
+        boost::beast::http::request<boost::beast::http::string_body> request;
+        boost::beast::http::response<boost::beast::http::string_body> response;
+    };
+    
+    void accept_next() {
+        acceptor.async_accept([this](boost::system::error_code ec, tcp::socket socket) {
+            if (!ec) {
+                serve(std::make_shared<Exchange>(std::move(socket)));
+            }
+            if (acceptor.is_open()) {
+                accept_next();
+            }
+        });
+    }
+    
+    // One request per connection; scrapers reconnect every interval anyway
+    void serve(const std::shared_ptr<Exchange>& exchange) {
+        namespace http = boost::beast::http;
+        exchange->stream.expires_after(std::chrono::seconds(5));
+        http::async_read(exchange->stream, exchange->buffer, exchange->request,
+            [this, exchange](boost::system::error_code ec, size_t) {
+                if (ec) return;
+                respond(*exchange);
+                http::async_write(exchange->stream, exchange->response,
+                    [exchange](boost::system::error_code, size_t) {
+                        boost::system::error_code ignored;
+                        exchange->stream.socket().shutdown(tcp::socket::shutdown_send, ignored);
+                    });
+            });
+    }
+    
+    void respond(Exchange& exchange) {
+        namespace http = boost::beast::http;
+        auto& response = exchange.response;
+        response.version(exchange.request.version());
+        response.keep_alive(false);
+        
+        const auto target = exchange.request.target();
+        if (exchange.request.method() != http::verb::get) {
+            response.result(http::status::method_not_allowed);
+        } else if (target == "/metrics") {
+            response.result(http::status::ok);
+            response.set(http::field::content_type, "text/plain; version=0.0.4");
+            ServerMetrics::write_prometheus(response.body());
+            gauge_writer(response.body());
+        } else if (target == "/health") {
+            response.result(http::status::ok);
+            response.set(http::field::content_type, "text/plain");
+            response.body() = "ok\n";
+        } else {
+            response.result(http::status::not_found);
+        }
+        response.prepare_payload();
+    }
+    
+    boost::asio::io_context io;
+    tcp::acceptor acceptor;
+    GaugeWriter gauge_writer;
+    std::thread worker;
 };
 
-class HighPerformanceStreamingServer {
+class HighPerformanceStreamingServer : public ChunkSink {
 private:
     typedef websocketpp::server<websocketpp::config::asio> server;
     typedef server::message_ptr message_ptr;
     
     server ws_server;
-    std::map<std::string, std::shared_ptr<StreamingSession>> active_sessions;
-    std::mutex sessions_mutex;
+    ShardedRegistry<session_key, StreamingSession> active_sessions;
     std::atomic<bool> is_running{false};
     
-    // Thread pool for handling streaming
-    std::vector<std::thread> worker_threads;
-    std::queue<std::function<void()>> task_queue;
-    std::mutex queue_mutex;
-    std::condition_variable cv;
-    std::atomic<bool> stop_workers{false};
+    // Control messages run on a work-stealing pool, pinned per session
+    std::unique_ptr<WorkStealingExecutor> executor;
+    
+    // Pacing runs on the websocket io_service, driven by a few io threads
+    std::unique_ptr<PacingScheduler> pacer;
+    std::vector<std::thread> io_threads;
+    
+    // Tracks are mapped once and shared by every listener
+    static const size_t TRACK_CACHE_BUDGET = size_t(1) << 30; // 1 GiB, mappings plus prepared frames
+    TrackCache track_cache;
+    RenditionBuilder rendition_builder; // Fills in missing ABR renditions
+    
+    // Broadcast channels by id, and which channel each listening session is in
+    std::mutex channels_mutex;
+    std::unordered_map<std::string, std::shared_ptr<BroadcastChannel>> channels;
+    std::unordered_map<const StreamingSession*, std::shared_ptr<BroadcastChannel>> channel_members;
+    
+    // Scrape endpoint; counters and histograms are recorded in ServerMetrics
+    std::unique_ptr<MetricsEndpoint> metrics_endpoint;
     
 public:
-    HighPerformanceStreamingServer() {
-        // Configure WebSocket server
-        ws_server.set_access_channels(websocketpp::log::alevel::all);
-        ws_server.clear_access_channels(websocketpp::log::alevel::frame_payload);
+    HighPerformanceStreamingServer()
+        : track_cache(audio_storage_path(), TRACK_CACHE_BUDGET),
+          rendition_builder(audio_storage_path()) {
+        // Configure WebSocket server. Its access log writes synchronously on
+        // the io threads; connection events go through AsyncLog instead.
+        ws_server.clear_access_channels(websocketpp::log::alevel::all);
         ws_server.init_asio();
+        pacer.reset(new PacingScheduler(ws_server.get_io_service()));
         
         // Set handlers
         ws_server.set_message_handler([this](websocketpp::connection_hdl hdl, message_ptr msg) {
@@ -112,20 +2660,16 @@ public:
         });
         
         // Initialize worker threads
-        const int num_workers = std::thread::hardware_concurrency();
-        for (int i = 0; i < num_workers; ++i) {
-            worker_threads.emplace_back([this] { this->worker_loop(); });
-        }
+        executor.reset(new WorkStealingExecutor(std::thread::hardware_concurrency()));
+        rendition_builder.start();
+        
+        metrics_endpoint.reset(new MetricsEndpoint([this](std::string& out) {
+            this->write_gauges(out);
+        }));
     }
     
     ~HighPerformanceStreamingServer() {
-        stop_workers.store(true);
-        cv.notify_all();
-        for (auto& thread : worker_threads) {
-            if (thread.joinable()) {
-                thread.join();
-            }
-        }
+        executor.reset(); // Joins the workers before anything they use goes away
     }
     
     void start_server(uint16_t port = 9001) {
@@ -133,195 +2677,701 @@ public:
         ws_server.start_accept();
         is_running.store(true);
         
+        pacer->start();
+        
+        const uint16_t metrics_port = metrics_port_from_env();
+        if (metrics_port != 0) {
+            metrics_endpoint->start(metrics_address_from_env(), metrics_port);
+        }
+        
         std::cout << "High-Performance Streaming Server started on port " << port << std::endl;
+        
+        const unsigned num_io_threads = std::min(4u, std::max(1u, std::thread::hardware_concurrency()));
+        for (unsigned i = 1; i < num_io_threads; ++i) {
+            io_threads.emplace_back([this] { ws_server.run(); });
+        }
         ws_server.run();
+        
+        for (auto& thread : io_threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
     }
     
     void stop_server() {
         is_running.store(false);
+        pacer->stop();
+        metrics_endpoint->stop();
         ws_server.stop();
+        AsyncLog::flush();
+    }
+    
+    bool send_chunk(websocketpp::connection_hdl hdl, const AudioChunk& chunk) override {
+        try {
+            // Whole chunks go out as the track's shared prepared frame; only
+            // odd-sized slices take websocketpp's copying send()
+            auto con = ws_server.get_con_from_hdl(hdl);
+            auto frame = chunk.prepared_frame();
+            const auto started = pacing_clock::now();
+            auto ec = frame ? con->send(frame)
+                            : con->send(chunk.data(), chunk.size, websocketpp::frame::opcode::binary);
+            ServerMetrics::record(ServerMetrics::SEND_LATENCY, pacing_clock::now() - started);
+            if (ec) {
+                ServerMetrics::add(ServerMetrics::SEND_ERRORS);
+                AsyncLog::error("Error sending chunk: " + ec.message());
+                return false;
+            }
+        } catch (const std::exception& e) {
+            ServerMetrics::add(ServerMetrics::SEND_ERRORS);
+            AsyncLog::error(std::string("Error sending chunk: ") + e.what());
+            return false;
+        }
+        ServerMetrics::add(ServerMetrics::CHUNKS_SENT);
+        ServerMetrics::add(ServerMetrics::BYTES_SENT, chunk.size);
+        return true;
+    }
+    
+    size_t buffered_amount(websocketpp::connection_hdl hdl) override {
+        websocketpp::lib::error_code ec;
+        auto con = ws_server.get_con_from_hdl(hdl, ec);
+        return (ec || !con) ? 0 : con->get_buffered_amount();
+    }
+    
+    void disconnect(websocketpp::connection_hdl hdl, const std::string& reason) override {
+        websocketpp::lib::error_code ec;
+        ws_server.close(hdl, websocketpp::close::status::try_again_later, reason, ec);
+        AsyncLog::info("Disconnecting slow client: " + reason);
+    }
+    
+    void suggest_quality(websocketpp::connection_hdl hdl, int32_t kbps) override {
+        // Tells the client which rendition to ask for next
+        websocketpp::lib::error_code ec;
+        ws_server.send(hdl, "{\"event\":\"quality\",\"kbps\":" + std::to_string(kbps) +
+                            ",\"reason\":\"backpressure\"}", websocketpp::frame::opcode::text, ec);
+    }
+    
+    void announce_loudness(websocketpp::connection_hdl hdl, const std::string& track_id,
+                           const TrackLoudness& loudness) override {
+        // The client applies gain_db and limits what would then pass its
+        // true-peak ceiling
+        char levels[96];
+        std::snprintf(levels, sizeof(levels), "\"lufs\":%.2f,\"peak_db\":%.2f,\"gain_db\":%.2f",
+                      loudness.integrated_lufs, loudness.true_peak_db, loudness.gain_db());
+        websocketpp::lib::error_code ec;
+        ws_server.send(hdl, "{\"event\":\"loudness\",\"track_id\":\"" + track_id + "\"," + levels + "}",
+                       websocketpp::frame::opcode::text, ec);
     }
     
 private:
     void on_open(websocketpp::connection_hdl hdl) {
         // Create new streaming session
         auto con = ws_server.get_con_from_hdl(hdl);
-        std::string session_id = generate_session_id();
+        std::string session_id = extract_session_id(con);
         std::string user_id = extract_user_id_from_headers(con);
         
-        auto session = std::make_shared<StreamingSession>(session_id, user_id);
-        
-        std::lock_guard<std::mutex> lock(sessions_mutex);
-        active_sessions[session_id] = session;
+        auto session = std::make_shared<StreamingSession>(session_id, user_id, hdl, *this);
+        active_sessions.insert(get_session_key(con), session);
+        ServerMetrics::add(ServerMetrics::SESSIONS_OPENED);
         
-        std::cout << "New streaming session created: " << session_id 
-                  << " for user: " << user_id << std::endl;
+        AsyncLog::info("New streaming session created: " + session_id + " for user: " + user_id);
     }
     
     void on_close(websocketpp::connection_hdl hdl) {
         // Clean up session
         auto con = ws_server.get_con_from_hdl(hdl);
-        std::string session_id = extract_session_id(con);
-        
-        std::lock_guard<std::mutex> lock(sessions_mutex);
-        auto it = active_sessions.find(session_id);
-        if (it != active_sessions.end()) {
-            it->second->terminate_session();
-            active_sessions.erase(it);
-            std::cout << "Streaming session closed: " << session_id << std::endl;
+        auto session = active_sessions.erase(get_session_key(con));
+        if (session) {
+            session->terminate_session();
+            pacer->cancel(*session);
+            leave_channel(*session);
+            ServerMetrics::add(ServerMetrics::SESSIONS_CLOSED);
+            AsyncLog::info("Streaming session closed: " + session->get_session_id());
         }
     }
     
     void on_message(websocketpp::connection_hdl hdl, message_ptr msg) {
         // Handle client requests (play, pause, seek, etc.)
         try {
-            std::string payload = msg->get_payload();
             auto con = ws_server.get_con_from_hdl(hdl);
-            std::string session_id = extract_session_id(con);
-            
-            // Add task to worker queue
-            {
-                std::lock_guard<std::mutex> lock(queue_mutex);
-                task_queue.push([this, session_id, payload, hdl]() {
-                    this->handle_streaming_request(session_id, payload, hdl);
-                });
+            session_key key = get_session_key(con);
+            auto session = active_sessions.find(key);
+            if (!session) {
+                return;
             }
-            cv.notify_one();
+            
+            // The task holds the message itself, so the payload is never copied
+            executor->submit_affine(key, [this, session, msg]() {
+                this->handle_streaming_request(session, msg->get_payload());
+            });
             
         } catch (const std::exception& e) {
-            std::cerr << "Error handling message: " << e.what() << std::endl;
+            AsyncLog::error(std::string("Error handling message: ") + e.what());
         }
     }
     
-    void handle_streaming_request(const std::string& session_id, 
-                                const std::string& request, 
-                                websocketpp::connection_hdl hdl) {
-        std::lock_guard<std::mutex> lock(sessions_mutex);
-        auto it = active_sessions.find(session_id);
-        if (it == active_sessions.end()) {
+    void handle_streaming_request(const std::shared_ptr<StreamingSession>& session, 
+                                const std::string& request) {
+        if (!session->is_session_active()) {
             return;
         }
         
-        auto session = it->second;
+        ServerMetrics::add(ServerMetrics::CONTROL_MESSAGES);
+        ControlMessage message;
+        if (!ControlParser::parse(request, message)) {
+            ServerMetrics::add(ServerMetrics::MALFORMED_MESSAGES);
+            AsyncLog::error("Malformed control message from " + session->get_session_id());
+            return;
+        }
         
-        // Parse request (JSON format expected)
-        // For now, simulate streaming audio chunks
-        if (request.find("\"action\":\"play\"") != std::string::npos) {
-            std::string track_id = extract_track_id_from_request(request);
-            start_streaming_track(session, track_id, hdl);
-        } else if (request.find("\"action\":\"pause\"") != std::string::npos) {
-            pause_streaming(session);
+        switch (message.action) {
+            case ControlAction::play:
+                leave_channel(*session);
+                start_streaming_track(session, message.track_id.empty()
+                                               ? std::string("default_track")
+                                               : std::string(message.track_id));
+                break;
+            case ControlAction::pause:
+                pause_streaming(session);
+                break;
+            case ControlAction::resume:
+                if (session->resume(message.offset)) {
+                    pacer->schedule(session, pacing_clock::now());
+                }
+                break;
+            case ControlAction::seek:
+                if (message.position_ms >= 0 && session->seek(message.position_ms / 1000.0)) {
+                    pacer->schedule(session, pacing_clock::now());
+                }
+                break;
+            case ControlAction::stop:
+                leave_channel(*session);
+                pacer->cancel(*session);
+                session->stop_track();
+                break;
+            case ControlAction::set_quality:
+                if (message.quality_kbps > 0) {
+                    session->set_quality(message.quality_kbps);
+                }
+                break;
+            case ControlAction::join:
+                join_channel(session, std::string(message.channel_id), std::string(message.track_id));
+                break;
+            case ControlAction::leave:
+                leave_channel(*session);
+                break;
+            default:
+                AsyncLog::error(std::string("Unsupported action '") + ControlParser::action_name(message.action)
+                                + "' from " + session->get_session_id());
+                break;
         }
     }
     
     void start_streaming_track(std::shared_ptr<StreamingSession> session,
-                             const std::string& track_id,
-                             websocketpp::connection_hdl hdl) {
-        // Simulate loading and streaming audio file
+                             const std::string& track_id) {
         // In production, this would load from storage/CDN
-        std::vector<uint8_t> audio_data = load_audio_file(track_id);
+        auto track = track_cache.acquire(track_id);
+        if (!track) {
+            AsyncLog::error("Track not available: " + track_id);
+            return;
+        }
         
-        // Stream in chunks
-        const size_t CHUNK_SIZE = 4096; // 4KB chunks
-        for (size_t i = 0; i < audio_data.size(); i += CHUNK_SIZE) {
-            if (!session->is_session_active()) break;
-            
-            size_t chunk_size = std::min(CHUNK_SIZE, audio_data.size() - i);
-            std::vector<uint8_t> chunk_data(audio_data.begin() + i, 
-                                          audio_data.begin() + i + chunk_size);
-            
-            auto chunk = std::make_shared<AudioChunk>(chunk_data, track_id);
-            session->add_chunk(chunk);
-            
-            // Send chunk to client
-            try {
-                ws_server.get_con_from_hdl(hdl)->send(chunk_data.data(), 
-                                                    chunk_data.size(), 
-                                                    websocketpp::frame::opcode::binary);
-            } catch (const std::exception& e) {
-                std::cerr << "Error sending chunk: " << e.what() << std::endl;
-                break;
+        // Tracks without current renditions play at their source bitrate
+        // until the builder has rendered them, or for good when there is
+        // nothing to render with
+        bool missing = false;
+        auto ladder = track_cache.acquire_ladder(track_id, track, RenditionBuilder::stand_in_enabled(), missing);
+        if (missing && RenditionBuilder::can_render()) {
+            rendition_builder.enqueue(track_id);
+        }
+        
+        // Chunks are sent from the pacer at the track's bitrate; this
+        // worker is free again as soon as the session is scheduled
+        session->start_track(std::move(track), std::move(ladder));
+        pacer->schedule(session, pacing_clock::now());
+    }
+    
+    // Moves the session onto a shared live stream. The first join with a
+    // track_id starts the channel; later joins only need the channel id.
+    void join_channel(const std::shared_ptr<StreamingSession>& session,
+                      const std::string& channel_id, const std::string& track_id) {
+        if (channel_id.empty()) {
+            return;
+        }
+        
+        pacer->cancel(*session);
+        session->stop_track();
+        leave_channel(*session);
+        
+        // Map the track before taking channels_mutex: a cold track means an
+        // mmap and an index scan, and on_close waits on that lock
+        std::shared_ptr<const MappedTrack> track;
+        if (!track_id.empty() && !find_live_channel(channel_id)) {
+            track = track_cache.acquire(track_id);
+            if (!track) {
+                AsyncLog::error("Track not available: " + track_id);
+                return;
             }
-            
-            // Throttle streaming to match audio playback rate
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
+        
+        std::shared_ptr<BroadcastChannel> channel;
+        {
+            std::lock_guard<std::mutex> lock(channels_mutex);
+            // The join runs on the executor and may lose a race with on_close,
+            // which marks the session inactive before it calls leave_channel
+            if (!session->is_session_active()) {
+                return;
+            }
+            auto it = channels.find(channel_id);
+            if (it != channels.end() && !it->second->is_finished()) {
+                channel = it->second;
+            } else if (track) {
+                if (it != channels.end()) {
+                    pacer->cancel(*it->second);
+                }
+                channel = std::make_shared<BroadcastChannel>(channel_id, std::move(track));
+                channels[channel_id] = channel;
+                pacer->schedule(channel, pacing_clock::now());
+            } else {
+                AsyncLog::error("No such channel: " + channel_id);
+                return;
+            }
+            // Subscribed in the same critical section, so a concurrent
+            // leave_channel either sees the membership or runs before it
+            channel_members[session.get()] = channel;
+            channel->subscribe(session);
+        }
+        
+        AsyncLog::info("Session " + session->get_session_id() + " joined channel " + channel_id +
+                       " (" + std::to_string(channel->subscriber_count()) + " listeners)");
     }
     
-    void pause_streaming(std::shared_ptr<StreamingSession> session) {
-        // Implementation for pausing stream
-        std::cout << "Pausing stream for session: " << session->get_session_id() << std::endl;
+    std::shared_ptr<BroadcastChannel> find_live_channel(const std::string& channel_id) {
+        std::lock_guard<std::mutex> lock(channels_mutex);
+        auto it = channels.find(channel_id);
+        return it != channels.end() && !it->second->is_finished() ? it->second : nullptr;
     }
     
-    std::vector<uint8_t> load_audio_file(const std::string& track_id) {
-        // Simulate loading audio file
-        // In production, this would load from distributed storage
-        std::string file_path = "/audio/tracks/" + track_id + ".mp3";
-        std::ifstream file(file_path, std::ios::binary);
-        
-        if (!file.is_open()) {
-            // Return empty vector if file not found
-            return std::vector<uint8_t>();
+    // Channels stop pacing once their last listener is gone
+    void leave_channel(const StreamingSession& session) {
+        std::lock_guard<std::mutex> lock(channels_mutex);
+        auto member = channel_members.find(&session);
+        if (member == channel_members.end()) {
+            return;
         }
         
-        file.seekg(0, std::ios::end);
-        size_t file_size = file.tellg();
-        file.seekg(0, std::ios::beg);
+        auto channel = std::move(member->second);
+        channel_members.erase(member);
+        channel->unsubscribe(session);
+        if (channel->subscriber_count() == 0) {
+            pacer->cancel(*channel);
+            auto it = channels.find(channel->get_channel_id());
+            if (it != channels.end() && it->second == channel) {
+                channels.erase(it);
+            }
+        }
+    }
+    
+    void pause_streaming(std::shared_ptr<StreamingSession> session) {
+        // Parked sessions hold no wheel slot and no thread until resumed
+        session->pause();
+        pacer->cancel(*session);
+        AsyncLog::info("Pausing stream for session: " + session->get_session_id());
+    }
+    
+    // Gauges and component stats that live outside ServerMetrics
+    void write_gauges(std::string& out) {
+        size_t channel_count = 0;
+        {
+            std::lock_guard<std::mutex> lock(channels_mutex);
+            channel_count = channels.size();
+        }
+        const auto cache = track_cache.get_stats();
+        size_t buffered_total = 0;
+        size_t buffered_max = 0;
+        active_sessions.for_each([&](session_key, const std::shared_ptr<StreamingSession>& session) {
+            const size_t buffered = session->get_buffered_bytes();
+            buffered_total += buffered;
+            buffered_max = std::max(buffered_max, buffered);
+        });
+        const auto work = executor->get_stats();
         
-        std::vector<uint8_t> buffer(file_size);
-        file.read(reinterpret_cast<char*>(buffer.data()), file_size);
+        const struct {
+            const char* name;
+            const char* type;
+            double value;
+        } metrics[] = {
+            {"catch_active_sessions", "gauge", static_cast<double>(active_sessions.size())},
+            {"catch_broadcast_channels", "gauge", static_cast<double>(channel_count)},
+            {"catch_session_buffered_bytes", "gauge", static_cast<double>(buffered_total)},
+            {"catch_session_buffered_bytes_max", "gauge", static_cast<double>(buffered_max)},
+            {"catch_paced_streams", "gauge", static_cast<double>(pacer->scheduled_count())},
+            {"catch_track_cache_hits_total", "counter", static_cast<double>(cache.hits)},
+            {"catch_track_cache_misses_total", "counter", static_cast<double>(cache.misses)},
+            {"catch_track_cache_evictions_total", "counter", static_cast<double>(cache.evictions)},
+            {"catch_track_cache_tracks", "gauge", static_cast<double>(cache.cached_tracks)},
+            {"catch_track_cache_bytes", "gauge", static_cast<double>(cache.cached_bytes)},
+            {"catch_control_tasks_executed_total", "counter", static_cast<double>(work.executed)},
+            {"catch_control_tasks_stolen_total", "counter", static_cast<double>(work.stolen)},
+            {"catch_control_queue_depth", "gauge", static_cast<double>(work.queue_depth)},
+            {"catch_log_lines_dropped_total", "counter", static_cast<double>(AsyncLog::dropped_lines())},
+        };
         
-        return buffer;
+        char line[160];
+        for (const auto& metric : metrics) {
+            std::snprintf(line, sizeof(line), "# TYPE %s %s\n%s %.17g\n",
+                          metric.name, metric.type, metric.name, metric.value);
+            out += line;
+        }
     }
     
-    void worker_loop() {
-        while (!stop_workers.load()) {
-            std::function<void()> task;
-            {
-                std::unique_lock<std::mutex> lock(queue_mutex);
-                cv.wait(lock, [this] { return !task_queue.empty() || stop_workers.load(); });
-                
-                if (stop_workers.load()) break;
-                
-                task = std::move(task_queue.front());
-                task_queue.pop();
-            }
-            task();
-        }
+    // METRICS_PORT=0 disables the endpoint; it binds to loopback unless
+    // METRICS_ADDRESS says otherwise
+    static uint16_t metrics_port_from_env() {
+        const char* port = std::getenv("METRICS_PORT");
+        return (port && *port) ? static_cast<uint16_t>(std::atoi(port)) : 9100;
+    }
+    
+    static std::string metrics_address_from_env() {
+        const char* address = std::getenv("METRICS_ADDRESS");
+        return (address && *address) ? address : "127.0.0.1";
     }
     
-    std::string generate_session_id() {
-        // Generate unique session ID
-        return "session_" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count());
+public:
+    static std::string audio_storage_path() {
+        const char* path = std::getenv("AUDIO_STORAGE_PATH");
+        return (path && *path) ? path : "/audio";
     }
     
+private:
     std::string extract_user_id_from_headers(server::connection_ptr con) {
         // Extract user ID from connection headers/auth
         return "user_" + std::to_string(std::rand());
     }
     
+    session_key get_session_key(const server::connection_ptr& con) {
+        return reinterpret_cast<session_key>(con.get());
+    }
+    
     std::string extract_session_id(server::connection_ptr con) {
         // Extract session ID from connection
-        return "session_" + std::to_string(reinterpret_cast<uintptr_t>(con.get()));
+        return "session_" + std::to_string(get_session_key(con));
+    }
+};
+
+#ifdef CATCH_COUNT_ALLOCATIONS
+// Counts heap allocations on the pacer's hot path: slicing a cached track,
+// queueing the chunk and fetching its shared frame for sending.
+class AllocationBenchmark : public ChunkSink {
+public:
+    int run() {
+        const std::string root = "/tmp/catch_bench_audio";
+        const size_t track_size = 8 * 1024 * 1024;
+        if (!write_dummy_track(root, track_size)) {
+            std::cerr << "Could not create benchmark track under " << root << std::endl;
+            return 1;
+        }
+        
+        TrackCache cache(root, track_size * 2);
+        auto session = std::make_shared<StreamingSession>("bench", "bench", websocketpp::connection_hdl(), *this);
+        
+        // First pass builds the prepared frames; the second is steady state
+        for (int pass = 0; pass < 2; ++pass) {
+            session->start_track(cache.acquire("bench_track"));
+            chunks_sent = 0;
+            const uint64_t before = heap_allocations;
+            const auto start = pacing_clock::now();
+            // Drive the session the way the pacer does, jumping straight to each deadline
+            for (auto next = start; next != pacing_clock::time_point::max();) {
+                next = session->pump(next);
+            }
+            const double seconds = std::chrono::duration<double>(pacing_clock::now() - start).count();
+            const uint64_t allocations = heap_allocations - before;
+            
+            std::cout << (pass == 0 ? "cold" : "warm") << ": " << chunks_sent << " chunks, "
+                      << allocations << " allocations ("
+                      << double(allocations) / std::max<uint64_t>(chunks_sent, 1) << " per chunk), "
+                      << chunks_sent / seconds << " chunks/s" << std::endl;
+        }
+        return 0;
+    }
+    
+    bool send_chunk(websocketpp::connection_hdl, const AudioChunk& chunk) override {
+        sent_frames[chunks_sent++ % sent_frames.size()] = chunk.prepared_frame();
+        return true;
+    }
+    
+private:
+    static bool write_dummy_track(const std::string& root, size_t size) {
+        mkdir(root.c_str(), 0755);
+        mkdir((root + "/tracks").c_str(), 0755);
+        std::FILE* file = std::fopen((root + "/tracks/bench_track.mp3").c_str(), "wb");
+        if (!file) return false;
+        std::vector<uint8_t> bytes(size, 0);
+        const bool ok = std::fwrite(bytes.data(), 1, size, file) == size;
+        std::fclose(file);
+        return ok;
+    }
+    
+    uint64_t chunks_sent = 0;
+    std::array<frame_message::ptr, 64> sent_frames; // Stand-in for the socket's send queue
+};
+#endif
+
+// Lookup throughput of the session registry at 100k sessions, with one
+// thread churning open/close the whole time, against the old single mutex
+// over std::map.
+class RegistryBenchmark : public ChunkSink {
+public:
+    int run() {
+        const size_t num_sessions = 100000;
+        const size_t lookups_per_thread = 2000000;
+        const unsigned num_readers = std::max(2u, std::thread::hardware_concurrency());
+        
+        std::vector<session_key> keys(num_sessions);
+        std::vector<std::shared_ptr<StreamingSession>> sessions(num_sessions);
+        for (size_t i = 0; i < num_sessions; ++i) {
+            keys[i] = 0x10000 + i * 64; // Spaced like heap addresses
+            sessions[i] = std::make_shared<StreamingSession>("bench", "bench", websocketpp::connection_hdl(), *this, 2);
+        }
+        
+        ShardedRegistry<session_key, StreamingSession> registry;
+        std::map<session_key, std::shared_ptr<StreamingSession>> baseline;
+        std::mutex baseline_mutex;
+        for (size_t i = 0; i < num_sessions; ++i) {
+            registry.insert(keys[i], sessions[i]);
+            baseline[keys[i]] = sessions[i];
+        }
+        
+        report("sharded registry", num_readers, lookups_per_thread, keys,
+               [&](session_key key) { return registry.find(key); },
+               [&](session_key key, bool open) {
+                   if (open) registry.insert(key, sessions[0]);
+                   else registry.erase(key);
+               });
+        report("mutex + std::map", num_readers, lookups_per_thread, keys,
+               [&](session_key key) {
+                   std::lock_guard<std::mutex> lock(baseline_mutex);
+                   auto it = baseline.find(key);
+                   return it != baseline.end() ? it->second : nullptr;
+               },
+               [&](session_key key, bool open) {
+                   std::lock_guard<std::mutex> lock(baseline_mutex);
+                   if (open) baseline[key] = sessions[0];
+                   else baseline.erase(key);
+               });
+        return 0;
     }
     
-    std::string extract_track_id_from_request(const std::string& request) {
-        // Parse track ID from JSON request
-        size_t pos = request.find("\"track_id\":\"");
-        if (pos != std::string::npos) {
-            pos += 12; // Length of "track_id":""
-            size_t end = request.find("\"", pos);
-            if (end != std::string::npos) {
-                return request.substr(pos, end - pos);
+    bool send_chunk(websocketpp::connection_hdl, const AudioChunk&) override { return true; }
+    
+private:
+    template <typename Lookup, typename Churn>
+    static void report(const char* name, unsigned num_readers, size_t lookups_per_thread,
+                       const std::vector<session_key>& keys, Lookup lookup, Churn churn) {
+        std::atomic<bool> done{false};
+        std::atomic<uint64_t> churn_ops{0};
+        std::thread churner([&] {
+            // Open/close storm on keys outside the looked-up set
+            for (session_key key = 1; !done.load(std::memory_order_relaxed); key = key % 4096 + 1) {
+                churn(key, true);
+                churn(key, false);
+                churn_ops.fetch_add(2, std::memory_order_relaxed);
             }
+        });
+        
+        std::atomic<uint64_t> found{0};
+        const auto start = pacing_clock::now();
+        std::vector<std::thread> readers;
+        for (unsigned t = 0; t < num_readers; ++t) {
+            readers.emplace_back([&, t] {
+                std::mt19937_64 rng(t + 1);
+                uint64_t hits = 0;
+                for (size_t i = 0; i < lookups_per_thread; ++i) {
+                    if (lookup(keys[rng() % keys.size()])) hits++;
+                }
+                found.fetch_add(hits);
+            });
+        }
+        for (auto& reader : readers) {
+            reader.join();
         }
-        return "default_track";
+        const double seconds = std::chrono::duration<double>(pacing_clock::now() - start).count();
+        done.store(true);
+        churner.join();
+        
+        const double total = double(num_readers) * lookups_per_thread;
+        std::cout << name << ": " << keys.size() << " sessions, " << num_readers << " threads, "
+                  << total / seconds / 1e6 << " M lookups/s, "
+                  << churn_ops.load() / seconds / 1e3 << " k open/close per s"
+                  << (found.load() == total ? "" : " (MISSING ENTRIES)") << std::endl;
     }
 };
 
+// Control messages parsed per second on one core, over a mix of key
+// orders, whitespace and ignored fields.
+int run_parser_benchmark() {
+    const std::string_view messages[] = {
+        R"({"action":"play","track_id":"track_0001"})",
+        R"({ "track_id" : "track_0002", "action" : "play", "client" : {"os": "ios", "v": [1, 2, 3]} })",
+        R"({"action":"seek","track_id":"track_0003","position_ms":93500})",
+        R"({"action": "seek", "position": 12.25})",
+        R"({"action":"pause"})",
+        "{\n  \"action\": \"resume\",\n  \"offset\": 1048576\n}",
+        R"({"action":"set-quality","quality":"low","reason":"network \"slow\""})",
+        R"({"action":"stop","ts":1.7e12,"extra":null,"flags":[true,false]})"
+    };
+    const size_t iterations = 2000000;
+    
+    ControlMessage message;
+    uint64_t parsed = 0;
+    uint64_t checksum = 0;
+    const auto start = pacing_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        for (const auto& json : messages) {
+            if (ControlParser::parse(json, message)) {
+                parsed++;
+                checksum += static_cast<uint64_t>(message.action) + message.track_id.size();
+            }
+        }
+    }
+    const double seconds = std::chrono::duration<double>(pacing_clock::now() - start).count();
+    const size_t total = iterations * (sizeof(messages) / sizeof(messages[0]));
+    
+    std::cout << "control parser: " << total / seconds / 1e6 << " M messages/s per core ("
+              << parsed << "/" << total << " parsed, checksum " << checksum << ")" << std::endl;
+    return parsed == total ? 0 : 1;
+}
+
+int run_benchmark(const std::string& name) {
+    if (name == "registry") {
+        return RegistryBenchmark().run();
+    }
+    if (name == "parser") {
+        return run_parser_benchmark();
+    }
+#ifdef CATCH_COUNT_ALLOCATIONS
+    if (name == "alloc") {
+        return AllocationBenchmark().run();
+    }
+#endif
+    std::cerr << "Unknown benchmark: " << name << std::endl;
+    return 1;
+}
+
+// The requested track ids, or every track in the storage root if none were
+// given. False if the tracks directory cannot be listed.
+static bool list_tracks(const std::string& root, const std::vector<std::string>& requested,
+                        std::vector<std::string>& track_ids) {
+    track_ids = requested;
+    if (!track_ids.empty()) {
+        return true;
+    }
+    DIR* dir = opendir((root + "/tracks").c_str());
+    if (!dir) {
+        std::cerr << "Cannot list " << root << "/tracks" << std::endl;
+        return false;
+    }
+    while (dirent* entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".mp3") == 0) {
+            track_ids.push_back(name.substr(0, name.size() - 4));
+        }
+    }
+    closedir(dir);
+    return true;
+}
+
+// Renders the ABR renditions of the given tracks, or of every track in the
+// storage root, ahead of time
+int build_renditions(const std::vector<std::string>& requested) {
+    const std::string root = HighPerformanceStreamingServer::audio_storage_path();
+    std::vector<std::string> track_ids;
+    if (!list_tracks(root, requested, track_ids)) {
+        return 1;
+    }
+    
+    if (!RenditionBuilder::can_render()) {
+        std::cerr << "Set RENDITION_ENCODER, or RENDITION_STAND_IN=1 for framing-only stand-ins" << std::endl;
+        return 1;
+    }
+    
+    RenditionBuilder builder(root);
+    int failures = 0;
+    for (const auto& track_id : track_ids) {
+        const bool ok = builder.build(track_id);
+        std::cout << (ok ? "built " : "FAILED ") << track_id << std::endl;
+        failures += ok ? 0 : 1;
+    }
+    return failures ? 1 : 0;
+}
+
+// Measures the loudness of the given tracks, or of every track in the
+// storage root, with one decode per core. Tracks whose sidecar is current
+// are skipped, so re-running after adding tracks only measures the new ones.
+int analyze_loudness(const std::vector<std::string>& requested) {
+    const std::string root = HighPerformanceStreamingServer::audio_storage_path();
+    std::vector<std::string> track_ids;
+    if (!list_tracks(root, requested, track_ids)) {
+        return 1;
+    }
+    
+    const LoudnessAnalyzer analyzer(root);
+    std::atomic<size_t> next{0};
+    std::atomic<int> failures{0};
+    std::mutex output_mutex;
+    const size_t worker_count = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(),
+                                                                     track_ids.size()));
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < worker_count; ++w) {
+        workers.emplace_back([&] {
+            for (size_t i; (i = next.fetch_add(1)) < track_ids.size();) {
+                const TrackLoudness loudness = analyzer.analyze(track_ids[i]);
+                failures += loudness.measured ? 0 : 1;
+                
+                std::lock_guard<std::mutex> lock(output_mutex);
+                if (loudness.measured) {
+                    std::cout << "analyzed " << track_ids[i] << ": " << loudness.integrated_lufs << " LUFS, "
+                              << loudness.true_peak_db << " dBTP, gain " << loudness.gain_db() << " dB" << std::endl;
+                } else {
+                    std::cout << "FAILED " << track_ids[i] << std::endl;
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return failures ? 1 : 0;
+}
+
 } // namespace catch_streaming
 
-int main() {
+#ifdef CATCH_COUNT_ALLOCATIONS
+void* operator new(std::size_t size) {
+    catch_streaming::heap_allocations++;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#endif
+
+
+int main(int argc, char** argv) {
+    if (argc > 2 && std::string(argv[1]) == "--bench") {
+        return catch_streaming::run_benchmark(argv[2]);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--build-renditions") {
+        return catch_streaming::build_renditions(std::vector<std::string>(argv + 2, argv + argc));
+    }
+    if (argc > 1 && std::string(argv[1]) == "--analyze-loudness") {
+        return catch_streaming::analyze_loudness(std::vector<std::string>(argv + 2, argv + argc));
+    }
+    
     try {
         catch_streaming::HighPerformanceStreamingServer server;
         server.start_server(9001);
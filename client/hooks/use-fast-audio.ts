@@ -212,11 +212,12 @@ export function useAudioSpectrum(
       analyzerRef.current = analyzer;
       sourceRef.current = source;
 
+      // The engine runs its own FFT, so feed it raw samples, reusing one buffer
+      const dataArray = new Float32Array(analyzer.fftSize);
+
       const updateSpectrum = () => {
         if (analyzerRef.current) {
-          const bufferLength = analyzerRef.current.frequencyBinCount;
-          const dataArray = new Float32Array(bufferLength);
-          analyzerRef.current.getFloatFrequencyData(dataArray);
+          analyzerRef.current.getFloatTimeDomainData(dataArray);
 
           // Use fast C++ engine for enhanced spectrum processing
           const enhancedSpectrum = fastAudio.getSpectrumData(
@@ -29,20 +29,93 @@ export interface AudioProcessor {
     pitchFactor: number,
   ): void;
   getSpectrumData(samples: VectorFloat, fftSize?: number): VectorFloat;
+  configureSpectrum(fftSize: number, buckets: number): void;
+  setSpectrumSmoothing(amount: number): void;
+  analyzeSpectrum(count: number): number;
+  getSpectrumInputView(): Float32Array;
+  getSpectrumBinsView(): Float32Array;
+  getSpectrumView(): Float32Array;
   getPerformanceMetrics(): number;
   setVolume(volume: number): void;
   setSpeed(speed: number): void;
+  setPitch(factor: number): void;
+  resetStream(): boolean;
   setMuted(muted: boolean): void;
+  // Loudness normalization from the server's "loudness" event; gains
+  // that would push the true peak past -1 dBFS are limited, not clipped
+  setTrackGain(gainDb: number, truePeakDb: number): void;
+  clearTrackGain(): void;
   setEqualizerBand(band: number, gain: number): void;
+  setSampleRate(hz: number): void;
   getVolume(): number;
   getSpeed(): number;
+  getPitch(): number;
   isMuted(): boolean;
+  getTrackGain(): number;
   getEqualizerSettings(): VectorFloat;
+  getKernelName(): string;
+
+  // Zero-copy io: write input/aux views, call a process method, read the
+  // output view. Views detach (length 0) when the heap grows; re-fetch them.
+  reserveBuffers(frames: number): void;
+  getInputView(): Float32Array;
+  getAuxView(): Float32Array;
+  getOutputView(): Float32Array;
+  // Planar multichannel: one view per channel; vector calls take interleaved data
+  setChannelCount(channels: number): void;
+  getChannelCount(): number;
+  getInputChannelView(channel: number): Float32Array;
+  getAuxChannelView(channel: number): Float32Array;
+  getOutputChannelView(channel: number): Float32Array;
+  // Streaming: write interleaved frames to the stream input view and
+  // enqueue them; the audio thread renders one quantum per renderStream
+  getStreamInputView(): Float32Array;
+  enqueueStream(frames: number): number;
+  renderStream(): number;
+  streamBuffered(): number;
+  flushStream(): boolean;
+  // Gapless track queue: enqueue a track (trims are encoder delay and
+  // padding in frames, gain and peak as for setTrackGain, 0 and -120 when
+  // unmeasured), then write its interleaved frames through the track
+  // input view; renderTracks renders one quantum of the mix
+  enqueueTrack(
+    frames: number,
+    leadingTrim: number,
+    trailingTrim: number,
+    crossfadeFrames: number,
+    gainDb: number,
+    truePeakDb: number,
+  ): number;
+  getTrackInputView(): Float32Array;
+  writeTrack(id: number, frames: number): number;
+  trackWritable(id: number): number;
+  renderTracks(): number;
+  stopTracks(): boolean;
+  getCurrentTrack(): number;
+  getInputPointer(): number;
+  getOutputPointer(): number;
+  processBlock(): number;
+  pushInput(frames: number): number;
+  outputAvailable(): number;
+  renderBlock(): number;
+  processBuffer(frames: number): number;
+  crossfadeBuffers(frames: number, fadeRatio: number): void;
+  pitchShiftBuffer(frames: number, pitchFactor: number): number;
+  getUnderruns(): number;
+  // Only in the pthreads build (fast_audio_threads.js)
+  startBackgroundAnalysis?(fftSize: number, buckets: number): void;
+  stopBackgroundAnalysis?(): void;
+  // The publish after next overwrites the view's buffer: fetch it per read,
+  // copy it, and keep the copy only if the generation is unchanged afterwards
+  getBackgroundSpectrumView?(): Float32Array;
+  getBackgroundSpectrumGeneration?(): number;
 }
 
 export interface StreamOptimizer {
   compressAudioChunk(samples: VectorFloat): VectorUint8;
   decompressAudioChunk(compressed: VectorUint8): VectorFloat;
+  setQuantizationBits(bits: number): void;
+  getQuantizationBits(): number;
 }
 
 export interface VectorFloat {
@@ -71,6 +144,9 @@ class FastAudioEngine {
   private audioWorklet: AudioWorkletNode | null = null;
   private isInitialized = false;
   private performanceMonitor: PerformanceMonitor;
+  private spectrumFftSize = 0;
+  private spectrumInput: Float32Array | null = null;
+  private spectrumBins: Float32Array | null = null;
 
   constructor() {
     this.performanceMonitor = new PerformanceMonitor();
@@ -121,25 +197,142 @@ class FastAudioEngine {
           getSpectrumData() {
             return { size: () => 0, get: () => 0, delete: () => {} };
           }
+          configureSpectrum() {}
+          setSpectrumSmoothing() {}
+          analyzeSpectrum() {
+            return 0;
+          }
+          getSpectrumInputView() {
+            return new Float32Array(0);
+          }
+          getSpectrumBinsView() {
+            return new Float32Array(0);
+          }
+          getSpectrumView() {
+            return new Float32Array(0);
+          }
           getPerformanceMetrics() {
             return 0;
           }
           setVolume() {}
           setSpeed() {}
+          setPitch() {}
+          resetStream() {
+            return true;
+          }
           setMuted() {}
+          setTrackGain() {}
+          clearTrackGain() {}
           setEqualizerBand() {}
+          setSampleRate() {}
           getVolume() {
             return 1;
           }
           getSpeed() {
             return 1;
           }
+          getPitch() {
+            return 1;
+          }
           isMuted() {
             return false;
           }
+          getTrackGain() {
+            return 0;
+          }
           getEqualizerSettings() {
             return { size: () => 8, get: () => 1, delete: () => {} };
           }
+          getKernelName() {
+            return "javascript";
+          }
+          reserveBuffers() {}
+          getInputView() {
+            return new Float32Array(0);
+          }
+          getAuxView() {
+            return new Float32Array(0);
+          }
+          getOutputView() {
+            return new Float32Array(0);
+          }
+          setChannelCount() {}
+          getChannelCount() {
+            return 1;
+          }
+          getInputChannelView() {
+            return new Float32Array(0);
+          }
+          getAuxChannelView() {
+            return new Float32Array(0);
+          }
+          getOutputChannelView() {
+            return new Float32Array(0);
+          }
+          getStreamInputView() {
+            return new Float32Array(0);
+          }
+          enqueueStream() {
+            return 0;
+          }
+          renderStream() {
+            return 0;
+          }
+          streamBuffered() {
+            return 0;
+          }
+          flushStream() {
+            return true;
+          }
+          enqueueTrack() {
+            return -1;
+          }
+          getTrackInputView() {
+            return new Float32Array(0);
+          }
+          writeTrack() {
+            return 0;
+          }
+          trackWritable() {
+            return 0;
+          }
+          renderTracks() {
+            return 0;
+          }
+          stopTracks() {
+            return true;
+          }
+          getCurrentTrack() {
+            return -1;
+          }
+          getInputPointer() {
+            return 0;
+          }
+          getOutputPointer() {
+            return 0;
+          }
+          processBlock() {
+            return 0;
+          }
+          pushInput() {
+            return 0;
+          }
+          outputAvailable() {
+            return 0;
+          }
+          renderBlock() {
+            return 0;
+          }
+          processBuffer() {
+            return 0;
+          }
+          crossfadeBuffers() {}
+          pitchShiftBuffer() {
+            return 0;
+          }
+          getUnderruns() {
+            return 0;
+          }
         },
         StreamOptimizer: class {
           compressAudioChunk() {
@@ -148,6 +341,10 @@ class FastAudioEngine {
           decompressAudioChunk() {
             return { size: () => 0, get: () => 0, delete: () => {} };
           }
+          setQuantizationBits() {}
+          getQuantizationBits() {
+            return 16;
+          }
         },
         VectorFloat: class {
           constructor(data = []) {
@@ -198,6 +395,7 @@ class FastAudioEngine {
         latencyHint: "playback",
         sampleRate: 48000, // High quality sample rate
       });
+      this.audioProcessor.setSampleRate(this.audioContext.sampleRate);
 
       // Load and register audio worklet for background processing (optional)
       this.initializeAudioWorklet().catch(() => {
@@ -252,25 +450,35 @@ class FastAudioEngine {
     try {
       const startTime = performance.now();
 
-      // Convert to WASM vector
-      const inputVector = new this.wasmModule.VectorFloat(
-        Array.from(inputBuffer),
-      );
-      const outputVector = new this.wasmModule.VectorFloat([]);
-
-      // Process with C++ speed
-      this.audioProcessor.processAudioChunk(inputVector, outputVector);
-
-      // Convert back to Float32Array
-      const outputSize = outputVector.size();
-      const outputBuffer = new Float32Array(outputSize);
-      for (let i = 0; i < outputSize; i++) {
-        outputBuffer[i] = outputVector.get(i);
+      // Copy into the processor's wasm buffer in capacity-sized pieces; the
+      // output can be longer or shorter than the input while time-stretching
+      const processor = this.audioProcessor;
+      const pieces: Float32Array[] = [];
+      let total = 0;
+      for (let offset = 0; offset < inputBuffer.length; ) {
+        const inputView = processor.getInputView();
+        if (inputView.length === 0) {
+          return inputBuffer; // JavaScript fallback module has no wasm buffers
+        }
+        const frames = Math.min(inputView.length, inputBuffer.length - offset);
+        inputView.set(inputBuffer.subarray(offset, offset + frames));
+        const written = processor.processBuffer(frames);
+        pieces.push(processor.getOutputView().slice(0, written));
+        total += written;
+        offset += frames;
       }
 
-      // Clean up WASM vectors
-      inputVector.delete();
-      outputVector.delete();
+      let outputBuffer: Float32Array;
+      if (pieces.length === 1) {
+        outputBuffer = pieces[0];
+      } else {
+        outputBuffer = new Float32Array(total);
+        let position = 0;
+        for (const piece of pieces) {
+          outputBuffer.set(piece, position);
+          position += piece.length;
+        }
+      }
 
       // Record performance
       const processingTime = performance.now() - startTime;
@@ -358,30 +566,35 @@ class FastAudioEngine {
     }
 
     try {
-      const inputVector = new this.wasmModule.VectorFloat(
-        Array.from(audioBuffer),
-      );
-      const spectrumVector = this.audioProcessor.getSpectrumData(
-        inputVector,
-        fftSize,
-      );
-
-      const spectrumSize = spectrumVector.size();
-      const spectrum = new Float32Array(spectrumSize);
-      for (let i = 0; i < spectrumSize; i++) {
-        spectrum[i] = spectrumVector.get(i);
+      const processor = this.audioProcessor;
+      if (this.spectrumFftSize !== fftSize) {
+        processor.configureSpectrum(fftSize, 64);
+        this.spectrumFftSize = fftSize;
+        this.spectrumInput = null;
+      }
+      // Views onto wasm memory detach when the heap grows; re-fetch then
+      if (!this.spectrumInput || this.spectrumInput.length === 0) {
+        this.spectrumInput = processor.getSpectrumInputView();
+        this.spectrumBins = processor.getSpectrumBinsView();
       }
 
-      inputVector.delete();
-      spectrumVector.delete();
+      const count = Math.min(audioBuffer.length, this.spectrumInput.length);
+      this.spectrumInput.set(audioBuffer.subarray(audioBuffer.length - count));
+      processor.analyzeSpectrum(count);
 
-      return spectrum;
+      // Copy out so React state sees a new array each frame
+      return this.spectrumBins!.slice(0, fftSize / 2);
     } catch (error) {
       console.error("Spectrum analysis error:", error);
       return new Float32Array(fftSize / 2);
     }
   }
 
+  // Log-spaced 0..1 buckets from the last getSpectrumData call, no copy
+  getSpectrumBuckets(): Float32Array {
+    return this.audioProcessor?.getSpectrumView() ?? new Float32Array(0);
+  }
+
   // Real-time audio controls
   setVolume(volume: number): void {
     if (this.audioProcessor) {
@@ -395,6 +608,18 @@ class FastAudioEngine {
     }
   }
 
+  // Pitch factor independent of speed (2 = up an octave)
+  setPitch(factor: number): void {
+    if (this.audioProcessor) {
+      this.audioProcessor.setPitch(Math.max(0.5, Math.min(2, factor)));
+    }
+  }
+
+  // Call on seek so time-stretch state from the old position is dropped
+  resetStream(): void {
+    this.audioProcessor?.resetStream();
+  }
+
   setMuted(muted: boolean): void {
     if (this.audioProcessor) {
       this.audioProcessor.setMuted(muted);
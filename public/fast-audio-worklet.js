@@ -7,6 +7,16 @@ class FastAudioProcessor extends AudioWorkletProcessor {
 
     this.wasmModule = null;
     this.audioProcessor = null;
+    // Planar io views, one per channel, once the zero-copy API is available
+    this.channelCount = 0;
+    this.views = [];
+    // Set once the main thread starts posting PCM with "streamChunk"; the
+    // worklet then renders from the processor's stream ring, not its input
+    this.streaming = false;
+    // Set by the first "enqueueTrack"; the worklet then renders the track
+    // mix, and reports each track as it starts
+    this.playingTracks = false;
+    this.currentTrack = -1;
     this.initialized = false;
     this.bufferSize = 1024;
     this.sampleRate = globalThis.sampleRate || 48000;
@@ -30,6 +40,9 @@ class FastAudioProcessor extends AudioWorkletProcessor {
       const wasmModule = await import(wasmPath);
       this.wasmModule = await wasmModule.default();
       this.audioProcessor = new this.wasmModule.AudioProcessor();
+      if (typeof this.audioProcessor.setSampleRate === "function") {
+        this.audioProcessor.setSampleRate(this.sampleRate);
+      }
       this.initialized = true;
 
       // Notify main thread that we're ready
@@ -59,15 +72,117 @@ class FastAudioProcessor extends AudioWorkletProcessor {
       case "setMuted":
         this.audioProcessor.setMuted(data.value);
         break;
+      case "setTrackGain":
+        // gain_db and peak_db of the server's "loudness" event
+        if (typeof this.audioProcessor.setTrackGain === "function") {
+          this.audioProcessor.setTrackGain(data.gainDb, data.truePeakDb);
+        }
+        break;
       case "setEqualizer":
         this.audioProcessor.setEqualizerBand(data.band, data.gain);
         break;
+      case "setPitch":
+        this.audioProcessor.setPitch(data.value);
+        break;
+      case "streamChunk":
+        this.enqueueStream(data.samples, data.channels);
+        break;
+      case "flushStream":
+        this.audioProcessor.flushStream();
+        break;
+      case "enqueueTrack":
+        this.enqueueTrack(data);
+        break;
+      case "trackChunk":
+        this.writeTrack(data.id, data.samples, data.channels);
+        break;
+      case "stopTracks":
+        this.audioProcessor.stopTracks();
+        break;
       case "getPerformance":
         this.sendPerformanceMetrics();
         break;
     }
   }
 
+  // Cached per-channel io views. The processor is reconfigured when the
+  // channel count changes (all channels share its EQ and stretch state), and
+  // views are re-fetched when they detach (length 0) after the heap grows
+  channelViews(channels) {
+    if (channels !== this.channelCount) {
+      this.audioProcessor.setChannelCount(channels);
+      this.channelCount = channels;
+      this.views = [];
+    }
+    if (this.views.length === 0 || this.views[0].input.length === 0) {
+      this.views = [];
+      for (let channel = 0; channel < channels; channel++) {
+        this.views.push({
+          input: this.audioProcessor.getInputChannelView(channel),
+          output: this.audioProcessor.getOutputChannelView(channel),
+        });
+      }
+    }
+    return this.views;
+  }
+
+  // Interleaved PCM into the stream ring; reports back how much did not fit
+  // so the sender can retry it
+  enqueueStream(samples, channels) {
+    if (typeof this.audioProcessor.enqueueStream !== "function") return;
+    this.streaming = true;
+    this.channelViews(channels);
+    const frames = Math.floor(samples.length / channels);
+    let written = 0;
+    while (written < frames) {
+      const staging = this.audioProcessor.getStreamInputView();
+      const count = Math.min(frames - written, Math.floor(staging.length / channels));
+      staging.set(samples.subarray(written * channels, (written + count) * channels));
+      const accepted = this.audioProcessor.enqueueStream(count);
+      written += accepted;
+      if (accepted < count) break;
+    }
+    if (written < frames) {
+      this.port.postMessage({ type: "streamFull", rejectedFrames: frames - written });
+    }
+  }
+
+  // Queue a track for gapless playback; the id comes back with the
+  // caller's requestId, and its PCM follows as "trackChunk" messages.
+  // gainDb and truePeakDb come from the track's loudness event, if any
+  enqueueTrack(data) {
+    if (typeof this.audioProcessor.enqueueTrack !== "function") return;
+    this.playingTracks = true;
+    this.channelViews(data.channels);
+    const id = this.audioProcessor.enqueueTrack(
+      data.frames,
+      data.leadingTrim || 0,
+      data.trailingTrim || 0,
+      data.crossfadeFrames || 0,
+      data.gainDb || 0,
+      data.truePeakDb ?? -120,
+    );
+    this.port.postMessage({ type: "trackQueued", requestId: data.requestId, id });
+  }
+
+  // Interleaved PCM of one queued track; what does not fit yet is reported
+  // back, as for the stream
+  writeTrack(id, samples, channels) {
+    const frames = Math.floor(samples.length / channels);
+    let written = 0;
+    while (written < frames) {
+      const staging = this.audioProcessor.getTrackInputView();
+      const count = Math.min(frames - written, Math.floor(staging.length / channels));
+      staging.set(samples.subarray(written * channels, (written + count) * channels));
+      const accepted = this.audioProcessor.writeTrack(id, count);
+      written += accepted;
+      if (accepted < count) break;
+    }
+    if (written < frames) {
+      this.port.postMessage({ type: "trackFull", id, rejectedFrames: frames - written });
+    }
+  }
+
   sendPerformanceMetrics() {
     if (!this.audioProcessor) return;
 
@@ -96,11 +211,63 @@ class FastAudioProcessor extends AudioWorkletProcessor {
     const input = inputs[0];
     const output = outputs[0];
 
+    if ((this.streaming || this.playingTracks) && output.length > 0) {
+      // Source-driven: the ring holds the audio, the node needs no input
+      if (this.playingTracks) {
+        this.audioProcessor.renderTracks();
+        const current = this.audioProcessor.getCurrentTrack();
+        if (current !== this.currentTrack) {
+          this.currentTrack = current;
+          this.port.postMessage({ type: "trackStarted", id: current });
+        }
+      } else {
+        this.audioProcessor.renderStream();
+      }
+      const views = this.channelViews(this.channelCount);
+      for (let channel = 0; channel < output.length; channel++) {
+        const view = views[Math.min(channel, views.length - 1)].output;
+        output[channel].set(view.subarray(0, output[channel].length));
+      }
+      this.processedSamples += output[0].length * this.channelCount;
+      return true;
+    }
+
     if (input.length === 0 || output.length === 0) {
       return true;
     }
 
     try {
+      const zeroCopy =
+        typeof this.audioProcessor.setChannelCount === "function";
+
+      if (zeroCopy) {
+        // All channels straight through wasm memory: no allocation per block
+        const channels = Math.min(input.length, output.length);
+        const frames = input[0].length;
+        const views = this.channelViews(channels);
+        for (let channel = 0; channel < channels; channel++) {
+          views[channel].input.set(input[channel]);
+        }
+        // A render quantum always fills (silence on underrun); other sizes
+        // return however many frames the stretcher produced
+        let rendered = frames;
+        if (frames === 128) {
+          this.audioProcessor.processBlock();
+        } else {
+          rendered = this.audioProcessor.processBuffer(frames);
+        }
+        for (let channel = 0; channel < channels; channel++) {
+          const valid = Math.min(rendered, output[channel].length);
+          output[channel].set(views[channel].output.subarray(0, valid));
+          output[channel].fill(0, valid);
+        }
+        this.processedSamples += frames * channels;
+        if (this.processedSamples % (this.sampleRate * 2) === 0) {
+          this.sendPerformanceMetrics();
+        }
+        return true;
+      }
+
       // Process each channel
       for (
         let channel = 0;